@@ -0,0 +1,159 @@
+#include "bloom.h"
+#include <string.h>
+
+/* Bits per element at full capacity (before rounding the size up to a
+   power of two), and the number of bits set per element. */
+#define BITS_PER_ELEMENT    (10)
+#define HASHES              (7)
+
+/* The bits of an element all lie in one block of BLOCK_SIZE bytes (a
+   cache line), so that a test touches a single line of memory; within a
+   block, each bit is selected by BLOCK_SHIFT bits of the hash. */
+#define BLOCK_SIZE          (64)
+#define BLOCK_SHIFT         (9)
+#define MIN_BLOCKS          (8)
+
+struct bloom
+{
+    unsigned char   *bits;
+    size_t          size;       /* bytes of bits; a power of two */
+    size_t          capacity;
+    size_t          count;
+};
+
+
+/* FNV-1a prime */
+#define FNV_PRIME   (((unsigned long long)0x100UL << 32) | 0x1b3UL)
+
+/* Finalizer of MurmurHash3, which spreads FNV's weak low bits. */
+static unsigned long long mix(unsigned long long h)
+{
+    h ^= h >> 33;
+    h *= ((unsigned long long)0xff51afd7UL << 32) | 0xed558ccdUL;
+    h ^= h >> 33;
+    h *= ((unsigned long long)0xc4ceb9feUL << 32) | 0x1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Returns the size in bytes of a filter with the given capacity, or 0 if
+   that is too large. */
+static size_t filter_size(size_t capacity)
+{
+    size_t size = MIN_BLOCKS * BLOCK_SIZE;
+
+    while(size / BITS_PER_ELEMENT * 8 < capacity)
+    {
+        if(size > ((size_t)-1) / 4)
+            return 0;
+        size *= 2;
+    }
+    return size;
+}
+
+/* Returns the block of an element, and in `bits' the hash bits that
+   select the bits within the block. */
+static unsigned char *find_block(bloom_t b, unsigned long long hash,
+                                 unsigned long long *bits)
+{
+    unsigned long long h = mix(hash);
+
+    *bits = mix(h + 1);
+    return b->bits + (size_t)(h & (b->size / BLOCK_SIZE - 1)) * BLOCK_SIZE;
+}
+
+
+/*
+    Public functions
+*/
+
+bloom_t bloom_create(size_t capacity)
+{
+    bloom_t b;
+
+    if((b = (bloom_t)malloc(sizeof(struct bloom))) == NULL)
+        return NULL;
+    b->size     = filter_size(capacity);
+    b->capacity = capacity;
+    b->count    = 0;
+    if(b->size == 0 || (b->bits = (unsigned char*)calloc(b->size, 1)) == NULL)
+    {
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+bloom_t bloom_load(const void *data, size_t size, size_t capacity, size_t count)
+{
+    bloom_t b;
+
+    if(size != filter_size(capacity) || (b = bloom_create(capacity)) == NULL)
+        return NULL;
+    memcpy(b->bits, data, size);
+    b->count = count;
+    return b;
+}
+
+void bloom_destroy(bloom_t b)
+{
+    free(b->bits);
+    free(b);
+}
+
+unsigned long long bloom_hash(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char*)data;
+
+    while(size-- > 0)
+        hash = (hash ^ *p++) * FNV_PRIME;
+    return hash;
+}
+
+void bloom_add(bloom_t b, unsigned long long hash)
+{
+    unsigned long long bits;
+    unsigned char *block = find_block(b, hash, &bits);
+    int n, bit;
+
+    for(n = 0; n < HASHES; ++n, bits >>= BLOCK_SHIFT)
+    {
+        bit = (int)(bits & ((1 << BLOCK_SHIFT) - 1));
+        block[bit / 8] |= (unsigned char)(1 << (bit % 8));
+    }
+    ++b->count;
+}
+
+int bloom_test(bloom_t b, unsigned long long hash)
+{
+    unsigned long long bits;
+    unsigned char *block = find_block(b, hash, &bits);
+    int n, bit;
+
+    for(n = 0; n < HASHES; ++n, bits >>= BLOCK_SHIFT)
+    {
+        bit = (int)(bits & ((1 << BLOCK_SHIFT) - 1));
+        if(!(block[bit / 8] & (1 << (bit % 8))))
+            return 0;
+    }
+    return 1;
+}
+
+int bloom_full(bloom_t b)
+{
+    return b->count > b->capacity;
+}
+
+const void *bloom_data(bloom_t b, size_t *size)
+{
+    *size = b->size;
+    return b->bits;
+}
+
+void bloom_stats(bloom_t b, size_t *capacity, size_t *count)
+{
+    if(capacity != NULL)
+        *capacity = b->capacity;
+    if(count != NULL)
+        *count = b->count;
+}
@@ -0,0 +1,47 @@
+#ifndef BLOOM_H_INCLUDED
+#define BLOOM_H_INCLUDED
+
+#include <stdlib.h>
+
+/* A Bloom filter: a set of 64-bit hashes that may claim to hold hashes it
+   does not (about 1% of them, while it holds no more elements than its
+   capacity), but never misses one that was added. Elements cannot be
+   removed; the filter is rebuilt instead. */
+typedef struct bloom *bloom_t;
+
+/* Hash value to start from when hashing an element with bloom_hash() */
+#define BLOOM_HASH_INIT \
+    (((unsigned long long)0xcbf29ce4UL << 32) | 0x84222325UL)
+
+/* Creates an empty filter sized for `capacity' elements. */
+bloom_t bloom_create(size_t capacity);
+
+/* Recreates a filter from the bits returned by bloom_data(), for a filter
+   of the same capacity holding `count' elements. Returns NULL if the size
+   does not match or memory runs out. */
+bloom_t bloom_load(const void *data, size_t size, size_t capacity, size_t count);
+
+/* Destroys the filter and frees all memory associated with it. */
+void bloom_destroy(bloom_t b);
+
+/* Continues `hash' with `size' bytes of data. The result does not depend
+   on the platform, so that filters can be stored. */
+unsigned long long bloom_hash(unsigned long long hash, const void *data, size_t size);
+
+/* Adds an element. */
+void bloom_add(bloom_t b, unsigned long long hash);
+
+/* Returns 0 if the element was certainly not added, or 1 if it may have been. */
+int bloom_test(bloom_t b, unsigned long long hash);
+
+/* Returns non-zero if the filter holds more elements than its capacity. */
+int bloom_full(bloom_t b);
+
+/* Returns the bits of the filter and their size in bytes. */
+const void *bloom_data(bloom_t b, size_t *size);
+
+/* Retrieves the capacity and number of elements added; either pointer may
+   be NULL. */
+void bloom_stats(bloom_t b, size_t *capacity, size_t *count);
+
+#endif /* ndef BLOOM_H_INCLUDED */
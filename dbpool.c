@@ -0,0 +1,193 @@
+/* For pthreads */
+#define _POSIX_C_SOURCE 200112L
+
+#include "dbpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of readers if none is given */
+#define DEFAULT_READERS (8)
+
+struct reader
+{
+    db_t            db;         /* NULL until first used */
+    int             busy;
+    unsigned        purges;     /* value of pool->purges when handed out */
+};
+
+struct rdf_pool
+{
+    char            *filepath;
+    pthread_mutex_t lock;
+    pthread_cond_t  released;   /* broadcast when a handle is returned */
+
+    db_t            writer;
+    int             writer_busy;
+
+    struct reader   *readers;
+    int             nreaders;
+    unsigned        purges;     /* number of purges so far */
+};
+
+
+rdf_pool_t rdf_pool_open(const char *filepath, int readers)
+{
+    rdf_pool_t pool;
+
+    if(readers <= 0)
+        readers = DEFAULT_READERS;
+
+    if((pool = (rdf_pool_t)malloc(sizeof(struct rdf_pool))) == NULL)
+        return NULL;
+    memset(pool, 0, sizeof(struct rdf_pool));
+
+    pool->filepath = (char*)malloc(strlen(filepath) + 1);
+    pool->readers  = (struct reader*)calloc(readers, sizeof(struct reader));
+    if(pool->filepath == NULL || pool->readers == NULL)
+    {
+        free(pool->filepath);
+        free(pool->readers);
+        free(pool);
+        return NULL;
+    }
+    strcpy(pool->filepath, filepath);
+    pool->nreaders = readers;
+
+    /* The writer creates the database and switches it to WAL mode, so it
+       is opened before any reader. */
+    if((pool->writer = rdf_db_open_flags(filepath, RDF_OPEN_WAL)) == NULL)
+    {
+        free(pool->filepath);
+        free(pool->readers);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->released, NULL);
+
+    return pool;
+}
+
+void rdf_pool_close(rdf_pool_t pool)
+{
+    int n;
+
+    for(n = 0; n < pool->nreaders; ++n)
+        if(pool->readers[n].db != NULL)
+            rdf_db_close(pool->readers[n].db);
+    rdf_db_close(pool->writer);
+
+    pthread_cond_destroy(&pool->released);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->readers);
+    free(pool->filepath);
+    free(pool);
+}
+
+db_t rdf_pool_reader(rdf_pool_t pool)
+{
+    struct reader *r = NULL;
+    db_t db;
+    int n, purged;
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;)
+    {
+        /* Prefer a handle that is open already. */
+        for(n = 0; n < pool->nreaders && r == NULL; ++n)
+            if(!pool->readers[n].busy && pool->readers[n].db != NULL)
+                r = &pool->readers[n];
+        for(n = 0; n < pool->nreaders && r == NULL; ++n)
+            if(!pool->readers[n].busy)
+                r = &pool->readers[n];
+        if(r != NULL)
+            break;
+        pthread_cond_wait(&pool->released, &pool->lock);
+    }
+    r->busy   = 1;
+    purged    = (r->purges != pool->purges);
+    r->purges = pool->purges;
+    db        = r->db;
+    pthread_mutex_unlock(&pool->lock);
+
+    if(db == NULL)
+    {
+        /* Open the handle without holding the lock. */
+        db = rdf_db_open_flags(pool->filepath, RDF_OPEN_READONLY | RDF_OPEN_WAL);
+
+        pthread_mutex_lock(&pool->lock);
+        if((r->db = db) == NULL)
+        {
+            r->busy = 0;
+            pthread_cond_broadcast(&pool->released);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    else
+    if(purged)
+    {
+        /* Cached identifiers may belong to purged nodes. */
+        rdf_cache_clear(db);
+    }
+
+    return db;
+}
+
+db_t rdf_pool_writer(rdf_pool_t pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while(pool->writer_busy)
+        pthread_cond_wait(&pool->released, &pool->lock);
+    pool->writer_busy = 1;
+    pthread_mutex_unlock(&pool->lock);
+
+    return pool->writer;
+}
+
+void rdf_pool_release(rdf_pool_t pool, db_t db)
+{
+    int n;
+
+    pthread_mutex_lock(&pool->lock);
+    if(db == pool->writer)
+        pool->writer_busy = 0;
+    else
+    {
+        for(n = 0; n < pool->nreaders; ++n)
+            if(pool->readers[n].db == db)
+                pool->readers[n].busy = 0;
+    }
+    pthread_cond_broadcast(&pool->released);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void rdf_pool_purge(rdf_pool_t pool)
+{
+    db_t db = rdf_pool_writer(pool);
+
+    rdf_purge(db);
+
+    pthread_mutex_lock(&pool->lock);
+    ++pool->purges;
+    pthread_mutex_unlock(&pool->lock);
+
+    rdf_pool_release(pool, db);
+}
+
+int rdf_pool_gc(rdf_pool_t pool, double seconds)
+{
+    db_t db = rdf_pool_writer(pool);
+    int result;
+
+    result = rdf_gc(db, seconds);
+
+    pthread_mutex_lock(&pool->lock);
+    ++pool->purges;
+    pthread_mutex_unlock(&pool->lock);
+
+    rdf_pool_release(pool, db);
+
+    return result;
+}
@@ -0,0 +1,40 @@
+#ifndef DBPOOL_H_INCLUDED
+#define DBPOOL_H_INCLUDED
+
+#include "storage.h"
+
+/* A pool of handles on one database, to be shared among threads. The
+   database is used in WAL mode, with a single writer handle and up to a
+   fixed number of read-only handles, each with its own connection,
+   prepared statements and term cache. Readers run in parallel with each
+   other and with the writer, which only blocks other writers. */
+typedef struct rdf_pool *rdf_pool_t;
+
+/* Opens a pool with at most `readers' read-only handles (or a default
+   number, if zero). Handles are opened when first needed. */
+rdf_pool_t rdf_pool_open(const char *filepath, int readers);
+
+/* Closes all handles; none may be in use. */
+void rdf_pool_close(rdf_pool_t pool);
+
+/* Returns a read-only handle for use by the calling thread, waiting until
+   one is available. Returns NULL if no handle could be opened. */
+db_t rdf_pool_reader(rdf_pool_t pool);
+
+/* Returns the writer handle, waiting until no other thread uses it. */
+db_t rdf_pool_writer(rdf_pool_t pool);
+
+/* Returns a handle to the pool. Iterators on it must be finished or
+   cancelled, and a batch opened with rdf_begin() must be committed. */
+void rdf_pool_release(rdf_pool_t pool, db_t db);
+
+/* Runs rdf_purge() on the writer handle. Readers forget the terms they
+   cached before they are next handed out. Use this instead of calling
+   rdf_purge() on a handle obtained from the pool. */
+void rdf_pool_purge(rdf_pool_t pool);
+
+/* Runs rdf_gc() on the writer handle, and likewise makes readers forget
+   their cached terms. Returns the result of rdf_gc(). */
+int rdf_pool_gc(rdf_pool_t pool, double seconds);
+
+#endif /* ndef DBPOOL_H_INCLUDED */
@@ -0,0 +1,899 @@
+#define _POSIX_C_SOURCE 200112L    /* for mmap() */
+#include "mmstore.h"
+#include "pool.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * File layout. All numbers are in native byte order, so a store is only
+ * read on machines like the one that wrote it.
+ *
+ *   header
+ *   term data:    blocks of TERM_BLOCK keys, sorted; the first key of a
+ *                 block is stored as its length and bytes, the others as
+ *                 the length of the prefix shared with the previous key,
+ *                 the length of the rest, and the rest.
+ *   term index:   offset in the term data of each block
+ *   for each of the SPO, POS and OSP orders:
+ *     triple data:  blocks of TRIPLE_BLOCK triples, sorted; the first
+ *                   triple of a block is in the index, and each of the
+ *                   others is stored relative to the previous one (see
+ *                   put_triple()).
+ *     triple index: first triple and data offset of each block
+ *
+ * Lengths, offsets and deltas are stored as variable-length integers of
+ * seven bits per byte, least significant first. Term keys are as in the
+ * term cache: 'U' and the URI for resources, or 'L' and the type,
+ * language and lexical form, separated by NULs, for literals.
+ */
+
+#define MM_MAGIC        "rdfmm01"
+
+/* Terms per block of the dictionary */
+#define TERM_BLOCK      (16)
+
+/* Triples per block of each order */
+#define TRIPLE_BLOCK    (128)
+
+/* Orders are rotations of (subject, predicate, object): order q stores
+   position (i + q)%3 of a triple at position i. */
+#define ORDERS          (3)
+
+struct mm_header
+{
+    char        magic[8];
+    long long   terms;
+    long long   triples;
+    long long   max_key;            /* length of the longest key */
+    long long   distinct[3];        /* distinct subjects, predicates, objects */
+    long long   term_data, term_index;
+    long long   data[ORDERS], index[ORDERS];
+    long long   size;               /* of the whole file */
+};
+
+struct mm_block
+{
+    long long   first[3];           /* first triple of the block */
+    long long   offset;             /* of the rest, in the triple data */
+};
+
+struct mmstore
+{
+    char                    *base;
+    size_t                  size;
+    const struct mm_header  *header;
+    const unsigned char     *term_data;
+    const long long         *term_index;
+    long long               term_blocks;
+    const unsigned char     *data[ORDERS];
+    const struct mm_block   *index[ORDERS];
+    long long               blocks;
+    char                    *key, *scratch;     /* max_key + 1 bytes each */
+};
+
+struct mm_cursor
+{
+    mmstore_t               mm;
+    int                     order;
+    int                     bound;              /* leading positions bound */
+    long long               prefix[3];
+    long long               pos;                /* of the next triple */
+    const unsigned char     *p;                 /* its data, within a block */
+    long long               t[3];               /* last triple read */
+    int                     done;
+};
+
+/* A term collected by the builder */
+struct build_term
+{
+    long long               id;                 /* in the source database */
+    char                    *key;
+    size_t                  len;
+};
+
+/* Maps identifiers in the source database to those in the store */
+struct id_map
+{
+    long long               from, to;
+};
+
+struct mm_builder
+{
+    struct pool             pool;               /* holds the keys */
+    struct build_term       *terms;
+    size_t                  nterms, terms_size;
+    long long               *triples;           /* three numbers each */
+    size_t                  ntriples, triples_size;
+};
+
+/* Keeps track of the write position and errors */
+struct writer
+{
+    FILE                    *fp;
+    long long               pos;
+};
+
+
+/*
+ *  Encoding
+ */
+
+static void put_bytes(struct writer *w, const void *data, size_t size)
+{
+    fwrite(data, 1, size, w->fp);
+    w->pos += size;
+}
+
+static void put_varint(struct writer *w, unsigned long long v)
+{
+    unsigned char buf[10];
+    int n = 0;
+
+    while(v >= 0x80)
+    {
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    put_bytes(w, buf, n);
+}
+
+/* Pads the file to a multiple of eight bytes. */
+static void put_padding(struct writer *w)
+{
+    static const char zeros[8] = { 0 };
+
+    if(w->pos % 8 != 0)
+        put_bytes(w, zeros, 8 - w->pos % 8);
+}
+
+static const unsigned char *get_varint(const unsigned char *p, long long *v)
+{
+    unsigned long long result = 0;
+    int shift = 0;
+
+    while(*p & 0x80)
+    {
+        result |= (unsigned long long)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *v = (long long)(result | ((unsigned long long)*p++ << shift));
+
+    return p;
+}
+
+/* Writes triple `t' relative to the previous one, `prev': the difference
+   in the first position; if that is zero, the difference in the second;
+   if that is zero too, the difference in the third. Positions after the
+   first that differ are written as they are. */
+static void put_triple(struct writer *w, const long long *prev, const long long *t)
+{
+    if(t[0] != prev[0])
+    {
+        put_varint(w, t[0] - prev[0]);
+        put_varint(w, t[1]);
+        put_varint(w, t[2]);
+    }
+    else
+    {
+        put_varint(w, 0);
+        if(t[1] != prev[1])
+        {
+            put_varint(w, t[1] - prev[1]);
+            put_varint(w, t[2]);
+        }
+        else
+        {
+            put_varint(w, 0);
+            put_varint(w, t[2] - prev[2]);
+        }
+    }
+}
+
+/* Reads a triple written by put_triple() into `t', which holds the
+   previous one. */
+static const unsigned char *get_triple(const unsigned char *p, long long *t)
+{
+    long long v;
+
+    p = get_varint(p, &v);
+    if(v != 0)
+    {
+        t[0] += v;
+        p = get_varint(p, &t[1]);
+        p = get_varint(p, &t[2]);
+    }
+    else
+    {
+        p = get_varint(p, &v);
+        if(v != 0)
+        {
+            t[1] += v;
+            p = get_varint(p, &t[2]);
+        }
+        else
+        {
+            p = get_varint(p, &v);
+            t[2] += v;
+        }
+    }
+
+    return p;
+}
+
+/* Builds the key of a term into `key', if it is at most `max' bytes long.
+   Returns its length, or 0 if it is too long. */
+static size_t make_key( char *key, size_t max, const char *lexical,
+                        const char *type, const char *lang )
+{
+    size_t len, lex_len = strlen(lexical), type_len, lang_len;
+
+    if(type == NULL)
+    {
+        if((len = lex_len + 1) > max)
+            return 0;
+        key[0] = 'U';
+        memcpy(key + 1, lexical, lex_len);
+        return len;
+    }
+
+    type_len = strlen(type);
+    lang_len = strlen(lang);
+    if((len = type_len + lang_len + lex_len + 3) > max)
+        return 0;
+    key[0] = 'L';
+    memcpy(key + 1, type, type_len + 1);
+    memcpy(key + 2 + type_len, lang, lang_len + 1);
+    memcpy(key + 3 + type_len + lang_len, lexical, lex_len);
+    return len;
+}
+
+static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int c = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+
+    if(c != 0)
+        return c;
+    return (a_len < b_len) ? -1 : (a_len > b_len) ? 1 : 0;
+}
+
+/* Reads the key at `p' into `buf', which holds the previous key of the
+   block unless this is the first. */
+static const unsigned char *get_key( const unsigned char *p, int first,
+                                     char *buf, size_t *len )
+{
+    long long shared = 0, rest;
+
+    if(!first)
+        p = get_varint(p, &shared);
+    p = get_varint(p, &rest);
+    memcpy(buf + shared, p, rest);
+    *len = (size_t)(shared + rest);
+
+    return p + rest;
+}
+
+
+/*
+ *  Building
+ */
+
+mm_builder_t mm_builder_create(void)
+{
+    mm_builder_t b = (mm_builder_t)malloc(sizeof(struct mm_builder));
+
+    if(b != NULL)
+        memset(b, 0, sizeof(struct mm_builder));
+
+    return b;
+}
+
+void mm_builder_destroy(mm_builder_t b)
+{
+    pclear(&b->pool);
+    free(b->terms);
+    free(b->triples);
+    free(b);
+}
+
+int mm_builder_term( mm_builder_t b, long long id, const char *lexical,
+                     const char *type, const char *lang )
+{
+    struct build_term *term;
+    size_t len;
+
+    if(b->nterms == b->terms_size)
+    {
+        size_t size = b->terms_size ? 2*b->terms_size : 1024;
+        term = (struct build_term*)realloc(b->terms, size*sizeof(struct build_term));
+        if(term == NULL)
+            return -1;
+        b->terms      = term;
+        b->terms_size = size;
+    }
+
+    if(lang == NULL)
+        lang = "";
+    len = strlen(lexical) + (type ? strlen(type) + strlen(lang) + 3 : 1);
+
+    term = &b->terms[b->nterms];
+    if((term->key = (char*)palloc(&b->pool, len)) == NULL)
+        return -1;
+    term->id  = id;
+    term->len = make_key(term->key, len, lexical, type, lang);
+    ++b->nterms;
+
+    return 0;
+}
+
+int mm_builder_triple( mm_builder_t b,
+                       long long subj, long long pred, long long obj )
+{
+    long long *t;
+
+    if(b->ntriples == b->triples_size)
+    {
+        size_t size = b->triples_size ? 2*b->triples_size : 4096;
+        t = (long long*)realloc(b->triples, 3*size*sizeof(long long));
+        if(t == NULL)
+            return -1;
+        b->triples      = t;
+        b->triples_size = size;
+    }
+
+    t = &b->triples[3*b->ntriples++];
+    t[0] = subj;
+    t[1] = pred;
+    t[2] = obj;
+
+    return 0;
+}
+
+static int compare_terms(const void *a, const void *b)
+{
+    const struct build_term *s = (const struct build_term*)a,
+                            *t = (const struct build_term*)b;
+
+    return compare_keys(s->key, s->len, t->key, t->len);
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    long long s = ((const struct id_map*)a)->from,
+              t = ((const struct id_map*)b)->from;
+
+    return (s < t) ? -1 : (s > t) ? 1 : 0;
+}
+
+static int compare_triples(const void *a, const void *b)
+{
+    const long long *s = (const long long*)a, *t = (const long long*)b;
+    int n;
+
+    for(n = 0; n < 3; ++n)
+        if(s[n] != t[n])
+            return (s[n] < t[n]) ? -1 : 1;
+
+    return 0;
+}
+
+/* Writes the sorted keys as front-coded blocks, followed by their index. */
+static void write_terms(mm_builder_t b, struct mm_header *h, struct writer *w)
+{
+    struct build_term *prev = NULL, *term;
+    long long *index, offset;
+    size_t n, shared, blocks = (b->nterms + TERM_BLOCK - 1)/TERM_BLOCK;
+
+    index = (long long*)malloc((blocks ? blocks : 1)*sizeof(long long));
+    h->term_data = w->pos;
+    for(n = 0; n < b->nterms; ++n)
+    {
+        term = &b->terms[n];
+        if(term->len > (size_t)h->max_key)
+            h->max_key = term->len;
+
+        offset = w->pos - h->term_data;
+        if(n % TERM_BLOCK == 0)
+        {
+            if(index != NULL)
+                index[n/TERM_BLOCK] = offset;
+            put_varint(w, term->len);
+            put_bytes(w, term->key, term->len);
+        }
+        else
+        {
+            for( shared = 0; shared < term->len && shared < prev->len &&
+                             term->key[shared] == prev->key[shared]; ++shared ) { };
+            put_varint(w, shared);
+            put_varint(w, term->len - shared);
+            put_bytes(w, term->key + shared, term->len - shared);
+        }
+        prev = term;
+    }
+    put_padding(w);
+
+    h->term_index = w->pos;
+    if(index != NULL)
+        put_bytes(w, index, blocks*sizeof(long long));
+    else
+        w->pos = -1;
+    free(index);
+}
+
+/* Writes the sorted triples in one order, followed by their index, and
+   counts the distinct values in their first position. */
+static void write_order( mm_builder_t b, int order, struct mm_header *h,
+                         struct writer *w )
+{
+    struct mm_block *index;
+    const long long *t, *prev = NULL;
+    size_t n, blocks = (b->ntriples + TRIPLE_BLOCK - 1)/TRIPLE_BLOCK;
+
+    index = (struct mm_block*)malloc((blocks ? blocks : 1)*sizeof(struct mm_block));
+    h->data[order] = w->pos;
+    h->distinct[order] = 0;
+    for(n = 0; n < b->ntriples; ++n)
+    {
+        t = &b->triples[3*n];
+        if(prev == NULL || t[0] != prev[0])
+            ++h->distinct[order];
+
+        if(n % TRIPLE_BLOCK == 0)
+        {
+            if(index != NULL)
+            {
+                memcpy(index[n/TRIPLE_BLOCK].first, t, 3*sizeof(long long));
+                index[n/TRIPLE_BLOCK].offset = w->pos - h->data[order];
+            }
+        }
+        else
+            put_triple(w, prev, t);
+        prev = t;
+    }
+    put_padding(w);
+
+    h->index[order] = w->pos;
+    if(index != NULL)
+        put_bytes(w, index, blocks*sizeof(struct mm_block));
+    else
+        w->pos = -1;
+    free(index);
+}
+
+/* Rotates each triple one position to the left, and sorts them again. */
+static void rotate_triples(mm_builder_t b)
+{
+    long long *t, first;
+    size_t n;
+
+    for(n = 0; n < b->ntriples; ++n)
+    {
+        t = &b->triples[3*n];
+        first = t[0];
+        t[0]  = t[1];
+        t[1]  = t[2];
+        t[2]  = first;
+    }
+    qsort(b->triples, b->ntriples, 3*sizeof(long long), compare_triples);
+}
+
+int mm_builder_write(mm_builder_t b, const char *path)
+{
+    struct mm_header h;
+    struct id_map *map, key, *found;
+    struct writer w;
+    size_t n;
+    int order, failed;
+
+    /* Number the terms in key order, and renumber the triples. */
+    qsort(b->terms, b->nterms, sizeof(struct build_term), compare_terms);
+    if((map = (struct id_map*)malloc((b->nterms + 1)*sizeof(struct id_map))) == NULL)
+        return -1;
+    for(n = 0; n < b->nterms; ++n)
+    {
+        map[n].from = b->terms[n].id;
+        map[n].to   = n + 1;
+    }
+    qsort(map, b->nterms, sizeof(struct id_map), compare_ids);
+    for(n = 0; n < 3*b->ntriples; ++n)
+    {
+        key.from = b->triples[n];
+        found = (struct id_map*)bsearch( &key, map, b->nterms,
+                                         sizeof(struct id_map), compare_ids );
+        if(found == NULL)
+        {
+            fprintf( stderr, "rdfdb: triple refers to unknown term %lld\n",
+                             b->triples[n] );
+            free(map);
+            return -1;
+        }
+        b->triples[n] = found->to;
+    }
+    free(map);
+
+    if((w.fp = fopen(path, "wb")) == NULL)
+    {
+        fprintf(stderr, "rdfdb: unable to create %s\n", path);
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    w.pos = 0;
+    put_bytes(&w, &h, sizeof(h));
+
+    write_terms(b, &h, &w);
+    qsort(b->triples, b->ntriples, 3*sizeof(long long), compare_triples);
+    for(order = 0; order < ORDERS && w.pos >= 0; ++order)
+    {
+        if(order > 0)
+            rotate_triples(b);
+        write_order(b, order, &h, &w);
+    }
+
+    /* Fill in the header last, so incomplete files are never valid. */
+    memcpy(h.magic, MM_MAGIC, sizeof(h.magic));
+    h.terms   = b->nterms;
+    h.triples = b->ntriples;
+    h.size    = w.pos;
+    if(w.pos >= 0 && fflush(w.fp) == 0 && fseek(w.fp, 0, SEEK_SET) == 0)
+        fwrite(&h, sizeof(h), 1, w.fp);
+
+    failed = (w.pos < 0 || ferror(w.fp));
+    if(fclose(w.fp) != 0 || failed)
+    {
+        fprintf(stderr, "rdfdb: unable to write %s\n", path);
+        remove(path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ *  Reading
+ */
+
+/* Checks that `count' items of `size' bytes at `offset' lie in the file. */
+static int in_file(mmstore_t mm, long long offset, long long count, size_t size)
+{
+    return offset >= (long long)sizeof(struct mm_header) && count >= 0 &&
+           offset <= (long long)mm->size &&
+           count <= ((long long)mm->size - offset)/(long long)size;
+}
+
+mmstore_t mm_open(const char *path)
+{
+    mmstore_t mm;
+    const struct mm_header *h;
+    struct stat st;
+    void *base;
+    int fd, order, valid;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct mm_header))
+    {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return NULL;
+
+    if((mm = (mmstore_t)malloc(sizeof(struct mmstore))) == NULL)
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    memset(mm, 0, sizeof(struct mmstore));
+    mm->base   = (char*)base;
+    mm->size   = st.st_size;
+    mm->header = h = (const struct mm_header*)base;
+
+    mm->term_blocks = (h->terms + TERM_BLOCK - 1)/TERM_BLOCK;
+    mm->blocks      = (h->triples + TRIPLE_BLOCK - 1)/TRIPLE_BLOCK;
+    valid = memcmp(h->magic, MM_MAGIC, sizeof(h->magic)) == 0 &&
+            h->size == (long long)mm->size && h->max_key >= 0 &&
+            in_file(mm, h->term_data, h->term_index - h->term_data, 1) &&
+            in_file(mm, h->term_index, mm->term_blocks, sizeof(long long));
+    for(order = 0; order < ORDERS && valid; ++order)
+    {
+        valid = in_file(mm, h->data[order], h->index[order] - h->data[order], 1) &&
+                in_file(mm, h->index[order], mm->blocks, sizeof(struct mm_block));
+        mm->data[order]  = (const unsigned char*)mm->base + h->data[order];
+        mm->index[order] = (const struct mm_block*)(mm->base + h->index[order]);
+    }
+    if(!valid)
+    {
+        fprintf(stderr, "rdfdb: %s is not a valid memory-mapped store\n", path);
+        mm_close(mm);
+        return NULL;
+    }
+    mm->term_data  = (const unsigned char*)mm->base + h->term_data;
+    mm->term_index = (const long long*)(mm->base + h->term_index);
+
+    mm->key     = (char*)malloc(h->max_key + 1);
+    mm->scratch = (char*)malloc(h->max_key + 1);
+    if(mm->key == NULL || mm->scratch == NULL)
+    {
+        mm_close(mm);
+        return NULL;
+    }
+
+    return mm;
+}
+
+void mm_close(mmstore_t mm)
+{
+    munmap(mm->base, mm->size);
+    free(mm->key);
+    free(mm->scratch);
+    free(mm);
+}
+
+long long mm_lookup( mmstore_t mm, const char *lexical,
+                     const char *type, const char *lang )
+{
+    const unsigned char *p;
+    long long lo = 0, hi = mm->term_blocks - 1, mid, block = -1, n;
+    size_t len, key_len;
+    int c;
+
+    if(type != NULL && lang == NULL)
+        return 0;
+    if((len = make_key(mm->key, mm->header->max_key, lexical, type, lang)) == 0)
+        return 0;
+
+    /* Find the last block that starts at or before the key. */
+    while(lo <= hi)
+    {
+        mid = (lo + hi)/2;
+        get_key(mm->term_data + mm->term_index[mid], 1, mm->scratch, &key_len);
+        if((c = compare_keys(mm->scratch, key_len, mm->key, len)) == 0)
+            return mid*TERM_BLOCK + 1;
+        if(c < 0)
+        {
+            block = mid;
+            lo    = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    if(block < 0)
+        return 0;
+
+    p = mm->term_data + mm->term_index[block];
+    for( n = block*TERM_BLOCK;
+         n < mm->header->terms && n < (block + 1)*TERM_BLOCK; ++n )
+    {
+        p = get_key(p, n == block*TERM_BLOCK, mm->scratch, &key_len);
+        if((c = compare_keys(mm->scratch, key_len, mm->key, len)) == 0)
+            return n + 1;
+        if(c > 0)
+            break;
+    }
+
+    return 0;
+}
+
+int mm_decode(mmstore_t mm, long long id, struct mm_term *term)
+{
+    const unsigned char *p;
+    long long n, block;
+    size_t len = 0;
+    char *data;
+
+    if(id < 1 || id > mm->header->terms)
+        return 0;
+
+    if(term->size < (size_t)mm->header->max_key + 1)
+    {
+        if((data = (char*)realloc(term->data, mm->header->max_key + 1)) == NULL)
+            return -1;
+        term->data = data;
+        term->size = mm->header->max_key + 1;
+    }
+
+    block = (id - 1)/TERM_BLOCK;
+    p = mm->term_data + mm->term_index[block];
+    for(n = block*TERM_BLOCK; n < id; ++n)
+        p = get_key(p, n == block*TERM_BLOCK, term->data, &len);
+    term->data[len] = '\0';
+
+    if(term->data[0] == 'U')
+    {
+        term->lexical = term->data + 1;
+        term->type    = NULL;
+        term->lang    = NULL;
+    }
+    else
+    {
+        term->type    = term->data + 1;
+        term->lang    = term->type + strlen(term->type) + 1;
+        term->lexical = term->lang + strlen(term->lang) + 1;
+    }
+
+    return 1;
+}
+
+/* Chooses the order in which the bound positions of a pattern come first,
+   and sets up a cursor to scan from the start of that order. */
+static void init_cursor( mmstore_t mm, struct mm_cursor *c,
+                         long long subj, long long pred, long long obj )
+{
+    memset(c, 0, sizeof(struct mm_cursor));
+    c->mm = mm;
+    if(subj != 0 && obj != 0 && pred == 0)
+    {
+        c->order     = 2;
+        c->prefix[0] = obj;
+        c->prefix[1] = subj;
+        c->bound     = 2;
+    }
+    else
+    if(subj != 0)
+    {
+        c->order     = 0;
+        c->prefix[0] = subj;
+        c->prefix[1] = pred;
+        c->prefix[2] = obj;
+        c->bound     = (pred == 0) ? 1 : (obj == 0) ? 2 : 3;
+    }
+    else
+    if(pred != 0)
+    {
+        c->order     = 1;
+        c->prefix[0] = pred;
+        c->prefix[1] = obj;
+        c->bound     = (obj == 0) ? 1 : 2;
+    }
+    else
+    if(obj != 0)
+    {
+        c->order     = 2;
+        c->prefix[0] = obj;
+        c->bound     = 1;
+    }
+}
+
+/* Compares the bound positions of a triple with the cursor's prefix. */
+static int compare_prefix(const struct mm_cursor *c, const long long *t)
+{
+    int n;
+
+    for(n = 0; n < c->bound; ++n)
+        if(t[n] != c->prefix[n])
+            return (t[n] < c->prefix[n]) ? -1 : 1;
+
+    return 0;
+}
+
+/* Moves the cursor to the block where its matches would start, if `after'
+   is zero, or end: the last block whose first triple comes before the
+   prefix (or does not come after it), or the first block. */
+static void seek_block(struct mm_cursor *c, int after)
+{
+    const struct mm_block *index = c->mm->index[c->order];
+    long long lo = 0, hi = c->mm->blocks - 1, mid, block = 0;
+    int cmp;
+
+    while(lo <= hi)
+    {
+        mid = (lo + hi)/2;
+        cmp = compare_prefix(c, index[mid].first);
+        if(cmp < 0 || (after && cmp == 0))
+        {
+            block = mid;
+            lo    = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    c->pos = block*TRIPLE_BLOCK;
+}
+
+/* Reads the triple at the cursor's position; returns 0 at the end. */
+static int advance(struct mm_cursor *c)
+{
+    mmstore_t mm = c->mm;
+    const struct mm_block *block;
+
+    if(c->pos >= mm->header->triples)
+        return 0;
+
+    if(c->pos % TRIPLE_BLOCK == 0)
+    {
+        block = &mm->index[c->order][c->pos/TRIPLE_BLOCK];
+        memcpy(c->t, block->first, sizeof(c->t));
+        c->p = mm->data[c->order] + block->offset;
+    }
+    else
+        c->p = get_triple(c->p, c->t);
+    ++c->pos;
+
+    return 1;
+}
+
+mm_cursor_t mm_find(mmstore_t mm, long long subj, long long pred, long long obj)
+{
+    mm_cursor_t c;
+
+    if((c = (mm_cursor_t)malloc(sizeof(struct mm_cursor))) == NULL)
+        return NULL;
+    init_cursor(mm, c, subj, pred, obj);
+    seek_block(c, 0);
+
+    return c;
+}
+
+int mm_next(mm_cursor_t c, long long *subj, long long *pred, long long *obj)
+{
+    long long *out[3];
+    int cmp, n;
+
+    while(!c->done && advance(c))
+    {
+        if((cmp = compare_prefix(c, c->t)) < 0)
+            continue;
+        if(cmp > 0)
+            break;
+
+        /* Undo the rotation of the cursor's order. */
+        out[0] = subj;
+        out[1] = pred;
+        out[2] = obj;
+        for(n = 0; n < 3; ++n)
+            if(out[(n + c->order)%3] != NULL)
+                *out[(n + c->order)%3] = c->t[n];
+        return 1;
+    }
+    c->done = 1;
+
+    return 0;
+}
+
+void mm_cursor_free(mm_cursor_t c)
+{
+    free(c);
+}
+
+/* Returns the position of the first triple that does not come before the
+   prefix (or, if `after', that comes after it). */
+static long long find_position(struct mm_cursor *c, int after)
+{
+    int cmp;
+
+    seek_block(c, after);
+    while(advance(c))
+    {
+        cmp = compare_prefix(c, c->t);
+        if(cmp > 0 || (!after && cmp == 0))
+            return c->pos - 1;
+    }
+
+    return c->mm->header->triples;
+}
+
+long long mm_count(mmstore_t mm, long long subj, long long pred, long long obj)
+{
+    struct mm_cursor c;
+    long long start;
+
+    init_cursor(mm, &c, subj, pred, obj);
+    if(c.bound == 0)
+        return mm->header->triples;
+
+    start = find_position(&c, 0);
+    return find_position(&c, 1) - start;
+}
+
+long long mm_distinct(mmstore_t mm, int position)
+{
+    return mm->header->distinct[position];
+}
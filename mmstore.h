@@ -0,0 +1,77 @@
+#ifndef MMSTORE_H_INCLUDED
+#define MMSTORE_H_INCLUDED
+
+#include <stddef.h>
+
+/* An immutable triple store in a memory-mapped file, for read-only
+   replicas. Terms are numbered 1 to n in the order of their keys, and
+   stored front-coded in small blocks. Triples are stored three times,
+   sorted in SPO, POS and OSP order and delta-encoded in blocks, so every
+   pattern is answered by a binary search over a block index followed by
+   a sequential scan. Nothing is read until it is needed, so opening a
+   store takes constant time. */
+typedef struct mmstore *mmstore_t;
+
+/* Collects the contents of a store, and writes it to a file */
+typedef struct mm_builder *mm_builder_t;
+
+/* Iterates over the triples matching a pattern */
+typedef struct mm_cursor *mm_cursor_t;
+
+/* A decoded term; the strings point into `data', which is reallocated as
+   needed and must be freed by the owner. `type' and `lang' are NULL for
+   resources. */
+struct mm_term
+{
+    char        *data;
+    size_t      size;
+    const char  *lexical, *type, *lang;
+};
+
+mm_builder_t mm_builder_create(void);
+
+void mm_builder_destroy(mm_builder_t b);
+
+/* Adds a term (a resource if `type' is NULL) with its identifier in the
+   source database. Returns 0, or -1 if out of memory. */
+int mm_builder_term( mm_builder_t b, long long id, const char *lexical,
+                     const char *type, const char *lang );
+
+/* Adds a triple of source identifiers. Returns 0, or -1 if out of memory. */
+int mm_builder_triple( mm_builder_t b,
+                       long long subj, long long pred, long long obj );
+
+/* Numbers the terms and writes the store. Returns 0, or -1 on error
+   (including triples that refer to unknown terms). */
+int mm_builder_write(mm_builder_t b, const char *path);
+
+/* Maps a store into memory; returns NULL if it is missing or invalid. */
+mmstore_t mm_open(const char *path);
+
+void mm_close(mmstore_t mm);
+
+/* Returns the identifier of a term, or 0 if there is none. */
+long long mm_lookup( mmstore_t mm, const char *lexical,
+                     const char *type, const char *lang );
+
+/* Decodes a term; returns 1, 0 if there is no such term, or -1 if out of
+   memory. */
+int mm_decode(mmstore_t mm, long long id, struct mm_term *term);
+
+/* Returns a cursor over the triples matching a pattern, with 0 matching
+   anything, or NULL if out of memory. */
+mm_cursor_t mm_find(mmstore_t mm, long long subj, long long pred, long long obj);
+
+/* Reads the next triple; returns 1, or 0 at the end. */
+int mm_next(mm_cursor_t c, long long *subj, long long *pred, long long *obj);
+
+void mm_cursor_free(mm_cursor_t c);
+
+/* Returns the number of triples matching a pattern. */
+long long mm_count(mmstore_t mm, long long subj, long long pred, long long obj);
+
+/* Returns the number of distinct subjects (0), predicates (1) or objects
+   (2) in the store. */
+long long mm_distinct(mmstore_t mm, int position);
+
+#endif /* ndef MMSTORE_H_INCLUDED */
@@ -0,0 +1,682 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "ntriples.h"
+#include "pool.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Size of the input buffer; also the maximum length of a line. */
+#define BUFFER_SIZE         (1<<20)
+
+#define DEFAULT_BATCH       (100000)
+#define DEFAULT_PROGRESS    (100000)
+
+/* Initial number of hash buckets for blank node labels (a power of two) */
+#define BNODE_BUCKETS       (256)
+
+/* Rows read at once while writing */
+#define WRITE_BATCH         (256)
+
+
+/*
+ *  Line parser
+ */
+
+static int is_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int is_label_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' ||
+           (c & 0x80);
+}
+
+static int is_lang_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '-';
+}
+
+static char *skip_ws(char *p, char *end)
+{
+    while(p < end && is_ws(*p))
+        ++p;
+    return p;
+}
+
+/* Decodes a \uXXXX or \UXXXXXXXX escape at `r' (pointing to the 'u' or 'U')
+   and writes the code point in UTF-8 at `w'. Since the escape is always
+   longer than its encoding, this can be done in place. Returns the position
+   after the escape, or NULL if the escape is invalid. */
+static char *decode_unicode(char *r, char *end, char **w)
+{
+    int n, digits = (*r == 'u') ? 4 : 8;
+    unsigned long c = 0;
+    char *out = *w;
+
+    if(end - r <= digits)
+        return NULL;
+
+    for(n = 1; n <= digits; ++n)
+    {
+        char d = r[n];
+        c <<= 4;
+        if(d >= '0' && d <= '9')
+            c |= d - '0';
+        else
+        if(d >= 'a' && d <= 'f')
+            c |= d - 'a' + 10;
+        else
+        if(d >= 'A' && d <= 'F')
+            c |= d - 'A' + 10;
+        else
+            return NULL;
+    }
+
+    if(c == 0 || c > 0x10FFFF)
+        return NULL;
+
+    if(c < 0x80)
+        *out++ = (char)c;
+    else
+    if(c < 0x800)
+    {
+        *out++ = (char)(0xC0 | (c >> 6));
+        *out++ = (char)(0x80 | (c & 0x3F));
+    }
+    else
+    if(c < 0x10000)
+    {
+        *out++ = (char)(0xE0 | (c >> 12));
+        *out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        *out++ = (char)(0xF0 | (c >> 18));
+        *out++ = (char)(0x80 | ((c >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (c & 0x3F));
+    }
+
+    *w = out;
+    return r + digits + 1;
+}
+
+/* Parses an IRI reference at *pp (pointing to '<'), decoding escapes in
+   place. The IRI starts at *start and ends at *stop. */
+static const char *parse_iri(char **pp, char *end, char **start, char **stop)
+{
+    char *r = *pp + 1, *w = r;
+
+    *start = r;
+    for(;;)
+    {
+        if(r == end)
+            return "unterminated IRI";
+        if(*r == '>')
+            break;
+        if(*r == '\\')
+        {
+            if(r + 1 == end || (r[1] != 'u' && r[1] != 'U') ||
+               (r = decode_unicode(r + 1, end, &w)) == NULL)
+                return "invalid escape sequence in IRI";
+        }
+        else
+            *w++ = *r++;
+    }
+
+    if(w == *start)
+        return "empty IRI";
+
+    *stop = w;
+    *pp   = r + 1;
+    return NULL;
+}
+
+/* Parses a blank node label at *pp (pointing to "_:"). */
+static const char *parse_bnode(char **pp, char *end, char **start, char **stop)
+{
+    char *p = *pp, *r = p + 2;
+
+    if(end - p < 2 || p[1] != ':')
+        return "invalid blank node";
+
+    while(r < end && is_label_char(*r))
+        ++r;
+
+    /* Labels may not end with a dot; it terminates the statement instead. */
+    while(r > p + 2 && r[-1] == '.')
+        --r;
+
+    if(r == p + 2)
+        return "empty blank node label";
+
+    *start = p;
+    *stop  = r;
+    *pp    = r;
+    return NULL;
+}
+
+/* Parses a quoted literal at *pp (pointing to '"'), decoding escapes in
+   place. */
+static const char *parse_string(char **pp, char *end, char **start, char **stop)
+{
+    char *r = *pp + 1, *w = r;
+
+    *start = r;
+    for(;;)
+    {
+        if(r == end)
+            return "unterminated literal";
+        if(*r == '"')
+            break;
+        if(*r != '\\')
+        {
+            *w++ = *r++;
+            continue;
+        }
+
+        if(++r == end)
+            return "unterminated literal";
+        switch(*r)
+        {
+        case 't':  *w++ = '\t'; ++r; break;
+        case 'b':  *w++ = '\b'; ++r; break;
+        case 'n':  *w++ = '\n'; ++r; break;
+        case 'r':  *w++ = '\r'; ++r; break;
+        case 'f':  *w++ = '\f'; ++r; break;
+        case '"':  *w++ = '"';  ++r; break;
+        case '\'': *w++ = '\''; ++r; break;
+        case '\\': *w++ = '\\'; ++r; break;
+        case 'u':
+        case 'U':
+            if((r = decode_unicode(r, end, &w)) == NULL)
+                return "invalid escape sequence in literal";
+            break;
+        default:
+            return "invalid escape sequence in literal";
+        }
+    }
+
+    *stop = w;
+    *pp   = r + 1;
+    return NULL;
+}
+
+int nt_parse_line(char *line, char *end, struct nt_triple *t, const char **error)
+{
+    char *p = line, *stops[4];
+    int nstops = 0;
+    const char *err;
+
+    t->type = t->lang = NULL;
+
+    /* Skip blank lines and comments */
+    p = skip_ws(p, end);
+    if(p == end || *p == '#')
+        return 0;
+
+    /* Subject */
+    if(*p == '<')
+        err = parse_iri(&p, end, &t->subj, &stops[nstops++]);
+    else
+    if(*p == '_')
+        err = parse_bnode(&p, end, &t->subj, &stops[nstops++]);
+    else
+        err = "expected subject";
+    if(err)
+        goto failed;
+
+    /* Predicate */
+    p = skip_ws(p, end);
+    if(p < end && *p == '<')
+        err = parse_iri(&p, end, &t->pred, &stops[nstops++]);
+    else
+        err = "expected predicate";
+    if(err)
+        goto failed;
+
+    /* Object */
+    p = skip_ws(p, end);
+    if(p < end && *p == '<')
+        err = parse_iri(&p, end, &t->obj, &stops[nstops++]);
+    else
+    if(p < end && *p == '_')
+        err = parse_bnode(&p, end, &t->obj, &stops[nstops++]);
+    else
+    if(p < end && *p == '"')
+    {
+        err = parse_string(&p, end, &t->obj, &stops[nstops++]);
+        if(!err && p < end && *p == '@')
+        {
+            /* Language tag */
+            t->lang = ++p;
+            while(p < end && is_lang_char(*p))
+                ++p;
+            if(p == t->lang)
+                err = "empty language tag";
+            stops[nstops++] = p;
+            t->type = "";
+        }
+        else
+        if(!err && end - p >= 3 && p[0] == '^' && p[1] == '^' && p[2] == '<')
+        {
+            /* Datatype */
+            p += 2;
+            err = parse_iri(&p, end, &t->type, &stops[nstops++]);
+            t->lang = "";
+        }
+        else
+        {
+            /* Plain literal */
+            t->type = t->lang = "";
+        }
+    }
+    else
+        err = "expected object";
+    if(err)
+        goto failed;
+
+    /* Terminating dot, optionally followed by a comment */
+    p = skip_ws(p, end);
+    if(p == end || *p != '.')
+    {
+        err = "expected '.'";
+        goto failed;
+    }
+    p = skip_ws(p + 1, end);
+    if(p != end && *p != '#')
+    {
+        err = "unexpected data after '.'";
+        goto failed;
+    }
+
+    /* The line is valid; terminate the terms in place. This is postponed
+       until now, because a term may end where a delimiter still needed by
+       the parser is stored. */
+    while(nstops > 0)
+        *stops[--nstops] = '\0';
+
+    return 1;
+
+failed:
+    if(error)
+        *error = err;
+    return -1;
+}
+
+
+/*
+ *  Loader
+ */
+
+/* A blank node label of the input, with the URI of the anonymous resource
+   that stands for it, followed by the label itself */
+struct bnode
+{
+    struct bnode                    *next;      /* in hash chain */
+    size_t                          hash;
+    char                            *uri;
+};
+
+#define BNODE_LABEL(b) ((char*)(b) + sizeof(struct bnode))
+
+struct loader
+{
+    db_t                            db;
+    FILE                            *fp;
+    int                             fd;
+    const struct rdf_load_options   *opts;
+
+    long long                       lines, triples, pending;
+    int                             own_batch;
+
+    struct bnode                    **bnodes;   /* hash buckets */
+    size_t                          nbnodes, nbuckets;
+    struct pool                     pool;       /* holds the labels */
+};
+
+static const struct rdf_load_options default_options = {
+    DEFAULT_BATCH, DEFAULT_PROGRESS, NULL, NULL, NULL, 0, 0 };
+
+static long read_input(struct loader *ld, char *buf, size_t size)
+{
+    ssize_t n;
+
+    if(ld->fp)
+    {
+        n = fread(buf, 1, size, ld->fp);
+        return (n == 0 && ferror(ld->fp)) ? -1 : (long)n;
+    }
+
+    do {
+        n = read(ld->fd, buf, size);
+    } while(n < 0 && errno == EINTR);
+    return (long)n;
+}
+
+static void report_error(struct loader *ld, const char *message)
+{
+    if(ld->opts->error)
+        ld->opts->error(ld->opts->arg, ld->lines, message);
+    else
+        fprintf(stderr, "rdfdb: line %lld: %s\n", ld->lines, message);
+}
+
+/* FNV-1a */
+static size_t hash_label(const char *label)
+{
+    unsigned h = 2166136261u;
+
+    while(*label)
+        h = (h ^ (unsigned char)*label++) * 16777619u;
+
+    return h;
+}
+
+/* Doubles the number of blank node buckets, or allocates the first ones. */
+static int grow_bnodes(struct loader *ld)
+{
+    struct bnode **buckets, *b, *next;
+    size_t n, nbuckets = ld->nbuckets ? 2*ld->nbuckets : BNODE_BUCKETS;
+
+    buckets = (struct bnode**)calloc(nbuckets, sizeof(struct bnode*));
+    if(buckets == NULL)
+        return -1;
+    for(n = 0; n < ld->nbuckets; ++n)
+    {
+        for(b = ld->bnodes[n]; b; b = next)
+        {
+            next = b->next;
+            b->next = buckets[b->hash & (nbuckets - 1)];
+            buckets[b->hash & (nbuckets - 1)] = b;
+        }
+    }
+    free(ld->bnodes);
+    ld->bnodes   = buckets;
+    ld->nbuckets = nbuckets;
+
+    return 0;
+}
+
+/* Returns the URI of the anonymous resource standing for a blank node
+   label, creating it with rdf_anon_uri() the first time the label occurs.
+   Labels are scoped to a single load, so they cannot clash with those of
+   other files or with existing anonymous resources. Returns NULL on error. */
+static char *bnode_uri(struct loader *ld, const char *label)
+{
+    size_t hash = hash_label(label), size = strlen(label) + 1;
+    struct bnode *b;
+    char *uri;
+
+    if(ld->nbuckets > 0)
+    {
+        for(b = ld->bnodes[hash & (ld->nbuckets - 1)]; b; b = b->next)
+            if(b->hash == hash && strcmp(BNODE_LABEL(b), label) == 0)
+                return b->uri;
+    }
+
+    if(ld->nbnodes >= ld->nbuckets && grow_bnodes(ld) != 0)
+        return NULL;
+    if((b = (struct bnode*)palloc(&ld->pool, sizeof(struct bnode) + size)) == NULL)
+        return NULL;
+    if((uri = rdf_anon_uri(ld->db)) == NULL)
+        return NULL;
+    b->uri = pstrdup(&ld->pool, uri);
+    free(uri);
+    if(b->uri == NULL)
+        return NULL;
+
+    b->hash = hash;
+    memcpy(BNODE_LABEL(b), label, size);
+    b->next = ld->bnodes[hash & (ld->nbuckets - 1)];
+    ld->bnodes[hash & (ld->nbuckets - 1)] = b;
+    ++ld->nbnodes;
+
+    return b->uri;
+}
+
+/* Processes a single line; returns -1 on a database error. */
+static int load_line(struct loader *ld, char *line, char *end)
+{
+    struct nt_triple t;
+    const char *error;
+    long long batch;
+
+    ld->lines += 1;
+    switch(nt_parse_line(line, end, &t, &error))
+    {
+    case 0:
+        break;
+
+    case 1:
+        if(NT_IS_BNODE(t.subj) && (t.subj = bnode_uri(ld, t.subj)) == NULL)
+            return -1;
+        if( t.type == NULL && NT_IS_BNODE(t.obj) &&
+            (t.obj = bnode_uri(ld, t.obj)) == NULL )
+            return -1;
+        if(rdf_insert(ld->db, t.subj, t.pred, t.obj, t.type, t.lang) != 0)
+            return -1;
+        ld->triples += 1;
+
+        /* Start a new transaction when the batch is full */
+        batch = (ld->opts->batch > 0) ? ld->opts->batch : DEFAULT_BATCH;
+        if(ld->own_batch && ++ld->pending >= batch)
+        {
+            ld->pending = 0;
+            if(rdf_commit(ld->db) != 0 || rdf_begin(ld->db) != 0)
+            {
+                ld->own_batch = 0;
+                return -1;
+            }
+        }
+        break;
+
+    default:
+        report_error(ld, error);
+    }
+
+    if( ld->opts->progress && ld->opts->progress_interval > 0 &&
+        ld->lines % ld->opts->progress_interval == 0 )
+    {
+        ld->opts->progress(ld->opts->arg, ld->lines, ld->triples);
+    }
+
+    return 0;
+}
+
+static long long load(struct loader *ld)
+{
+    char *buf, *start, *end, *nl;
+    long n;
+    int skipping = 0, eof = 0, result = 0;
+
+    if(ld->opts == NULL)
+        ld->opts = &default_options;
+
+    if((buf = (char*)malloc(BUFFER_SIZE)) == NULL)
+        return -1;
+
+    /* Use a batch of our own, unless the caller has one open. */
+    if(!rdf_in_batch(ld->db))
+    {
+        if(rdf_begin(ld->db) != 0)
+        {
+            free(buf);
+            return -1;
+        }
+        ld->own_batch = 1;
+    }
+
+    start = end = buf;
+    while(result == 0)
+    {
+        nl = (char*)memchr(start, '\n', end - start);
+        if(nl != NULL)
+        {
+            /* Process complete line */
+            if(skipping)
+                skipping = 0;
+            else
+                result = load_line(ld, start, nl);
+            start = nl + 1;
+            continue;
+        }
+
+        if(eof)
+        {
+            /* Process final line without line terminator */
+            if(start < end && !skipping)
+                result = load_line(ld, start, end);
+            break;
+        }
+
+        /* Move partial line to the front of the buffer */
+        if(skipping)
+            start = end;
+        memmove(buf, start, end - start);
+        end  -= start - buf;
+        start = buf;
+
+        if(end == buf + BUFFER_SIZE)
+        {
+            /* Line does not fit in buffer; skip it. */
+            ld->lines += 1;
+            report_error(ld, "line too long");
+            skipping = 1;
+            start = end = buf;
+        }
+
+        n = read_input(ld, end, buf + BUFFER_SIZE - end);
+        if(n < 0)
+            result = -1;
+        else
+        if(n == 0)
+            eof = 1;
+        else
+            end += n;
+    }
+
+    if(ld->own_batch)
+    {
+        if(result == 0)
+            result = rdf_commit(ld->db);
+        else
+            rdf_rollback(ld->db);
+    }
+
+    if(result == 0 && ld->opts->progress)
+        ld->opts->progress(ld->opts->arg, ld->lines, ld->triples);
+
+    free(buf);
+    free(ld->bnodes);
+    pclear(&ld->pool);
+
+    return (result == 0) ? ld->triples : -1;
+}
+
+long long rdf_load_ntriples( db_t db, FILE *fp,
+                             const struct rdf_load_options *options )
+{
+    struct loader ld;
+
+    memset(&ld, 0, sizeof(ld));
+    ld.db   = db;
+    ld.fp   = fp;
+    ld.fd   = -1;
+    ld.opts = options;
+
+    return load(&ld);
+}
+
+long long rdf_load_ntriples_fd( db_t db, int fd,
+                                const struct rdf_load_options *options )
+{
+    struct loader ld;
+
+    memset(&ld, 0, sizeof(ld));
+    ld.db   = db;
+    ld.fd   = fd;
+    ld.opts = options;
+
+    return load(&ld);
+}
+
+
+/*
+ *  Writer
+ */
+
+static void write_triple( FILE *fp,
+                          const char *subj_uri,
+                          const char *pred_uri,
+                          const char *obj_lexical,
+                          const char *obj_type,
+                          const char *obj_lang )
+{
+    fprintf(fp, strncmp(subj_uri, "_:", 2) ? "<%s> <%s> " : "%s <%s> ",
+                subj_uri, pred_uri);
+    if(obj_type == NULL)
+        fprintf(fp, strncmp(obj_lexical, "_:", 2) ? "<%s>" : "%s", obj_lexical);
+    else
+    {
+        const char *p;
+
+        fputc('"', fp);
+        for(p = obj_lexical; *p; ++p)
+        {
+            if(*p == '\\')
+                fputs("\\\\", fp);
+            else
+            if(*p == '"')
+                fputs("\\\"", fp);
+            else
+            if(*p == 0x0A)
+                fputs("\\n", fp);
+            else
+            if(*p == 0x0D)
+                fputs("\\r", fp);
+            else
+            if(*p == 0x09)
+                fputs("\\t", fp);
+            else
+                fputc(*p, fp);
+        }
+        fputc('"', fp);
+        if(obj_lang && *obj_lang)
+            fprintf(fp, "@%s", obj_lang);
+        else
+        if(*obj_type)
+            fprintf(fp, "^^<%s>", obj_type);
+    }
+    fprintf(fp, " .\n");
+}
+
+long long rdf_write_ntriples(FILE *fp, rdf_it_t it)
+{
+    const char *terms[5][WRITE_BATCH];
+    struct rdf_batch batch;
+    long long triples = 0;
+    int result, n;
+
+    memset(&batch, 0, sizeof(batch));
+    for(n = 0; n < 5; ++n)
+        batch.terms[n] = terms[n];
+
+    while((result = rdf_next_batch(it, &batch, WRITE_BATCH)) > 0)
+    {
+        for(n = 0; n < result; ++n)
+            write_triple( fp, terms[0][n], terms[1][n], terms[2][n],
+                          terms[3][n], terms[4][n] );
+        triples += result;
+    }
+
+    return (result < 0 || ferror(fp)) ? -1 : triples;
+}
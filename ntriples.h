@@ -0,0 +1,90 @@
+#ifndef NTRIPLES_H_INCLUDED
+#define NTRIPLES_H_INCLUDED
+
+#include "storage.h"
+#include <stdio.h>
+
+/* A parsed triple, in the form expected by rdf_insert(): for resources,
+   type and lang are NULL; for literals, they are empty if absent. Blank
+   nodes are given as their label, prefixed with "_:"; loaders replace them
+   with resources of their own (see NT_IS_BNODE). */
+struct nt_triple
+{
+    char *subj, *pred, *obj, *type, *lang;
+};
+
+/* Tests whether a subject or resource object of a parsed triple is a blank
+   node label. */
+#define NT_IS_BNODE(uri) ((uri)[0] == '_' && (uri)[1] == ':')
+
+/* Parses the N-Triples statement in [line, end), which must not include the
+   line terminator. Escape sequences are decoded and terms are terminated
+   in place, so the strings in `t' point into the line buffer.
+
+   Returns 1 if a triple was parsed, 0 if the line is blank or a comment,
+   or -1 if it is invalid, in which case *error describes the problem. */
+int nt_parse_line(char *line, char *end, struct nt_triple *t, const char **error);
+
+/* Called periodically while loading, with the number of lines read and the
+   number of triples inserted so far. */
+typedef void (*rdf_progress_t)(void *arg, long long lines, long long triples);
+
+/* Called for every line that could not be parsed; the line is skipped. */
+typedef void (*rdf_error_t)(void *arg, long long line, const char *message);
+
+struct rdf_load_options
+{
+    long long       batch;              /* triples per transaction */
+    long long       progress_interval;  /* lines between progress reports */
+    rdf_progress_t  progress;
+    rdf_error_t     error;              /* if NULL, errors go to stderr */
+    void            *arg;               /* passed to callbacks */
+
+    /* Used by rdf_bulk_load_ntriples() only; 0 for the defaults */
+    int             threads;            /* parser threads */
+    size_t          memory;             /* bytes of triples sorted at once */
+};
+
+/* Loads N-Triples data into the database. The input is read through a
+   fixed-size buffer, so files of any size are loaded in constant memory;
+   lines longer than the buffer are reported as errors.
+
+   Triples are inserted in transactions of `batch' triples, unless the
+   caller already opened a batch with rdf_begin(), in which case that one
+   is used. `options' may be NULL to use defaults.
+
+   Every blank node label of the input stands for a new anonymous resource
+   (see rdf_anon_uri()), so labels of different loads never meet.
+
+   Returns the number of triples loaded, or -1 if reading the input or
+   writing to the database failed. */
+long long rdf_load_ntriples( db_t db, FILE *fp,
+                             const struct rdf_load_options *options );
+
+long long rdf_load_ntriples_fd( db_t db, int fd,
+                                const struct rdf_load_options *options );
+
+/* Loads N-Triples data into an empty database (see rdf_bulk_begin()),
+   using several threads. The input is cut into chunks of lines that
+   worker threads parse, numbering terms through a shared dictionary.
+   Each worker sorts its triples as identifiers, writing them to temporary
+   files whenever its share of `memory' is full; these runs are then
+   merged in SPO order, and the indices are built after all triples have
+   been added. Lines longer than 1 MB are reported as errors.
+
+   Uses one thread per processor by default, and 256 MB for sorting. The
+   dictionary of terms is kept in memory. Everything is loaded in a single
+   transaction (`batch' is ignored); if loading fails, nothing is loaded.
+   The callbacks may be called from any thread, though never concurrently.
+   Blank nodes become anonymous resources named after their identifier, as
+   in rdf_load_ntriples().
+
+   Returns the number of triples read, or -1 on error. */
+long long rdf_bulk_load_ntriples( db_t db, FILE *fp,
+                                  const struct rdf_load_options *options );
+
+/* Writes the triples produced by an iterator as N-Triples, reading all of
+   them. Returns the number of triples written, or -1 on error. */
+long long rdf_write_ntriples(FILE *fp, rdf_it_t it);
+
+#endif /* ndef NTRIPLES_H_INCLUDED */
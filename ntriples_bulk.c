@@ -0,0 +1,964 @@
+/* For pthreads */
+#define _POSIX_C_SOURCE 200112L
+
+#include "ntriples.h"
+#include "pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Offline loader for empty databases, in three stages:
+ *
+ *  1. The input is cut into chunks of whole lines, which worker threads
+ *     parse. Terms are numbered through a dictionary shared by all
+ *     workers, and each worker collects the triples as identifiers.
+ *     When its buffer is full, a worker sorts it and writes it to a
+ *     temporary file as a run.
+ *  2. The runs of all workers are merged in SPO order, dropping
+ *     duplicates.
+ *  3. The terms and the merged triples are added with rdf_bulk_term() and
+ *     rdf_bulk_triple(), after which rdf_bulk_end() builds the indices.
+ */
+
+/* Size of a chunk of input; also the maximum length of a line */
+#define CHUNK_SIZE          (1<<20)
+
+/* Chunks per worker, read ahead or being parsed */
+#define CHUNKS_PER_WORKER   (2)
+
+/* Number of workers if the number of processors is unknown */
+#define DEFAULT_THREADS     (4)
+
+/* Memory used for sorting triples, if none is given */
+#define DEFAULT_MEMORY      (256<<20)
+
+#define DEFAULT_PROGRESS    (100000)
+
+/* Smallest number of triples sorted at once by a worker */
+#define MIN_RUN             (4096)
+
+/* Triples read at once from a run in a temporary file */
+#define MERGE_BUFFER        (4096)
+
+/* Number of dictionary shards, each with a lock of its own (a power of
+   two). The n-th term added to shard i is numbered n*SHARDS + i + 1, so
+   that identifiers are handed out without a global lock. */
+#define SHARDS              (64)
+
+/* Initial number of hash buckets per shard (a power of two) */
+#define SHARD_BUCKETS       (1024)
+
+
+/* A part of the input, ending at a line boundary */
+struct chunk
+{
+    struct chunk    *next;      /* in the queue or the free list */
+    char            *data;      /* CHUNK_SIZE bytes */
+    size_t          size;
+    long long       line;       /* number of the first line */
+};
+
+/* A term in the dictionary, followed by its key: 'U' and the URI, 'B' and
+   a blank node label, or 'L' and the type, language and data, each
+   terminated by a zero byte. */
+struct term
+{
+    struct term     *next;      /* in hash chain */
+    size_t          hash;
+    size_t          size;       /* of the key */
+    nid_t           id;
+};
+
+#define TERM_KEY(t) ((char*)(t) + sizeof(struct term))
+
+struct shard
+{
+    pthread_mutex_t lock;
+    int             index;
+    struct term     **buckets;
+    size_t          nbuckets;
+    struct term     **terms;    /* in order of identifier */
+    size_t          count, capacity;
+    struct pool     pool;       /* holds the terms */
+};
+
+/* A sorted run of distinct triples, stored in a temporary file or in the
+   buffer of a worker */
+struct run
+{
+    FILE            *fp;        /* NULL if the run is in memory */
+    nid_t           *triples;   /* triples read, or all of them */
+    size_t          pos, avail; /* position in and size of `triples' */
+    size_t          left;       /* triples left in the file */
+};
+
+struct worker
+{
+    struct bulk_loader *bl;
+    pthread_t       thread;
+    nid_t           *triples;   /* collected, unsorted triples */
+    size_t          count, capacity;
+    char            *key;       /* key being looked up */
+    size_t          key_size;
+    struct run      *runs;      /* runs written so far */
+    size_t          nruns;
+};
+
+struct bulk_loader
+{
+    db_t                            db;
+    FILE                            *fp;
+    const struct rdf_load_options   *opts;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  queued;     /* a chunk was queued, or loading ended */
+    pthread_cond_t  returned;   /* a chunk was returned after parsing */
+    struct chunk    *queue, *queue_end;
+    struct chunk    *unused;    /* free list */
+    int             nchunks, max_chunks;
+    int             eof;        /* all chunks have been queued */
+    int             failed;
+    long long       lines, triples, next_progress;
+
+    struct worker   *workers;
+    int             nworkers;
+
+    struct shard    shards[SHARDS];
+};
+
+static const struct rdf_load_options default_options = {
+    0, DEFAULT_PROGRESS, NULL, NULL, NULL, 0, 0 };
+
+
+/*
+ *  Dictionary
+ */
+
+/* FNV-1a */
+static size_t hash_key(const char *key, size_t size)
+{
+    unsigned h = 2166136261u;
+
+    while(size-- > 0)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+
+    return h;
+}
+
+/* Doubles the number of buckets of a shard. */
+static int grow_buckets(struct shard *sh)
+{
+    struct term **buckets, *t, *next;
+    size_t n, nbuckets = 2*sh->nbuckets;
+
+    buckets = (struct term**)calloc(nbuckets, sizeof(struct term*));
+    if(buckets == NULL)
+        return -1;
+    for(n = 0; n < sh->nbuckets; ++n)
+    {
+        for(t = sh->buckets[n]; t; t = next)
+        {
+            next = t->next;
+            t->next = buckets[(t->hash / SHARDS) & (nbuckets - 1)];
+            buckets[(t->hash / SHARDS) & (nbuckets - 1)] = t;
+        }
+    }
+    free(sh->buckets);
+    sh->buckets  = buckets;
+    sh->nbuckets = nbuckets;
+
+    return 0;
+}
+
+/* Adds a term to a shard and numbers it. Returns NULL if out of memory. */
+static struct term *add_term( struct shard *sh, size_t hash,
+                              const char *key, size_t size )
+{
+    struct term *t, **terms;
+    size_t capacity;
+
+    if(sh->count >= sh->nbuckets && grow_buckets(sh) != 0)
+        return NULL;
+    if(sh->count == sh->capacity)
+    {
+        capacity = sh->capacity ? 2*sh->capacity : SHARD_BUCKETS;
+        terms = (struct term**)realloc(sh->terms, capacity*sizeof(struct term*));
+        if(terms == NULL)
+            return NULL;
+        sh->terms    = terms;
+        sh->capacity = capacity;
+    }
+    if((t = (struct term*)palloc(&sh->pool, sizeof(struct term) + size)) == NULL)
+        return NULL;
+
+    t->hash = hash;
+    t->size = size;
+    t->id   = (nid_t)sh->count*SHARDS + sh->index + 1;
+    memcpy(TERM_KEY(t), key, size);
+    t->next = sh->buckets[(hash / SHARDS) & (sh->nbuckets - 1)];
+    sh->buckets[(hash / SHARDS) & (sh->nbuckets - 1)] = t;
+    sh->terms[sh->count++] = t;
+
+    return t;
+}
+
+/* Returns the identifier of the term with the given key, numbering it if
+   it is new, or 0 if out of memory. */
+static nid_t lookup(struct bulk_loader *bl, const char *key, size_t size)
+{
+    size_t hash = hash_key(key, size);
+    struct shard *sh = &bl->shards[hash & (SHARDS - 1)];
+    struct term *t;
+    nid_t id = 0;
+
+    pthread_mutex_lock(&sh->lock);
+    for(t = sh->buckets[(hash / SHARDS) & (sh->nbuckets - 1)]; t; t = t->next)
+        if(t->hash == hash && t->size == size && memcmp(TERM_KEY(t), key, size) == 0)
+            break;
+    if(t == NULL)
+        t = add_term(sh, hash, key, size);
+    if(t != NULL)
+        id = t->id;
+    pthread_mutex_unlock(&sh->lock);
+
+    return id;
+}
+
+/* Builds the key of a term in the key buffer of a worker and looks it up;
+   `type' is NULL for resources, including blank nodes. Returns its
+   identifier, or 0 if out of memory. */
+static nid_t term_id( struct worker *w, const char *lexical,
+                      const char *type, const char *lang )
+{
+    const char *parts[3];
+    size_t sizes[3], size = 1;
+    char *key;
+    int n, nparts = 0;
+
+    if(type != NULL)
+    {
+        parts[nparts++] = type;
+        parts[nparts++] = lang;
+    }
+    parts[nparts++] = lexical;
+    for(n = 0; n < nparts; ++n)
+        size += (sizes[n] = strlen(parts[n])) + 1;
+
+    if(size > w->key_size)
+    {
+        if((key = (char*)realloc(w->key, 2*size)) == NULL)
+            return 0;
+        w->key      = key;
+        w->key_size = 2*size;
+    }
+
+    key = w->key;
+    *key++ = (type != NULL) ? 'L' : NT_IS_BNODE(lexical) ? 'B' : 'U';
+    for(n = 0; n < nparts; ++n)
+    {
+        memcpy(key, parts[n], sizes[n] + 1);
+        key += sizes[n] + 1;
+    }
+
+    return lookup(w->bl, w->key, size);
+}
+
+/* Adds all terms to the database, in order of identifier. */
+static int add_terms(struct bulk_loader *bl)
+{
+    const char *type, *lang, *key;
+    struct shard *sh;
+    char uri[32];
+    size_t n, count = 0;
+    int i, result = 0;
+
+    for(i = 0; i < SHARDS; ++i)
+        if(bl->shards[i].count > count)
+            count = bl->shards[i].count;
+
+    for(n = 0; n < count && result == 0; ++n)
+    {
+        for(i = 0; i < SHARDS && result == 0; ++i)
+        {
+            sh = &bl->shards[i];
+            if(n >= sh->count)
+                continue;
+
+            key = TERM_KEY(sh->terms[n]);
+            if(*key == 'U')
+                result = rdf_bulk_term(bl->db, sh->terms[n]->id, key + 1, NULL, NULL);
+            else
+            if(*key == 'B')
+            {
+                /* Named like the resources of rdf_anon_uri(), which the
+                   label stands for; the label itself is not kept. */
+                sprintf(uri, "_:%lld", sh->terms[n]->id);
+                result = rdf_bulk_term(bl->db, sh->terms[n]->id, uri, NULL, NULL);
+            }
+            else
+            {
+                type = key + 1;
+                lang = type + strlen(type) + 1;
+                key  = lang + strlen(lang) + 1;
+                result = rdf_bulk_term(bl->db, sh->terms[n]->id, key, type, lang);
+            }
+        }
+    }
+
+    return result;
+}
+
+static void free_terms(struct bulk_loader *bl)
+{
+    int i;
+
+    for(i = 0; i < SHARDS; ++i)
+    {
+        pclear(&bl->shards[i].pool);
+        free(bl->shards[i].buckets);
+        free(bl->shards[i].terms);
+        bl->shards[i].buckets = NULL;
+        bl->shards[i].terms   = NULL;
+        bl->shards[i].count   = 0;
+    }
+}
+
+
+/*
+ *  Sorting
+ */
+
+static int cmp_triple(const nid_t *a, const nid_t *b)
+{
+    int n;
+
+    for(n = 0; n < 3; ++n)
+        if(a[n] != b[n])
+            return (a[n] < b[n]) ? -1 : 1;
+
+    return 0;
+}
+
+static int cmp_triple_qsort(const void *a, const void *b)
+{
+    return cmp_triple((const nid_t*)a, (const nid_t*)b);
+}
+
+/* Sorts the triples collected by a worker and removes duplicates. If
+   `spill' is set, they are written to a temporary file as a run, and the
+   buffer is emptied. */
+static int sort_run(struct worker *w, int spill)
+{
+    struct run *runs;
+    size_t n, count = 0;
+    FILE *fp;
+
+    qsort(w->triples, w->count, 3*sizeof(nid_t), cmp_triple_qsort);
+    for(n = 0; n < w->count; ++n)
+    {
+        if(count > 0 && cmp_triple(w->triples + 3*n, w->triples + 3*(count - 1)) == 0)
+            continue;
+        if(count != n)
+            memcpy(w->triples + 3*count, w->triples + 3*n, 3*sizeof(nid_t));
+        ++count;
+    }
+    w->count = count;
+    if(!spill)
+        return 0;
+
+    runs = (struct run*)realloc(w->runs, (w->nruns + 1)*sizeof(struct run));
+    if(runs == NULL)
+        return -1;
+    w->runs = runs;
+
+    if((fp = tmpfile()) == NULL)
+        return -1;
+    if(fwrite(w->triples, 3*sizeof(nid_t), count, fp) != count)
+    {
+        fclose(fp);
+        return -1;
+    }
+    memset(&runs[w->nruns], 0, sizeof(struct run));
+    runs[w->nruns].fp   = fp;
+    runs[w->nruns].left = count;
+    ++w->nruns;
+    w->count = 0;
+
+    return 0;
+}
+
+/* Moves on to the next triple of a run. Returns 1, 0 at the end of the
+   run, or -1 on error. */
+static int advance(struct run *r)
+{
+    size_t n;
+
+    if(++r->pos < r->avail)
+        return 1;
+    if(r->left == 0)
+        return 0;
+
+    n = (r->left < MERGE_BUFFER) ? r->left : MERGE_BUFFER;
+    if(fread(r->triples, 3*sizeof(nid_t), n, r->fp) != n)
+        return -1;
+    r->pos   = 0;
+    r->avail = n;
+    r->left -= n;
+
+    return 1;
+}
+
+#define RUN_TRIPLE(r) ((r)->triples + 3*(r)->pos)
+
+/* Restores the heap property of a heap of runs, ordered by their current
+   triples, from position `n' down. */
+static void sift_down(struct run **heap, size_t size, size_t n)
+{
+    struct run *r;
+    size_t child;
+
+    while((child = 2*n + 1) < size)
+    {
+        if( child + 1 < size &&
+            cmp_triple(RUN_TRIPLE(heap[child + 1]), RUN_TRIPLE(heap[child])) < 0 )
+            ++child;
+        if(cmp_triple(RUN_TRIPLE(heap[child]), RUN_TRIPLE(heap[n])) >= 0)
+            break;
+        r = heap[n];
+        heap[n] = heap[child];
+        heap[child] = r;
+        n = child;
+    }
+}
+
+/* Merges the runs of all workers and adds the triples to the database.
+   Returns 0, or -1 on error. */
+static int add_triples(struct bulk_loader *bl)
+{
+    struct run *runs, **heap, *r;
+    struct worker *w;
+    nid_t last[3] = { 0, 0, 0 };
+    size_t nruns = 0, size = 0, n;
+    int i, result = 0;
+
+    for(i = 0; i < bl->nworkers; ++i)
+        nruns += bl->workers[i].nruns + 1;
+    runs = (struct run*)calloc(nruns, sizeof(struct run));
+    heap = (struct run**)calloc(nruns, sizeof(struct run*));
+    if(runs == NULL || heap == NULL)
+    {
+        free(runs);
+        free(heap);
+        return -1;
+    }
+
+    /* Runs in temporary files are read through a buffer of their own. */
+    nruns = 0;
+    for(i = 0; i < bl->nworkers; ++i)
+    {
+        w = &bl->workers[i];
+        for(n = 0; n < w->nruns; ++n)
+        {
+            r = &runs[nruns++];
+            *r = w->runs[n];
+            w->runs[n].fp = NULL;
+            r->triples = (nid_t*)malloc(MERGE_BUFFER*3*sizeof(nid_t));
+            r->pos = r->avail = 0;
+            if(r->triples == NULL || fseek(r->fp, 0, SEEK_SET) != 0)
+                result = -1;
+        }
+        r = &runs[nruns++];
+        r->triples = w->triples;
+        r->avail   = w->count;
+        r->pos     = 0;
+    }
+
+    for(n = 0; n < nruns && result == 0; ++n)
+    {
+        if(runs[n].fp != NULL)
+        {
+            /* Read the first block */
+            runs[n].pos = (size_t)-1;
+            if((i = advance(&runs[n])) < 0)
+                result = -1;
+            else
+            if(i > 0)
+                heap[size++] = &runs[n];
+        }
+        else
+        if(runs[n].avail > 0)
+            heap[size++] = &runs[n];
+    }
+    for(n = size; n-- > 0; )
+        sift_down(heap, size, n);
+
+    while(size > 0 && result == 0)
+    {
+        r = heap[0];
+        if(cmp_triple(RUN_TRIPLE(r), last) != 0)
+        {
+            memcpy(last, RUN_TRIPLE(r), 3*sizeof(nid_t));
+            result = rdf_bulk_triple(bl->db, last[0], last[1], last[2]);
+        }
+
+        if((i = advance(r)) < 0)
+            result = -1;
+        else
+        if(i == 0)
+            heap[0] = heap[--size];
+        sift_down(heap, size, 0);
+    }
+
+    for(n = 0; n < nruns; ++n)
+    {
+        if(runs[n].fp != NULL)
+        {
+            fclose(runs[n].fp);
+            free(runs[n].triples);
+        }
+    }
+    free(runs);
+    free(heap);
+
+    return result;
+}
+
+
+/*
+ *  Parsing
+ */
+
+static void report_error(struct bulk_loader *bl, long long line, const char *message)
+{
+    if(bl->opts->error)
+        bl->opts->error(bl->opts->arg, line, message);
+    else
+        fprintf(stderr, "rdfdb: line %lld: %s\n", line, message);
+}
+
+/* Parses the lines in a chunk. Returns 0, or -1 on error. */
+static int parse_chunk(struct worker *w, struct chunk *c)
+{
+    struct bulk_loader *bl = w->bl;
+    struct nt_triple t;
+    const char *error;
+    char *p = c->data, *end = c->data + c->size, *nl;
+    long long line = c->line, triples = 0;
+    nid_t *triple;
+
+    for(; p < end; p = nl + 1, ++line)
+    {
+        if((nl = (char*)memchr(p, '\n', end - p)) == NULL)
+            nl = end;
+
+        switch(nt_parse_line(p, nl, &t, &error))
+        {
+        case 0:
+            break;
+
+        case 1:
+            if(w->count == w->capacity && sort_run(w, 1) != 0)
+                return -1;
+            triple = w->triples + 3*w->count;
+            triple[0] = term_id(w, t.subj, NULL, NULL);
+            triple[1] = term_id(w, t.pred, NULL, NULL);
+            triple[2] = term_id(w, t.obj, t.type, t.lang);
+            if(!triple[0] || !triple[1] || !triple[2])
+                return -1;
+            ++w->count;
+            ++triples;
+            break;
+
+        default:
+            pthread_mutex_lock(&bl->lock);
+            report_error(bl, line, error);
+            pthread_mutex_unlock(&bl->lock);
+        }
+    }
+
+    pthread_mutex_lock(&bl->lock);
+    bl->lines   += line - c->line;
+    bl->triples += triples;
+    if( bl->opts->progress && bl->opts->progress_interval > 0 &&
+        bl->lines >= bl->next_progress )
+    {
+        bl->opts->progress(bl->opts->arg, bl->lines, bl->triples);
+        bl->next_progress = (bl->lines / bl->opts->progress_interval + 1) *
+                            bl->opts->progress_interval;
+    }
+    pthread_mutex_unlock(&bl->lock);
+
+    return 0;
+}
+
+static void *work(void *arg)
+{
+    struct worker *w = (struct worker*)arg;
+    struct bulk_loader *bl = w->bl;
+    struct chunk *c;
+    int result = 0;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&bl->lock);
+        while(bl->queue == NULL && !bl->eof && !bl->failed)
+            pthread_cond_wait(&bl->queued, &bl->lock);
+        if(bl->queue == NULL || bl->failed)
+        {
+            pthread_mutex_unlock(&bl->lock);
+            break;
+        }
+        c = bl->queue;
+        if((bl->queue = c->next) == NULL)
+            bl->queue_end = NULL;
+        pthread_mutex_unlock(&bl->lock);
+
+        result = parse_chunk(w, c);
+
+        pthread_mutex_lock(&bl->lock);
+        c->next = bl->unused;
+        bl->unused = c;
+        pthread_cond_signal(&bl->returned);
+        pthread_mutex_unlock(&bl->lock);
+
+        if(result != 0)
+            break;
+    }
+
+    /* What is left becomes a run that stays in memory. */
+    if(result == 0)
+        result = sort_run(w, 0);
+
+    if(result != 0)
+    {
+        pthread_mutex_lock(&bl->lock);
+        bl->failed = 1;
+        pthread_cond_broadcast(&bl->queued);
+        pthread_cond_broadcast(&bl->returned);
+        pthread_mutex_unlock(&bl->lock);
+    }
+
+    return NULL;
+}
+
+
+/*
+ *  Reading
+ */
+
+/* Returns a chunk to read into, waiting for one to be returned if the
+   maximum number is in use, or NULL if out of memory or loading failed. */
+static struct chunk *get_chunk(struct bulk_loader *bl)
+{
+    struct chunk *c = NULL;
+
+    pthread_mutex_lock(&bl->lock);
+    while(bl->unused == NULL && bl->nchunks == bl->max_chunks && !bl->failed)
+        pthread_cond_wait(&bl->returned, &bl->lock);
+    if(!bl->failed)
+    {
+        if((c = bl->unused) != NULL)
+            bl->unused = c->next;
+        else
+        if((c = (struct chunk*)malloc(sizeof(struct chunk))) != NULL)
+        {
+            if((c->data = (char*)malloc(CHUNK_SIZE)) == NULL)
+            {
+                free(c);
+                c = NULL;
+            }
+            else
+                ++bl->nchunks;
+        }
+    }
+    pthread_mutex_unlock(&bl->lock);
+
+    if(c != NULL)
+        c->size = 0;
+    return c;
+}
+
+static void put_chunk(struct bulk_loader *bl, struct chunk *c)
+{
+    pthread_mutex_lock(&bl->lock);
+    c->next = NULL;
+    if(bl->queue_end != NULL)
+        bl->queue_end->next = c;
+    else
+        bl->queue = c;
+    bl->queue_end = c;
+    pthread_cond_signal(&bl->queued);
+    pthread_mutex_unlock(&bl->lock);
+}
+
+static long long count_lines(const char *data, size_t size)
+{
+    const char *end = data + size;
+    long long lines = 0;
+
+    while((data = (const char*)memchr(data, '\n', end - data)) != NULL)
+    {
+        ++lines;
+        ++data;
+    }
+
+    return lines;
+}
+
+/* Reads the input and queues it in chunks of whole lines. Lines longer
+   than a chunk are skipped. Returns 0, or -1 on error. */
+static int read_input(struct bulk_loader *bl)
+{
+    struct chunk *c, *next = NULL;
+    char *nl;
+    size_t n;
+    long long line = 1;
+    int skipping = 0, eof = 0, result = 0;
+
+    if((c = get_chunk(bl)) == NULL)
+        return -1;
+
+    while(!eof)
+    {
+        n = fread(c->data + c->size, 1, CHUNK_SIZE - c->size, bl->fp);
+        if(n == 0 && ferror(bl->fp))
+        {
+            result = -1;
+            break;
+        }
+        eof = (c->size + n < CHUNK_SIZE);
+        c->size += n;
+
+        if(skipping)
+        {
+            if((nl = (char*)memchr(c->data, '\n', c->size)) == NULL)
+            {
+                c->size = 0;
+                continue;
+            }
+            c->size -= nl + 1 - c->data;
+            memmove(c->data, nl + 1, c->size);
+            skipping = 0;
+            if(!eof)
+                continue;
+        }
+
+        /* Find the end of the last complete line */
+        nl = c->data + c->size;
+        if(!eof)
+        {
+            while(nl > c->data && nl[-1] != '\n')
+                --nl;
+            if(nl == c->data)
+            {
+                /* Line does not fit in a chunk; skip it. */
+                pthread_mutex_lock(&bl->lock);
+                report_error(bl, line, "line too long");
+                ++bl->lines;
+                pthread_mutex_unlock(&bl->lock);
+                ++line;
+                skipping = 1;
+                c->size  = 0;
+                continue;
+            }
+        }
+        if(nl == c->data)
+            break;
+
+        /* Move the partial line to the next chunk, and queue this one. */
+        if(!eof)
+        {
+            if((next = get_chunk(bl)) == NULL)
+            {
+                result = -1;
+                break;
+            }
+            next->size = c->data + c->size - nl;
+            memcpy(next->data, nl, next->size);
+        }
+        c->size = nl - c->data;
+        c->line = line;
+        line += count_lines(c->data, c->size);
+        put_chunk(bl, c);
+        c = eof ? NULL : next;
+    }
+
+    pthread_mutex_lock(&bl->lock);
+    if(c != NULL)
+    {
+        c->next = bl->unused;
+        bl->unused = c;
+    }
+    bl->eof = 1;
+    pthread_cond_broadcast(&bl->queued);
+    pthread_mutex_unlock(&bl->lock);
+
+    return result;
+}
+
+
+/*
+ *  Loader
+ */
+
+static int default_threads()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(n > 0)
+        return (int)n;
+#endif
+    return DEFAULT_THREADS;
+}
+
+/* Runs the workers over the input, and waits for them to finish. */
+static int parse_input(struct bulk_loader *bl)
+{
+    size_t memory = bl->opts->memory ? bl->opts->memory : DEFAULT_MEMORY;
+    struct worker *w;
+    int n, started, result;
+
+    bl->nworkers   = (bl->opts->threads > 0) ? bl->opts->threads : default_threads();
+    bl->max_chunks = CHUNKS_PER_WORKER*bl->nworkers;
+    bl->workers    = (struct worker*)calloc(bl->nworkers, sizeof(struct worker));
+    if(bl->workers == NULL)
+        return -1;
+
+    for(n = 0; n < bl->nworkers; ++n)
+    {
+        w = &bl->workers[n];
+        w->bl       = bl;
+        w->capacity = memory / (3*sizeof(nid_t)) / bl->nworkers;
+        if(w->capacity < MIN_RUN)
+            w->capacity = MIN_RUN;
+        if((w->triples = (nid_t*)malloc(w->capacity*3*sizeof(nid_t))) == NULL)
+            break;
+    }
+    started = 0;
+    if(n == bl->nworkers)
+    {
+        for(started = 0; started < bl->nworkers; ++started)
+            if(pthread_create( &bl->workers[started].thread, NULL, work,
+                               &bl->workers[started] ) != 0)
+                break;
+    }
+
+    if(started < bl->nworkers)
+    {
+        /* Let the workers that did start finish right away. */
+        pthread_mutex_lock(&bl->lock);
+        bl->failed = 1;
+        pthread_cond_broadcast(&bl->queued);
+        pthread_mutex_unlock(&bl->lock);
+        result = -1;
+    }
+    else
+        result = read_input(bl);
+
+    if(result != 0)
+    {
+        pthread_mutex_lock(&bl->lock);
+        bl->failed = 1;
+        pthread_cond_broadcast(&bl->queued);
+        pthread_mutex_unlock(&bl->lock);
+    }
+
+    for(n = 0; n < started; ++n)
+        pthread_join(bl->workers[n].thread, NULL);
+
+    return (result == 0 && !bl->failed) ? 0 : -1;
+}
+
+static void free_loader(struct bulk_loader *bl)
+{
+    struct chunk *c;
+    size_t n;
+    int i;
+
+    while((c = bl->unused) != NULL)
+    {
+        bl->unused = c->next;
+        free(c->data);
+        free(c);
+    }
+    while((c = bl->queue) != NULL)
+    {
+        bl->queue = c->next;
+        free(c->data);
+        free(c);
+    }
+
+    if(bl->workers != NULL)
+    {
+        for(i = 0; i < bl->nworkers; ++i)
+        {
+            for(n = 0; n < bl->workers[i].nruns; ++n)
+                if(bl->workers[i].runs[n].fp != NULL)
+                    fclose(bl->workers[i].runs[n].fp);
+            free(bl->workers[i].runs);
+            free(bl->workers[i].triples);
+            free(bl->workers[i].key);
+        }
+        free(bl->workers);
+    }
+
+    free_terms(bl);
+    for(i = 0; i < SHARDS; ++i)
+        pthread_mutex_destroy(&bl->shards[i].lock);
+    pthread_cond_destroy(&bl->queued);
+    pthread_cond_destroy(&bl->returned);
+    pthread_mutex_destroy(&bl->lock);
+}
+
+long long rdf_bulk_load_ntriples( db_t db, FILE *fp,
+                                  const struct rdf_load_options *options )
+{
+    struct bulk_loader bl;
+    int i, result = 0;
+
+    memset(&bl, 0, sizeof(bl));
+    bl.db   = db;
+    bl.fp   = fp;
+    bl.opts = options ? options : &default_options;
+    bl.next_progress = bl.opts->progress_interval;
+
+    pthread_mutex_init(&bl.lock, NULL);
+    pthread_cond_init(&bl.queued, NULL);
+    pthread_cond_init(&bl.returned, NULL);
+    for(i = 0; i < SHARDS; ++i)
+    {
+        pthread_mutex_init(&bl.shards[i].lock, NULL);
+        bl.shards[i].index    = i;
+        bl.shards[i].nbuckets = SHARD_BUCKETS;
+        bl.shards[i].buckets  = (struct term**)calloc(SHARD_BUCKETS, sizeof(struct term*));
+        if(bl.shards[i].buckets == NULL)
+            result = -1;
+    }
+
+    /* Fails early if the database is not empty. */
+    if(result != 0 || rdf_bulk_begin(db) != 0)
+    {
+        free_loader(&bl);
+        return -1;
+    }
+
+    result = parse_input(&bl);
+    if(result == 0)
+        result = add_terms(&bl);
+    free_terms(&bl);
+    if(result == 0)
+        result = add_triples(&bl);
+    if(rdf_bulk_end(db, result == 0) != 0)
+        result = -1;
+
+    if(result == 0 && bl.opts->progress)
+        bl.opts->progress(bl.opts->arg, bl.lines, bl.triples);
+
+    free_loader(&bl);
+
+    return (result == 0) ? bl.triples : -1;
+}
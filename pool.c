@@ -3,68 +3,192 @@
 #include <stdio.h>
 #include <stdarg.h>
 
-struct pool_block
+/* Default size of a chunk, including its header */
+#define CHUNK_SIZE  (16384)
+
+/* Alignment of allocations */
+union pool_align
 {
-    struct pool_block *next;
+    long long   l;
+    double      d;
+    void        *p;
 };
 
+#define ALIGNMENT   (sizeof(union pool_align))
+#define ALIGN(n)    (((n) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
 
-void *palloc(pool_t p, size_t size)
+struct pool_chunk
 {
-    struct pool_block *block = (struct pool_block*)malloc(8 + size);
+    struct pool_chunk *next;
+    size_t            size;     /* usable bytes following the header */
+};
 
-    if(block == NULL)
-        return NULL;
+#define HEADER_SIZE ALIGN(sizeof(struct pool_chunk))
+#define DATA(chunk) ((char*)(chunk) + HEADER_SIZE)
 
-    block->next = p->blocks;
-    p->blocks   = block;
 
-    return ((char*)block) + 8;
+/* Makes `chunk' the current chunk. */
+static void use_chunk(pool_t p, struct pool_chunk *chunk)
+{
+    p->current = chunk;
+    p->ptr     = DATA(chunk);
+    p->end     = DATA(chunk) + chunk->size;
 }
 
-void pfree(pool_t p, void *buffer)
+/* Moves on to a chunk with at least `size' bytes free; a chunk left over
+   from before a reset is reused if it is large enough. */
+static int next_chunk(pool_t p, size_t size)
 {
-    struct pool_block *block = p->blocks, *last = NULL;
+    struct pool_chunk *chunk = p->current ? p->current->next : p->first;
 
-    buffer = ((char*)buffer) - 8;
-    while(block)
+    if(chunk == NULL || chunk->size < size)
     {
-        if(block == buffer)
-        {
-            if(last == NULL)
-                p->blocks = block->next;
-            else
-                last->next = block->next;
+        size_t chunk_size = CHUNK_SIZE - HEADER_SIZE;
+        if(chunk_size < size)
+            chunk_size = size;
 
-            free(buffer);
+        chunk = (struct pool_chunk*)malloc(HEADER_SIZE + chunk_size);
+        if(chunk == NULL)
+            return -1;
+        chunk->size = chunk_size;
 
-            return;
+        /* Insert after current chunk */
+        if(p->current)
+        {
+            chunk->next = p->current->next;
+            p->current->next = chunk;
+        }
+        else
+        {
+            chunk->next = p->first;
+            p->first = chunk;
         }
+    }
+
+    p->wasted += p->end - p->ptr;
+    use_chunk(p, chunk);
+    return 0;
+}
+
+/* Allocates `size' bytes; if `aligned' is zero, the result is not aligned
+   and the next allocation starts right after it. */
+static void *alloc(pool_t p, size_t size, int aligned)
+{
+    size_t padded = aligned ? ALIGN(size) : size;
+    char *result;
+
+    if(padded == 0)
+        padded = ALIGNMENT;
+
+    if((size_t)(p->end - p->ptr) < padded && next_chunk(p, padded) != 0)
+        return NULL;
+
+    result       = p->ptr;
+    p->ptr      += padded;
+    p->last      = result;
+    p->last_size = size;
+    p->used     += size;
+    p->wasted   += padded - size;
+
+    return result;
+}
+
+void *palloc(pool_t p, size_t size)
+{
+    /* Realign in case the previous allocation was a string */
+    size_t pad = (size_t)p->ptr % ALIGNMENT;
 
-        last  = block;
-        block = block->next;
+    if(pad != 0 && (size_t)(p->end - p->ptr) >= ALIGNMENT - pad)
+    {
+        p->ptr    += ALIGNMENT - pad;
+        p->wasted += ALIGNMENT - pad;
     }
 
-    fprintf(stderr, "pfree(): invalid block passed; not freed!\n");
+    return alloc(p, size, 1);
+}
+
+void pfree(pool_t p, void *buffer)
+{
+    if(buffer != NULL && buffer == p->last)
+    {
+        /* Most recent allocation; give the space back. */
+        p->used   -= p->last_size;
+        p->wasted -= (p->ptr - p->last) - p->last_size;
+        p->ptr     = p->last;
+        p->last    = NULL;
+    }
 }
 
 void pclear(pool_t p)
 {
-    struct pool_block *block = p->blocks, *next;
+    struct pool_chunk *chunk = p->first, *next;
+
+    while(chunk)
+    {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    memset(p, 0, sizeof(struct pool));
+}
+
+void preset(pool_t p)
+{
+    if(p->first)
+        use_chunk(p, p->first);
+    p->last   = NULL;
+    p->used   = 0;
+    p->wasted = 0;
+}
+
+pool_mark_t pmark(pool_t p)
+{
+    pool_mark_t mark;
+
+    mark.current = p->current;
+    mark.ptr     = p->ptr;
+    mark.used    = p->used;
+    mark.wasted  = p->wasted;
 
-    while(block)
+    return mark;
+}
+
+void prelease(pool_t p, pool_mark_t mark)
+{
+    if(mark.current == NULL)
+        preset(p);
+    else
     {
-        next = block->next;
-        free(block);
-        block = next;
+        use_chunk(p, mark.current);
+        p->ptr    = mark.ptr;
+        p->last   = NULL;
+        p->used   = mark.used;
+        p->wasted = mark.wasted;
     }
 }
 
+void pstats(pool_t p, size_t *used, size_t *wasted, size_t *reserved)
+{
+    struct pool_chunk *chunk;
+    size_t total = 0;
+
+    for(chunk = p->first; chunk; chunk = chunk->next)
+        total += HEADER_SIZE + chunk->size;
+
+    if(used)
+        *used = p->used;
+    if(wasted)
+        *wasted = p->wasted;
+    if(reserved)
+        *reserved = total;
+}
+
 char *pstrdup(pool_t p, const char *str)
 {
     char *buf;
     int size = strlen(str) + 1;
-    if((buf = (char*)palloc(p, size)))
+    if((buf = (char*)alloc(p, size, 0)))
         memcpy(buf, str, size);
     return buf;
 }
@@ -81,7 +205,7 @@ char *pprintf(pool_t p, const char *fmt, ...)
     buflen = 1 + vsnprintf(NULL, 0, fmt, ap);
     va_end(ap);
 
-    if((buf = (char*)palloc(p, buflen)))
+    if((buf = (char*)alloc(p, buflen, 0)))
     {
         va_start(ap, fmt);
         vsnprintf(buf, buflen, fmt, ap);
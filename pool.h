@@ -3,13 +3,45 @@
 
 #include <stdlib.h>
 
+/* A memory pool is an arena that allocates from large chunks by advancing
+   a pointer. Individual allocations are not freed; instead, the whole pool
+   is reset (keeping its chunks for reuse) or cleared (freeing them).
+   A zero-initialized struct pool is an empty pool. */
 typedef struct pool {
-    struct pool_block *blocks;
+    struct pool_chunk *first;       /* all chunks, in allocation order */
+    struct pool_chunk *current;     /* chunk being allocated from */
+    char *ptr, *end;                /* free space in current chunk */
+    char *last;                     /* most recent allocation */
+    size_t last_size;
+    size_t used, wasted;
 } *pool_t;
 
+/* A position in a pool, to which the pool can be rolled back. */
+typedef struct pool_mark {
+    struct pool_chunk *current;
+    char *ptr;
+    size_t used, wasted;
+} pool_mark_t;
+
 void *palloc(pool_t p, size_t size);
+
+/* Only the most recent allocation is actually reclaimed. */
 void pfree(pool_t p, void *buffer);
+
+/* Frees all memory held by the pool. */
 void pclear(pool_t p);
+
+/* Discards all allocations in O(1) time, keeping chunks for reuse. */
+void preset(pool_t p);
+
+/* Discards all allocations made since `mark' was taken. */
+pool_mark_t pmark(pool_t p);
+void prelease(pool_t p, pool_mark_t mark);
+
+/* Reports bytes allocated, bytes lost to alignment and unused chunk ends,
+   and bytes held in chunks. Any of the pointers may be NULL. */
+void pstats(pool_t p, size_t *used, size_t *wasted, size_t *reserved);
+
 char *pstrdup(pool_t p, const char *st);
 char *pprintf(pool_t p, const char *fmt, ...);
 
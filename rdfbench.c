@@ -0,0 +1,808 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "storage.h"
+#include "dbpool.h"
+#include "ntriples.h"
+#include "serql.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Benchmarks the storage layer and the SerQL parser on synthetic data.
+ *
+ * The data is generated from a seed, so runs with the same parameters
+ * measure the same work. Triple n has subject s(n/8); its predicate is
+ * drawn from a Zipf distribution with exponent `skew' over `predicates'
+ * predicates, and its object is a literal with probability `literals',
+ * and otherwise a random subject.
+ *
+ * Results are written as tab-separated rows, with a header:
+ *
+ *   benchmark  ops  seconds  ops_per_s  p50_us  p99_us
+ *
+ * Latency percentiles are per operation (per query, for the finds), and
+ * "-" for benchmarks that are only timed as a whole. Lines starting with
+ * '#' are comments. With -v, the statistics kept by each handle (see
+ * rdf_db_stats()) are written to stderr when it is closed.
+ */
+
+#define BENCH_FILE "rdfbench.dat"
+
+/* Snapshot written by the dump benchmark, and the database that it and
+   the load benchmarks fill */
+#define BENCH_DUMP "rdfbench.dump"
+#define BENCH_COPY "rdfbench-copy.dat"
+
+/* Rows read per call by the batched scans */
+#define SCAN_BATCH  (256)
+
+/* Largest number of threads in the concurrent scans */
+#define MAX_THREADS (8)
+
+/* Operations of the unbatched insert and the drop benchmarks, which
+   commit after every triple */
+#define UNBATCHED   (1000)
+
+/* Time limit of an incremental garbage collection step, in seconds */
+#define GC_STEP     (0.01)
+
+#define EX "http://example.org/"
+
+enum scan_method { scan_next, scan_batch, scan_ids, scan_ids_batch };
+
+struct params
+{
+    long            triples;        /* -n */
+    long            batch;          /* -b */
+    int             predicates;     /* -p */
+    double          skew;           /* -z */
+    double          literals;       /* -l */
+    unsigned long   seed;           /* -s */
+    long            queries;        /* -q: operations per benchmark */
+    int             stats;          /* -v: dump handle statistics */
+};
+
+/* A generated triple */
+struct triple
+{
+    char            subj[64], pred[64], obj[64];
+    const char      *type;          /* NULL for a resource */
+};
+
+static struct params params = { 100000, 10000, 32, 1.0, 0.5, 1, 1000, 0 };
+static double *pred_cdf;            /* cumulative predicate distribution */
+
+/* Latencies of the benchmark being run, in seconds */
+static double *samples;
+static long nsamples;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+/*
+ *  Data generator
+ */
+
+/* SplitMix64; returns the `n'th value of the stream for `seed'. */
+static unsigned long long mix(unsigned long long seed, unsigned long long n)
+{
+    unsigned long long z = seed + (n + 1)*0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Returns a uniform number in [0, 1) from a random value. */
+static double uniform(unsigned long long r)
+{
+    return (r >> 11)*(1.0/9007199254740992.0);
+}
+
+static void init_generator()
+{
+    double sum = 0;
+    int n;
+
+    pred_cdf = (double*)malloc(params.predicates*sizeof(double));
+    for(n = 0; n < params.predicates; ++n)
+        pred_cdf[n] = (sum += pow(n + 1, -params.skew));
+    for(n = 0; n < params.predicates; ++n)
+        pred_cdf[n] /= sum;
+}
+
+/* Generates triple `n'. Triples beyond the data set are not in the
+   database (most likely), which the lookups use to miss. */
+static void make_triple(long n, struct triple *t)
+{
+    unsigned long long r = mix(params.seed, n);
+    long subjects = params.triples/8 + 1;
+    double u = uniform(r);
+    int lo = 0, hi = params.predicates - 1, mid;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi)/2;
+        if(pred_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    sprintf(t->subj, EX "s%ld", n/8);
+    sprintf(t->pred, EX "p%d", lo);
+
+    r = mix(params.seed ^ 0x5555, n);
+    if(uniform(r) < params.literals)
+    {
+        sprintf(t->obj, "value %ld", (long)(mix(r, 0) % (params.triples/4 + 1)));
+        t->type = "";
+    }
+    else
+    {
+        sprintf(t->obj, EX "s%ld", (long)(mix(r, 0) % subjects));
+        t->type = NULL;
+    }
+}
+
+/* Returns the index of a random triple in the data set; the query
+   number `q' and benchmark `salt' select it. */
+static long pick(long q, int salt)
+{
+    return (long)(mix(params.seed + salt, q) % params.triples);
+}
+
+
+/*
+ *  Reporting
+ */
+
+static void start_samples()
+{
+    nsamples = 0;
+}
+
+static void add_sample(double latency)
+{
+    samples[nsamples++] = latency;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Prints a result row; percentiles are taken from the samples, if any. */
+static void report(const char *name, long ops, double seconds)
+{
+    printf("%s\t%ld\t%.6f\t%.0f", name, ops, seconds,
+           (seconds > 0) ? ops/seconds : 0.0);
+    if(nsamples > 0)
+    {
+        qsort(samples, nsamples, sizeof(double), cmp_double);
+        printf("\t%.2f\t%.2f\n", 1e6*samples[(nsamples - 1)*50/100],
+                                 1e6*samples[(nsamples - 1)*99/100]);
+    }
+    else
+        printf("\t-\t-\n");
+    fflush(stdout);
+    nsamples = 0;
+}
+
+static db_t open_db_flags(const char *path, int flags)
+{
+    db_t db;
+
+    if((db = rdf_db_open_flags(path, flags)) == NULL)
+    {
+        fprintf(stderr, "rdfbench: unable to open %s\n", path);
+        exit(1);
+    }
+
+    return db;
+}
+
+static db_t open_db(const char *path)
+{
+    return open_db_flags(path, 0);
+}
+
+/* Closes a handle opened by open_db(), writing its operation statistics
+   to stderr first if asked to. */
+static void close_db(db_t db)
+{
+    if(params.stats)
+        rdf_db_stats_dump(db, stderr);
+    rdf_db_close(db);
+}
+
+
+/*
+ *  Benchmarks
+ */
+
+/* Inserts `count' generated triples into a fresh database, opened with
+   the given flags, committing every `batch' triples (or after every
+   triple, if batch is zero). The database is kept for the other
+   benchmarks. */
+static void bench_insert(const char *name, long count, long batch, int flags)
+{
+    db_t db;
+    struct triple t;
+    long n;
+    double start, begin, elapsed;
+
+    remove(BENCH_FILE);
+    db = open_db_flags(BENCH_FILE, flags);
+
+    start_samples();
+    start = now();
+    if(batch > 0)
+    {
+        rdf_autocommit(db, batch);
+        rdf_begin(db);
+    }
+    for(n = 0; n < count; ++n)
+    {
+        make_triple(n, &t);
+        begin = now();
+        if(rdf_insert(db, t.subj, t.pred, t.obj, t.type, "") != 0)
+        {
+            fprintf(stderr, "rdfbench: insert %ld failed\n", n);
+            exit(1);
+        }
+        add_sample(now() - begin);
+    }
+    if(batch > 0)
+        rdf_commit(db);
+    elapsed = now() - start;
+
+    close_db(db);
+    report(name, count, elapsed);
+}
+
+/* Runs queries of one shape: the positions in `shape' (1 for the subject,
+   2 for the predicate, 4 for the object) are bound to the terms of a
+   random triple, and all matches are read. */
+static void bench_find(db_t db, int shape)
+{
+    struct triple t;
+    rdf_it_t it;
+    const char *s, *p, *o, *type, *lang;
+    char name[16];
+    long queries = params.queries, n;
+    double start, begin;
+
+    /* A full scan reads everything; a few are enough */
+    if(shape == 0 && queries > 10)
+        queries = 10;
+
+    sprintf(name, "find_%c%c%c", (shape & 1) ? 's' : '?',
+            (shape & 2) ? 'p' : '?', (shape & 4) ? 'o' : '?');
+
+    start_samples();
+    start = now();
+    for(n = 0; n < queries; ++n)
+    {
+        make_triple(pick(n, shape), &t);
+        begin = now();
+        it = rdf_find( db, (shape & 1) ? t.subj : NULL,
+                           (shape & 2) ? t.pred : NULL,
+                           (shape & 4) ? t.obj  : NULL, t.type, "" );
+        while(rdf_next(it, &s, &p, &o, &type, &lang) > 0) { };
+        add_sample(now() - begin);
+    }
+    report(name, queries, now() - start);
+}
+
+/* Tests for triples that exist and, alternately, ones that do not. */
+static void bench_exists(db_t db, const char *name)
+{
+    struct triple t;
+    long n;
+    double start, begin;
+
+    start_samples();
+    start = now();
+    for(n = 0; n < params.queries; ++n)
+    {
+        make_triple((n & 1) ? params.triples + n : pick(n, 8), &t);
+        begin = now();
+        rdf_exists(db, t.subj, t.pred, t.obj, t.type, "");
+        add_sample(now() - begin);
+    }
+    report(name, params.queries, now() - start);
+}
+
+/* Builds the Bloom filter of a handle opened with RDF_OPEN_BLOOM. */
+static void bench_filter(db_t db)
+{
+    double start = now();
+
+    if(rdf_filter_rebuild(db) != 0)
+    {
+        fprintf(stderr, "rdfbench: unable to build filter\n");
+        exit(1);
+    }
+    report("filter_build", 1, now() - start);
+}
+
+/* Reads all triples in the database with the given method. */
+static void bench_scan(const char *name, enum scan_method method)
+{
+    db_t db;
+    rdf_it_t it;
+    struct rdf_batch batch;
+    const char *subj, *pred, *obj;
+    const char *subjs[SCAN_BATCH], *preds[SCAN_BATCH], *objs[SCAN_BATCH];
+    nid_t subj_ids[SCAN_BATCH], pred_ids[SCAN_BATCH], obj_ids[SCAN_BATCH];
+    long count = 0;
+    int n;
+    double start;
+
+    db = open_db(BENCH_FILE);
+
+    memset(&batch, 0, sizeof(batch));
+    batch.terms[0] = subjs;
+    batch.terms[1] = preds;
+    batch.terms[2] = objs;
+    batch.ids[0]   = subj_ids;
+    batch.ids[1]   = pred_ids;
+    batch.ids[2]   = obj_ids;
+
+    start = now();
+    switch(method)
+    {
+    case scan_next:
+        it = rdf_find(db, NULL, NULL, NULL, NULL, NULL);
+        while(rdf_next(it, &subj, &pred, &obj, NULL, NULL) > 0)
+            ++count;
+        break;
+
+    case scan_batch:
+        batch.ids[0] = batch.ids[1] = batch.ids[2] = NULL;
+        it = rdf_find(db, NULL, NULL, NULL, NULL, NULL);
+        while((n = rdf_next_batch(it, &batch, SCAN_BATCH)) > 0)
+            count += n;
+        break;
+
+    case scan_ids:
+        it = rdf_find_ids(db, 0, 0, 0);
+        while(rdf_next_ids(it, &subj_ids[0], &pred_ids[0], &obj_ids[0]) > 0)
+            ++count;
+        break;
+
+    case scan_ids_batch:
+        batch.terms[0] = batch.terms[1] = batch.terms[2] = NULL;
+        it = rdf_find_ids(db, 0, 0, 0);
+        while((n = rdf_next_batch(it, &batch, SCAN_BATCH)) > 0)
+            count += n;
+        break;
+    }
+    report(name, count, now() - start);
+
+    close_db(db);
+}
+
+/* Reads all triples by identifier with a reader from `arg', a pool. */
+static void *scan_thread(void *arg)
+{
+    rdf_pool_t pool = (rdf_pool_t)arg;
+    db_t db;
+    rdf_it_t it;
+    long count = 0;
+
+    if((db = rdf_pool_reader(pool)) == NULL)
+        return NULL;
+    it = rdf_find_ids(db, 0, 0, 0);
+    while(rdf_next_ids(it, NULL, NULL, NULL) > 0)
+        ++count;
+    rdf_pool_release(pool, db);
+
+    return (void*)count;
+}
+
+/* Scans the database from `threads' threads at once, while the writer
+   holds an open batch if `writing' is set. */
+static void bench_readers(const char *name, int threads, int writing)
+{
+    rdf_pool_t pool;
+    pthread_t tids[MAX_THREADS];
+    db_t writer = NULL;
+    void *result;
+    long count = 0, n;
+    char subj[64];
+    double start, elapsed;
+
+    if((pool = rdf_pool_open(BENCH_FILE, threads)) == NULL)
+    {
+        fprintf(stderr, "rdfbench: unable to open %s\n", BENCH_FILE);
+        exit(1);
+    }
+
+    if(writing)
+    {
+        writer = rdf_pool_writer(pool);
+        rdf_begin(writer);
+        for(n = 0; n < 1000; ++n)
+        {
+            sprintf(subj, EX "w%ld", n);
+            rdf_insert(writer, subj, EX "p0", "w", "", "");
+        }
+    }
+
+    start = now();
+    for(n = 0; n < threads; ++n)
+        pthread_create(&tids[n], NULL, scan_thread, pool);
+    for(n = 0; n < threads; ++n)
+    {
+        pthread_join(tids[n], &result);
+        count += (long)result;
+    }
+    elapsed = now() - start;
+
+    if(writing)
+    {
+        rdf_rollback(writer);
+        rdf_pool_release(pool, writer);
+    }
+    rdf_pool_close(pool);
+
+    report(name, count, elapsed);
+}
+
+/* Writes the whole database as N-Triples, to /dev/null. */
+static void bench_export(db_t db)
+{
+    FILE *fp;
+    long long count;
+    double start;
+
+    if((fp = fopen("/dev/null", "w")) == NULL)
+        return;
+    start = now();
+    count = rdf_write_ntriples(fp, rdf_find(db, NULL, NULL, NULL, NULL, NULL));
+    fflush(fp);
+    report("export_ntriples", (long)count, now() - start);
+    fclose(fp);
+}
+
+/* Loads the database, written as N-Triples, into a new one with the
+   streaming loader and with the parallel bulk loader. */
+static void bench_load(db_t db)
+{
+    FILE *fp;
+    db_t copy;
+    long long count;
+    double start;
+
+    if((fp = tmpfile()) == NULL)
+        return;
+    rdf_write_ntriples(fp, rdf_find(db, NULL, NULL, NULL, NULL, NULL));
+
+    rewind(fp);
+    remove(BENCH_COPY);
+    copy  = open_db(BENCH_COPY);
+    start = now();
+    count = rdf_load_ntriples(copy, fp, NULL);
+    report("load_ntriples", (long)count, now() - start);
+    close_db(copy);
+
+    rewind(fp);
+    remove(BENCH_COPY);
+    copy  = open_db(BENCH_COPY);
+    start = now();
+    count = rdf_bulk_load_ntriples(copy, fp, NULL);
+    report("bulk_load_ntriples", (long)count, now() - start);
+    close_db(copy);
+
+    fclose(fp);
+    remove(BENCH_COPY);
+}
+
+/* Writes a snapshot of the database, and restores it into a new one. */
+static void bench_snapshot(db_t db)
+{
+    FILE *fp;
+    db_t copy;
+    double start;
+
+    if((fp = fopen(BENCH_DUMP, "w+b")) == NULL)
+        return;
+    start = now();
+    if(rdf_dump(db, fp) != 0 || fflush(fp) != 0)
+    {
+        fprintf(stderr, "rdfbench: unable to write %s\n", BENCH_DUMP);
+        exit(1);
+    }
+    report("dump", params.triples, now() - start);
+
+    rewind(fp);
+    remove(BENCH_COPY);
+    copy  = open_db(BENCH_COPY);
+    start = now();
+    if(rdf_restore(copy, fp) != 0)
+    {
+        fprintf(stderr, "rdfbench: unable to restore %s\n", BENCH_DUMP);
+        exit(1);
+    }
+    report("restore", params.triples, now() - start);
+    close_db(copy);
+    fclose(fp);
+
+    remove(BENCH_COPY);
+    remove(BENCH_DUMP);
+}
+
+/* Parses queries of a few shapes, with constants from the data set. */
+static void bench_parse()
+{
+    static const char * const templates[] = {
+        "SELECT x, y FROM {x} <%s> {y}",
+        "SELECT DISTINCT y FROM {<%s>} p {y} WHERE p != ex:p0 "
+        "USING NAMESPACE ex = <" EX ">",
+        "SELECT x, n FROM {x} ex:p1 {y} ex:p2 {n}; [ex:p3 {m}], "
+        "{y} ex:p4 {<%s>} WHERE n = \"value 1\" OR m = NULL LIMIT 10 "
+        "USING NAMESPACE ex = <" EX ">",
+        "SELECT * FROM {x} ex:p0 {\"%s\"} UNION SELECT * FROM {x} ex:p1 {y} "
+        "USING NAMESPACE ex = <" EX ">" };
+    struct pool pool = { NULL };
+    struct triple t;
+    char text[512], *error;
+    long n;
+    double start, begin;
+
+    start_samples();
+    start = now();
+    for(n = 0; n < params.queries; ++n)
+    {
+        make_triple(pick(n, 9), &t);
+        sprintf(text, templates[n%4], (n%4 == 3) ? t.obj : t.subj);
+        begin = now();
+        if(parse_serql_buffer(text, strlen(text), &pool, &error) == NULL)
+        {
+            fprintf(stderr, "rdfbench: %s\n", error);
+            exit(1);
+        }
+        add_sample(now() - begin);
+        preset(&pool);
+    }
+    report("parse_serql", params.queries, now() - start);
+    pclear(&pool);
+}
+
+/* Runs queries from a few templates, with a term from the data set in
+   place of $t: either prepared through a query cache and bound, or
+   with the term written into the query text, which is parsed and
+   planned every time. */
+static void bench_serql(db_t db, int prepared)
+{
+    static const char * const templates[] = {
+        "SELECT y FROM {%s} ex:p0 {y} USING NAMESPACE ex = <" EX ">",
+        "SELECT x FROM {x} ex:p1 {%s} USING NAMESPACE ex = <" EX ">",
+        "SELECT p, y FROM {%s} p {y}" };
+    struct pool pool = { NULL };
+    struct triple t;
+    serql_cache_t cache = NULL;
+    serql_stmt_t stmt;
+    serql_cursor_t cursor;
+    struct query *query;
+    const char *values[2], *term, *type;
+    char text[512], quoted[256], *error = NULL;
+    long hits, misses, n;
+    double start, begin;
+
+    if(prepared && (cache = serql_cache_open(db, 0)) == NULL)
+        return;
+
+    start_samples();
+    start = now();
+    for(n = 0; n < params.queries; ++n)
+    {
+        /* Objects for the second template, subjects for the others */
+        make_triple(pick(n, 11), &t);
+        term = (n%3 == 1) ? t.obj : t.subj;
+        type = (n%3 == 1) ? t.type : NULL;
+        if(prepared)
+            sprintf(text, templates[n%3], "$t");
+        else
+        {
+            sprintf(quoted, type ? "\"%s\"" : "<%s>", term);
+            sprintf(text, templates[n%3], quoted);
+        }
+
+        begin = now();
+        if(prepared)
+        {
+            cursor = NULL;
+            if((stmt = serql_cache_prepare(cache, text, strlen(text), &error)))
+            {
+                serql_bind(stmt, "t", term, type, "");
+                cursor = serql_run(stmt, &pool, &error);
+            }
+        }
+        else
+        {
+            cursor = NULL;
+            if((query = parse_serql_buffer(text, strlen(text), &pool, &error)))
+                cursor = serql_execute(db, &pool, query, &error);
+        }
+        if(cursor == NULL)
+        {
+            fprintf(stderr, "rdfbench: %s\n", error);
+            exit(1);
+        }
+        while(serql_next(cursor, values) > 0)
+            ;
+        serql_close(cursor);
+        add_sample(now() - begin);
+        preset(&pool);
+    }
+    report(prepared ? "serql_prepared" : "serql_text", params.queries,
+           now() - start);
+    pclear(&pool);
+
+    if(prepared)
+    {
+        serql_cache_stats(cache, &hits, &misses);
+        printf("# serql_cache hits=%ld misses=%ld\n", hits, misses);
+        serql_cache_close(cache);
+    }
+}
+
+/* Drops random triples, each in a transaction of its own. */
+static void bench_drop(db_t db)
+{
+    struct triple t;
+    long count = (params.triples < UNBATCHED) ? params.triples : UNBATCHED, n;
+    double start, begin;
+
+    start_samples();
+    start = now();
+    for(n = 0; n < count; ++n)
+    {
+        make_triple(pick(n, 10), &t);
+        begin = now();
+        rdf_drop(db, t.subj, t.pred, t.obj, t.type, "");
+        add_sample(now() - begin);
+    }
+    report("drop", count, now() - start);
+}
+
+/* Reclaims the terms left unused by bench_drop() incrementally, in steps
+   of at most GC_STEP seconds. */
+static void bench_gc(db_t db)
+{
+    long steps = 0;
+    double start, begin;
+    int result;
+
+    start_samples();
+    start = now();
+    do {
+        begin  = now();
+        result = rdf_gc(db, GC_STEP);
+        add_sample(now() - begin);
+        ++steps;
+    } while(result > 0);
+    report("gc_steps", steps, now() - start);
+}
+
+/* Removes the nodes left unused by bench_drop(), and those bench_gc()
+   does not know about. */
+static void bench_purge(db_t db)
+{
+    double start = now();
+
+    rdf_purge(db);
+    report("purge", 1, now() - start);
+}
+
+/* Prints the usage to stdout when asked for with -h, and to stderr after
+   invalid options; then exits with `status'. */
+static void usage(int status)
+{
+    fprintf(status == 0 ? stdout : stderr,
+        "usage: rdfbench [-n triples] [-b batch] [-p predicates] [-z skew]\n"
+        "                [-l literal ratio] [-s seed] [-q queries] [-v] [-h]\n");
+    exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+    db_t db;
+    long unbatched;
+    char name[32];
+    int threads, opt, shape;
+
+    while((opt = getopt(argc, argv, "n:b:p:z:l:s:q:vh")) != -1)
+    {
+        switch(opt)
+        {
+        case 'n': params.triples    = atol(optarg); break;
+        case 'b': params.batch      = atol(optarg); break;
+        case 'p': params.predicates = atoi(optarg); break;
+        case 'z': params.skew       = atof(optarg); break;
+        case 'l': params.literals   = atof(optarg); break;
+        case 's': params.seed       = strtoul(optarg, NULL, 10); break;
+        case 'q': params.queries    = atol(optarg); break;
+        case 'v': params.stats      = 1; break;
+        case 'h': usage(0);
+        default:  usage(1);
+        }
+    }
+    if(params.triples <= 0 || params.predicates <= 0 || params.queries <= 0)
+        usage(1);
+
+    init_generator();
+    unbatched = (params.triples < UNBATCHED) ? params.triples : UNBATCHED;
+    samples = (double*)malloc(
+        ((params.triples > params.queries) ? params.triples : params.queries)*
+        sizeof(double) );
+
+    printf("# rdfbench triples=%ld batch=%ld predicates=%d skew=%.2f "
+           "literals=%.2f seed=%lu queries=%ld\n", params.triples,
+           params.batch, params.predicates, params.skew, params.literals,
+           params.seed, params.queries);
+    printf("benchmark\tops\tseconds\tops_per_s\tp50_us\tp99_us\n");
+
+    bench_insert("insert_unbatched", unbatched, 0, 0);
+    sprintf(name, "insert_batch_%ld_filtered", params.batch);
+    bench_insert(name, params.triples, params.batch, RDF_OPEN_BLOOM);
+    sprintf(name, "insert_batch_%ld", params.batch);
+    bench_insert(name, params.triples, params.batch, 0);
+
+    db = open_db(BENCH_FILE);
+    for(shape = 0; shape < 8; ++shape)
+        bench_find(db, shape);
+    bench_exists(db, "exists");
+    close_db(db);
+
+    db = open_db_flags(BENCH_FILE, RDF_OPEN_BLOOM);
+    bench_filter(db);
+    bench_exists(db, "exists_filtered");
+    close_db(db);
+
+    bench_scan("scan_next", scan_next);
+    sprintf(name, "scan_batch_%d", SCAN_BATCH);
+    bench_scan(name, scan_batch);
+    bench_scan("scan_ids", scan_ids);
+    sprintf(name, "scan_ids_batch_%d", SCAN_BATCH);
+    bench_scan(name, scan_ids_batch);
+    for(threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+        sprintf(name, "scan_ids_threads_%d", threads);
+        bench_readers(name, threads, 0);
+    }
+    bench_readers("scan_ids_while_writing", 1, 1);
+
+    db = open_db(BENCH_FILE);
+    bench_export(db);
+    bench_load(db);
+    bench_snapshot(db);
+    bench_parse();
+    bench_serql(db, 0);
+    bench_serql(db, 1);
+    bench_drop(db);
+    bench_gc(db);
+    bench_purge(db);
+    close_db(db);
+
+    remove(BENCH_FILE);
+    free(samples);
+    free(pred_cdf);
+
+    return 0;
+}
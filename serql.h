@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include "pool.h"
+#include "storage.h"
 
 struct namespace_decl {
     struct namespace_decl *next;
@@ -15,6 +16,7 @@ struct table_query {
 
     struct table_query *next;
 
+    struct projection *projection;  /* NULL selects all variables */
     struct graph_expr *from;
     char              distinct;
     long long int     limit, offset;
@@ -26,7 +28,8 @@ struct query {
 };
 
 struct value {
-    enum { null, string, integer, real, uri, variable, UNIMPLEMENTED } type;
+    enum { null, string, integer, real, uri, variable, parameter,
+           UNIMPLEMENTED } type;
 
     union {
         long long       integer;
@@ -37,10 +40,17 @@ struct value {
             char        *datatype;
         };
         char            *uri;
-        char            *identifier;
+        char            *identifier;    /* variables and parameters */
     };
 };
 
+struct projection {
+    struct projection *next;
+
+    struct value value;
+    char         *alias;
+};
+
 struct identifier {
     struct identifier *next;
 
@@ -53,6 +63,7 @@ struct expression {
 
     struct value      value;
     struct expression *left, *right;
+    nid_t             id;   /* of a constant value, looked up per execution */
 };
 
 struct node_elem {
@@ -79,6 +90,114 @@ struct graph_expr {
     struct identifier *identifiers;
 };
 
+/* State of a parse, shared by the parser and the scanner. */
+struct serql_parser {
+    pool_t        pool;
+    struct query  *query;
+    char          *error;
+
+    int           line, col, chars;     /* position of the scanner */
+    int           in_place;             /* scanning a buffer in the pool */
+};
+
+/* Parses a query from `fp'. This is reentrant: all state is kept in a
+   parser and scanner of its own, so different threads may parse at the
+   same time (with different pools). */
 struct query *parse_serql(FILE *fp, pool_t pool, char **error);
 
+/* Parses a query from the `size' bytes at `data'. The input is copied into
+   the pool once and scanned there; URIs and strings without escapes in the
+   result point into that copy instead of being copied again. */
+struct query *parse_serql_buffer( const char *data, size_t size,
+                                  pool_t pool, char **error );
+
+/* Compiles a parsed query into a single SQL statement over the rdfdb
+   schema. Returns NULL and sets *error if the query cannot be compiled. */
+char *serql_to_sql(pool_t pool, struct query *query, char **error);
+
+/* Expands a qualified name using the namespaces declared in the query,
+   or the default ones (rdf, rdfs, xsd, owl and serql). */
+const char *serql_expand_uri(pool_t pool, struct query *query, const char *uri);
+
+/* Executes a parsed query directly on the database. Each group of
+   triple patterns is joined in the order that minimizes the estimated
+   cost, using index nested loop or hash joins; optional patterns are
+   evaluated with left outer joins and WHERE clauses are applied as soon as
+   their variables are bound. The plan works on node identifiers; terms are
+   only decoded by serql_next().
+
+   All memory is taken from `pool', which must outlive the cursor. Returns
+   NULL and sets *error if the query cannot be executed. */
+typedef struct serql_cursor *serql_cursor_t;
+
+serql_cursor_t serql_execute( db_t db, pool_t pool,
+                              struct query *query, char **error );
+
+int serql_columns(serql_cursor_t cursor);
+
+const char *serql_column_name(serql_cursor_t cursor, int column);
+
+/* Reads the next result row into `values', which must have room for
+   serql_columns() entries; unbound values are NULL. Strings remain valid
+   until the next call. Returns 1 if a row was read, 0 at the end. */
+int serql_next(serql_cursor_t cursor, const char **values);
+
+/* Prints the chosen plans, with estimated cardinalities and costs. */
+void serql_explain(serql_cursor_t cursor, FILE *fp);
+
+void serql_close(serql_cursor_t cursor);
+
+/* Prepared queries. A query may contain placeholders, written $name, in
+   place of constant terms; values are bound to them before each run. The
+   query is parsed and planned once, using average estimates for the
+   placeholders, and the plan is reused by every run; the identifiers of
+   all constants are looked up again each time.
+
+   serql_prepare() parses `size' bytes of query text at `data'. All memory
+   of the prepared query is taken from `pool'. A prepared query belongs to
+   one database handle, and must not be run by two threads at once. */
+typedef struct serql_stmt *serql_stmt_t;
+
+serql_stmt_t serql_prepare( db_t db, pool_t pool, const char *data,
+                            size_t size, char **error );
+
+int serql_parameters(serql_stmt_t stmt);
+
+const char *serql_parameter_name(serql_stmt_t stmt, int n);
+
+/* Binds a term to the placeholder named `name' (without the $). The
+   datatype is NULL for a URI; integers and doubles (by their XSD datatype)
+   are bound as numbers. The strings are not copied, and must remain valid
+   until the query is run. Returns -1 if there is no such placeholder. */
+int serql_bind( serql_stmt_t stmt, const char *name, const char *lexical,
+                const char *datatype, const char *language );
+
+/* Runs a prepared query with the current bindings; otherwise like
+   serql_execute(). Returns NULL and sets *error if a placeholder is not
+   bound. The cursor stays valid when the query is run again, and after
+   the query is gone (evicted from a cache, or its pool reset), except for
+   serql_explain(); it must be closed before `pool' is reset. */
+serql_cursor_t serql_run(serql_stmt_t stmt, pool_t pool, char **error);
+
+/* A cache of prepared queries, keyed on their text with runs of white
+   space outside of strings collapsed, so that applications can pass query
+   text as is and have each distinct query parsed and planned only once.
+   When full, the least recently used query is evicted. */
+typedef struct serql_cache *serql_cache_t;
+
+serql_cache_t serql_cache_open(db_t db, int capacity);
+
+void serql_cache_close(serql_cache_t cache);
+
+/* Returns the prepared query for the given text, preparing it on a miss.
+   The query belongs to the cache, and remains valid until the next call;
+   cursors returned by serql_run() for it remain valid after that.
+   Queries that fail to prepare are cached too, with their error. */
+serql_stmt_t serql_cache_prepare( serql_cache_t cache, const char *data,
+                                  size_t size, char **error );
+
+/* Reports the number of lookups that found a prepared query, and the
+   number that had to prepare one. Either pointer may be NULL. */
+void serql_cache_stats(serql_cache_t cache, long *hits, long *misses);
+
 #endif /* ndef SERQL_H_INCLUDED */
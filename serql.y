@@ -8,65 +8,73 @@
 #include "serql.h"
 #include "pool.h"
 
-
-/* Global variables */
-static pool_t pool;
-static char *parse_error;
-static struct query *query;
-
-/* Defined in lexfile */
-extern char *yytext;
-extern int line, col, chars;
-
 #define PALLOC(p,type) (type*)palloc(p,sizeof(type))
 
-
-void yyerror(const char *string)
+void assign_subject(struct node_elem *subj, struct graph_expr *expr)
 {
-    int tokenlen = strlen(yytext);
+    struct path_expr *pe;
+    struct graph_expr *ge;
 
-    col   -= tokenlen;
-    chars += col;
+    /* The subject may still be NULL here; it is filled in when the
+       enclosing path expression is reduced. */
+    for(pe = expr->mandatory; pe; pe = pe->next)
+        if(pe->subj == NULL)
+            pe->subj = subj;
 
-    if(*yytext)
-    {
-        parse_error = pprintf(pool,
-            "unexpected token '%s' (character %d on line %d, column %d)",
-            yytext, chars + 1, line + 1, col + 1 );
-    }
-    else
-    {
-        parse_error = pprintf(pool, 
-            "unexpected end of input at character %d on line %d, column %d",
-            chars + 1, line + 1, col + 1 );
-    }
+    for(ge = expr->optional; ge; ge = ge->next)
+        assign_subject(subj, ge);
 }
 
-int yywrap()
+/* Returns a token whose text stays terminated in the scanner's buffer. That
+   buffer is only kept when it was allocated from the parser's pool;
+   otherwise the token is copied. */
+char *token_string(struct serql_parser *parser, char *token)
 {
-    return 1;
+    return parser->in_place ? token : pstrdup(parser->pool, token);
 }
 
-void assign_subject(struct node_elem *subj, struct graph_expr *expr)
+/* Strips the quotes from a string token and decodes its escape sequences.
+   The token may no longer be terminated when the parser needed a lookahead
+   token, so it is scanned up to its closing quote. A string without escape
+   sequences is terminated in place when the scanner's buffer is kept. */
+char *unquote(struct serql_parser *parser, char *token)
 {
-    struct path_expr *pe;
-    struct graph_expr *ge;
+    char *p = token + 1, *result, *q;
 
-    /* TEMP */
-    if(subj == NULL)
-        fprintf(stderr, "WARNING: assigning NULL subject!\n");
+    if(parser->in_place)
+    {
+        for(q = p; *q != '"' && *q != '\\'; ++q) { };
+        if(*q == '"')
+        {
+            *q = '\0';
+            return p;
+        }
+    }
 
-    for(pe = expr->mandatory; pe; pe = pe->next)
-        if(pe->subj == NULL)
-            pe->subj = subj;
+    q = result = (char*)palloc(parser->pool, strlen(p) + 1);
+    while(*p && *p != '"')
+    {
+        if(*p == '\\')
+        {
+            switch(*++p)
+            {
+            case 't':   *q++ = '\t'; break;
+            case 'r':   *q++ = '\r'; break;
+            case 'n':   *q++ = '\n'; break;
+            default:    *q++ = *p;
+            }
+            ++p;
+        }
+        else
+            *q++ = *p++;
+    }
+    *q = '\0';
 
-    for(ge = expr->optional; ge; ge = ge->next)
-        for(pe = ge->mandatory; pe; pe = pe->next)
-            if(pe->subj == NULL)
-                pe->subj = subj;
+    return result;
 }
 
-struct graph_expr *merge_paths(struct graph_expr *f, struct graph_expr *g)
+struct graph_expr *merge_paths( pool_t pool,
+                                struct graph_expr *f, struct graph_expr *g )
 {
     struct path_expr **pe;
     struct graph_expr **ge;
@@ -83,28 +91,15 @@ struct graph_expr *merge_paths(struct graph_expr *f, struct graph_expr *g)
     return f;
 }
 
-
-
-struct query *parse_serql(FILE *fp, pool_t p, char **error)
-{
-    pool = p;
-    parse_error = NULL;
-    line = col = chars =0;
-    yyrestart(fp);
-
-    if(yyparse() != 0)
-    {
-        if(error != NULL)
-            *error = parse_error;
-
-        return NULL;
-    }
-
-    return query;
-}
-
 %}
 
+/* The parser and scanner keep all their state in a struct serql_parser
+   and a flex scanner, so that queries can be parsed in parallel. */
+%define api.pure
+%parse-param { struct serql_parser *parser }
+%parse-param { void *scanner }
+%lex-param   { void *scanner }
+
 %union {
     char                  *string;
     double                real;
@@ -118,9 +113,109 @@ struct query *parse_serql(FILE *fp, pool_t p, char **error)
     struct node_elem      *node_elem;
     struct path_expr      *path_expr;
     struct graph_expr     *graph_expr;
+    struct projection     *projection;
+}
+
+%{
+/* Defined in lexfile; the scanner is a yyscan_t */
+int yylex(YYSTYPE *lvalp, void *scanner);
+int yylex_init_extra(struct serql_parser *parser, void **scanner);
+void yyset_in(FILE *fp, void *scanner);
+struct yy_buffer_state *yy_scan_buffer(char *base, size_t size, void *scanner);
+char *yyget_text(void *scanner);
+int yylex_destroy(void *scanner);
+
+void yyerror(struct serql_parser *parser, void *scanner, const char *string)
+{
+    const char *text = yyget_text(scanner);
+    int col = parser->col - strlen(text), chars = parser->chars + col;
+
+    if(*text)
+    {
+        parser->error = pprintf(parser->pool,
+            "unexpected token '%s' (character %d on line %d, column %d)",
+            text, chars + 1, parser->line + 1, col + 1 );
+    }
+    else
+    {
+        parser->error = pprintf(parser->pool,
+            "unexpected end of input at character %d on line %d, column %d",
+            chars + 1, parser->line + 1, col + 1 );
+    }
+}
+
+/* Runs the parser on a scanner that has its input set. */
+static struct query *run_parser( struct serql_parser *parser, void *scanner,
+                                 char **error )
+{
+    int result = yyparse(parser, scanner);
+
+    yylex_destroy(scanner);
+    if(result != 0)
+    {
+        if(error != NULL)
+            *error = parser->error;
+
+        return NULL;
+    }
+
+    return parser->query;
+}
+
+struct query *parse_serql(FILE *fp, pool_t pool, char **error)
+{
+    struct serql_parser parser;
+    void *scanner;
+
+    memset(&parser, 0, sizeof(parser));
+    parser.pool = pool;
+    if(yylex_init_extra(&parser, &scanner) != 0)
+    {
+        if(error != NULL)
+            *error = pstrdup(pool, "unable to create scanner");
+        return NULL;
+    }
+    yyset_in(fp, scanner);
+
+    return run_parser(&parser, scanner, error);
+}
+
+struct query *parse_serql_buffer( const char *data, size_t size,
+                                  pool_t pool, char **error )
+{
+    struct serql_parser parser;
+    void *scanner;
+    char *buffer;
+
+    /* Flex scans a buffer in place if it ends with two NUL characters. The
+       copy is kept in the pool, so tokens may point into it. */
+    buffer = (char*)palloc(pool, size + 2);
+    memcpy(buffer, data, size);
+    buffer[size] = buffer[size + 1] = '\0';
+
+    memset(&parser, 0, sizeof(parser));
+    parser.pool     = pool;
+    parser.in_place = 1;
+    if(yylex_init_extra(&parser, &scanner) != 0)
+    {
+        if(error != NULL)
+            *error = pstrdup(pool, "unable to create scanner");
+        return NULL;
+    }
+    if(yy_scan_buffer(buffer, size + 2, scanner) == NULL)
+    {
+        yylex_destroy(scanner);
+        if(error != NULL)
+            *error = pstrdup(pool, "unable to create scanner");
+        return NULL;
+    }
+
+    return run_parser(&parser, scanner, error);
 }
 
-%token <string>  FULL_URI QNAME BNODE STRING IDENTIFIER LANGUAGE_TAG
+%}
+
+%token <string>  FULL_URI QNAME BNODE STRING IDENTIFIER LANGUAGE_TAG PARAMETER
 %token <real>    REAL
 %token <integer> INTEGER
 
@@ -137,14 +232,15 @@ struct query *parse_serql(FILE *fp, pool_t p, char **error)
 
 %type <namespace_decl>  NamespaceDecl NamespaceList OptionalNamespaceList
 %type <table_query>     TableQuerySet TableQuery SelectQuery
-%type <value>           Var Value VarOrValue Literal Edge
+%type <value>           Var Param Value VarOrValue Literal Edge
 %type <expression>      BooleanExpr BooleanElem AndExpr WhereClause OptionalWhereClause
 %type <query>           Query
 %type <integer>         SignedInteger SetOperator
 %type <integer>         OptionalLimitClause OptionalOffsetClause OptionalDistinct
 %type <integer>         CompOp
 %type <real>            SignedReal
-%type <string>          Uri
+%type <string>          Uri OptionalAsClause NamespacePrefix
+%type <projection>      Projection ProjectionElem
 %type <node_elem>       Node NodeElemList NodeElem
 %type <graph_expr>      PathExpr PathExprTail PathExprPath PathExprList GraphPattern OptionalFromClause
 
@@ -153,9 +249,9 @@ struct query *parse_serql(FILE *fp, pool_t p, char **error)
 
 %%
 
-Uri:                    FULL_URI    { $$ = pstrdup(pool, $1); }
-                        | QNAME     { $$ = pstrdup(pool, $1); }
-                        | BNODE     { $$ = pstrdup(pool, $1); };
+Uri:                    FULL_URI    { $$ = token_string(parser, $1); }
+                        | QNAME     { $$ = pstrdup(parser->pool, $1); }
+                        | BNODE     { $$ = pstrdup(parser->pool, $1); };
 
 SignedInteger:          INTEGER         { $$ =  $1; }
                         | '+' INTEGER   { $$ = +$2; }
@@ -167,20 +263,20 @@ SignedReal:             REAL            { $$ =  $1; }
 
 Literal:                STRING {
                             $$.type        = string;
-                            $$.lexical     = pstrdup(pool, $1);
+                            $$.lexical     = unquote(parser, $1);
                             $$.language    = NULL;
                             $$.datatype    = NULL;
                         }
                         | STRING OP_DATATYPE Uri {
                             $$.type        = string;
-                            $$.lexical     = pstrdup(pool, $1);
+                            $$.lexical     = unquote(parser, $1);
                             $$.language    = NULL;
-                            $$.datatype    = pstrdup(pool, $3);
+                            $$.datatype    = $3;
                         }
                         | STRING LANGUAGE_TAG {
                             $$.type        = string;
-                            $$.lexical     = pstrdup(pool, $1);
-                            $$.language    = pstrdup(pool, $2);
+                            $$.lexical     = unquote(parser, $1);
+                            $$.language    = pstrdup(parser->pool, $2);
                             $$.datatype    = NULL;
                         }
                         | SignedInteger {
@@ -194,7 +290,12 @@ Literal:                STRING {
 
 Var:                    IDENTIFIER {
                             $$.type        = variable;
-                            $$.identifier  = pstrdup(pool, $1);
+                            $$.identifier  = pstrdup(parser->pool, $1);
+                        };
+
+Param:                  PARAMETER {
+                            $$.type        = parameter;
+                            $$.identifier  = pstrdup(parser->pool, $1);
                         };
 
 Value:                  KW_NULL {
@@ -205,6 +306,7 @@ Value:                  KW_NULL {
                             $$.uri         = $1;
                         }
                         | Literal
+                        | Param
                         | KW_DATATYPE  '(' Var ')'  { $$.type = UNIMPLEMENTED; }
                         | KW_LANG      '(' Var ')'  { $$.type = UNIMPLEMENTED; }
                         | KW_LABEL     '(' Var ')'  { $$.type = UNIMPLEMENTED; }
@@ -225,30 +327,30 @@ AnyOrAll:               KW_ANY
 
 BooleanElem:            '(' BooleanExpr ')' { $$ = $2; }
                         | KW_TRUE {
-                            $$ = PALLOC(pool, struct expression);
+                            $$ = PALLOC(parser->pool, struct expression);
                             $$->type  = value;
                             $$->value.type    = integer;
                             $$->value.integer = 1;
                         }
                         | KW_FALSE {
-                            $$ = PALLOC(pool, struct expression);
+                            $$ = PALLOC(parser->pool, struct expression);
                             $$->type  = value;
                             $$->value.type    = integer;
                             $$->value.integer = 0;
                         }
                         | KW_NOT BooleanElem {
-                            $$ = PALLOC(pool, struct expression);
+                            $$ = PALLOC(parser->pool, struct expression);
                             $$->type  = negation;
                             $$->left  = $2;
                             $$->right = NULL;
                         }
                         | VarOrValue CompOp VarOrValue {
-                            $$ = PALLOC(pool, struct expression);
-                            $$->left  = PALLOC(pool, struct expression);
-                            $$->right = PALLOC(pool, struct expression);
+                            $$ = PALLOC(parser->pool, struct expression);
+                            $$->left  = PALLOC(parser->pool, struct expression);
+                            $$->right = PALLOC(parser->pool, struct expression);
                             $$->left->type = value;
                             $$->right->type = value;
-                            if($2 > 0)
+                            if($2 >= 0)
                             {
                                 $$->left->value  = $1;
                                 $$->right->value = $3;
@@ -259,7 +361,7 @@ BooleanElem:            '(' BooleanExpr ')' { $$ = $2; }
                             {
                                 $$->left->value  = $3;
                                 $$->right->value = $1;
-                                $$->type = (-$2 == 2) ? less : less_or_equal;
+                                $$->type = (-$2 == 3) ? less : less_or_equal;
                             }
                         }
                         | VarOrValue CompOp AnyOrAll '(' TableQuerySet ')' { $$ = NULL; }
@@ -273,7 +375,7 @@ BooleanElem:            '(' BooleanExpr ')' { $$ = $2; }
 
 AndExpr:                BooleanElem
                         | AndExpr KW_AND BooleanElem {
-                            $$ = PALLOC(pool, struct expression);
+                            $$ = PALLOC(parser->pool, struct expression);
                             $$->type  = conjunction;
                             $$->left  = $1;
                             $$->right = $3;
@@ -281,24 +383,30 @@ AndExpr:                BooleanElem
 
 BooleanExpr:            AndExpr
                         | BooleanExpr KW_OR AndExpr {
-                            $$ = PALLOC(pool, struct expression);
+                            $$ = PALLOC(parser->pool, struct expression);
                             $$->type  = disjunction;
                             $$->left  = $1;
                             $$->right = $3;
                         };
 
 NodeElem:               Literal {
-                            $$ = PALLOC(pool, struct node_elem);
+                            $$ = PALLOC(parser->pool, struct node_elem);
                             $$->next  = NULL;
                             $$->value = $1;
                         }
                         | Var {
-                            $$ = PALLOC(pool, struct node_elem);
+                            $$ = PALLOC(parser->pool, struct node_elem);
+                            $$->next  = NULL;
+                            $$->value = $1;
+                        }
+                        | Param {
+                            $$ = PALLOC(parser->pool, struct node_elem);
                             $$->next  = NULL;
                             $$->value = $1;
                         }
                         | Uri {
-                            $$ = PALLOC(pool, struct node_elem);
+                            $$ = PALLOC(parser->pool, struct node_elem);
+                            $$->next        = NULL;
                             $$->value.type  = uri;
                             $$->value.uri   = $1;
                         };
@@ -310,16 +418,17 @@ NodeElemList:           NodeElem
                         };
 
 Node:                   '{' '}' {
-                            $$ = PALLOC(pool, struct node_elem);
+                            $$ = PALLOC(parser->pool, struct node_elem);
                             $$->next = NULL;
                             $$->value.type       = variable;
-                            $$->value.identifier = pprintf(pool, ".%d", chars);
+                            $$->value.identifier = pprintf(parser->pool, ".%d", parser->chars + parser->col);
                         }
                         | '{' NodeElemList '}' {
                             $$ = $2;
                         };
 
 Edge:                   Var
+                        | Param
                         | Uri {
                             $$.type        = uri;
                             $$.identifier  = $1;
@@ -335,7 +444,7 @@ PathExpr:               Node PathExprPath {
                             $$ = $2;
                         }
                         | '[' GraphPattern ']' {
-                            $$ = PALLOC(pool, struct graph_expr);
+                            $$ = PALLOC(parser->pool, struct graph_expr);
                             $$->next      = NULL;
                             $$->mandatory = NULL;
                             $$->optional  = $2;
@@ -345,17 +454,17 @@ PathExpr:               Node PathExprPath {
 PathExprPath:           PathExprTail
                         | PathExprPath ';' PathExprTail {
                             assign_subject($1->mandatory->subj, $3);
-                            $$ = merge_paths($1, $3);
+                            $$ = merge_paths(parser->pool, $1, $3);
                         }
                         | PathExprPath PathExprTail {
                             assign_subject($1->mandatory->obj, $2);
-                            $$ = merge_paths($1, $2);
+                            $$ = merge_paths(parser->pool, $1, $2);
                         };
 
 PathExprTail:           Edge Node {
-                            $$ = PALLOC(pool, struct graph_expr);
+                            $$ = PALLOC(parser->pool, struct graph_expr);
                             $$->next      = NULL;
-                            $$->mandatory = PALLOC(pool, struct path_expr);
+                            $$->mandatory = PALLOC(parser->pool, struct path_expr);
                             $$->optional  = NULL;
                             $$->where     = NULL;
                             $$->mandatory->next = NULL;
@@ -364,16 +473,17 @@ PathExprTail:           Edge Node {
                             $$->mandatory->obj  = $2;
                         }
                         | '[' PathExprPath OptionalWhereClause ']' {
-                            $$ = PALLOC(pool, struct graph_expr);
+                            $$ = PALLOC(parser->pool, struct graph_expr);
                             $$->next      = NULL;
                             $$->mandatory = NULL;
                             $$->optional  = $2;
-                            $$->where     = $3;
+                            $$->where     = NULL;
+                            $2->where     = $3;
                         };
 
 PathExprList:           PathExpr
                         | PathExprList ',' PathExpr {
-                            $$ = merge_paths($1, $3);
+                            $$ = merge_paths(parser->pool, $1, $3);
                         };
 
 GraphPattern:           PathExprList OptionalWhereClause {
@@ -381,13 +491,24 @@ GraphPattern:           PathExprList OptionalWhereClause {
                             $$->where = $2;
                         };
 
-OptionalAsClause:       | KW_AS STRING;
+OptionalAsClause:                   { $$ = NULL; }
+                        | KW_AS STRING { $$ = unquote(parser, $2); };
 
-ProjectionElem:         VarOrValue OptionalAsClause;
+ProjectionElem:         VarOrValue OptionalAsClause {
+                            $$ = PALLOC(parser->pool, struct projection);
+                            $$->next  = NULL;
+                            $$->value = $1;
+                            $$->alias = $2;
+                        };
 
-Projection:             '*'
+Projection:             '*' { $$ = NULL; }
                         | ProjectionElem
-                        | Projection ',' ProjectionElem;
+                        | Projection ',' ProjectionElem {
+                            struct projection *p;
+                            for(p = $1; p->next; p = p->next) { };
+                            p->next = $3;
+                            $$ = $1;
+                        };
 
 OptionalDistinct:                       { $$ = 0; }
                         | KW_DISTINCT   { $$ = 1; };
@@ -403,11 +524,12 @@ OptionalOffsetClause:                       { $$ = -1; }
 
 SelectQuery:            KW_SELECT OptionalDistinct Projection OptionalFromClause
                         OptionalLimitClause OptionalOffsetClause {
-                            $$ = PALLOC(pool, struct table_query);
-                            $$->next     = NULL;
-                            $$->distinct = $2;
-                            /* TODO projection */
-                            $$->from     = $4;
+                            $$ = PALLOC(parser->pool, struct table_query);
+                            $$->setop      = setop_union;
+                            $$->next       = NULL;
+                            $$->distinct   = $2;
+                            $$->projection = $3;
+                            $$->from       = $4;
                             $$->limit    = $5;
                             $$->offset   = $6;
                         };
@@ -422,15 +544,20 @@ TableQuery:             SelectQuery { $$ = $1; }
 
 TableQuerySet:          TableQuery
                         | TableQuerySet SetOperator TableQuery {
-                            $$        = $1;
-                            $$->setop = $2;
-                            $$->next  = $3;
+                            struct table_query *tq;
+                            for(tq = $1; tq->next; tq = tq->next) { };
+                            tq->setop = $2;
+                            tq->next  = $3;
+                            $$ = $1;
                         };
 
-NamespaceDecl:          IDENTIFIER OP_EQ FULL_URI {
-                            $$ = PALLOC(pool, struct namespace_decl);
-                            $$->prefix = pstrdup(pool, $1);
-                            $$->uri    = pstrdup(pool, $3);
+NamespacePrefix:        IDENTIFIER  { $$ = pstrdup(parser->pool, $1); };
+
+NamespaceDecl:          NamespacePrefix OP_EQ FULL_URI {
+                            $$ = PALLOC(parser->pool, struct namespace_decl);
+                            $$->next   = NULL;
+                            $$->prefix = $1;
+                            $$->uri    = token_string(parser, $3);
                         };
 
 NamespaceList:          NamespaceDecl
@@ -443,9 +570,9 @@ OptionalNamespaceList:  { $$ = NULL; }
                         | KW_USING KW_NAMESPACE NamespaceList { $$ = $3; };
 
 Query:                  TableQuerySet OptionalNamespaceList {
-                            $$ = PALLOC(pool, struct query);
+                            $$ = PALLOC(parser->pool, struct query);
                             $$->queries         = $1;
                             $$->namespace_decls = $2;
-                            query = $$;
+                            parser->query = $$;
                         }
 /* EOF */
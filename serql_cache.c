@@ -0,0 +1,197 @@
+#include "serql.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of queries cached if no capacity is given */
+#define DEFAULT_CAPACITY (256)
+
+struct entry
+{
+    struct entry    *next;          /* in hash chain */
+    size_t          hash;
+    char            *text;          /* normalized query text */
+    unsigned long   used;           /* clock value of last lookup */
+    serql_stmt_t    stmt;           /* NULL if the query failed */
+    char            *error;
+    struct pool     pool;           /* holds the text and the query */
+};
+
+struct serql_cache
+{
+    db_t            db;
+    struct entry    **buckets;
+    size_t          nbuckets;
+    int             count, capacity;
+    unsigned long   clock;
+    long            hits, misses;
+};
+
+
+/* Copies query text, collapsing runs of white space outside of strings
+   into a single space and dropping it at either end. */
+static size_t normalize(const char *data, size_t size, char *out)
+{
+    size_t n, len = 0;
+    int quoted = 0, space = 0;
+
+    for(n = 0; n < size; ++n)
+    {
+        char ch = data[n];
+
+        if(!quoted && (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n'))
+        {
+            space = 1;
+            continue;
+        }
+        if(space && len > 0)
+            out[len++] = ' ';
+        space = 0;
+        out[len++] = ch;
+
+        if(ch == '"')
+            quoted = !quoted;
+        else
+        if(ch == '\\' && quoted && n + 1 < size)
+            out[len++] = data[++n];
+    }
+    out[len] = '\0';
+
+    return len;
+}
+
+/* FNV-1a */
+static size_t hash_text(const char *text)
+{
+    unsigned h = 2166136261u;
+
+    while(*text)
+        h = (h ^ (unsigned char)*text++) * 16777619u;
+
+    return h;
+}
+
+static void free_entry(struct entry *e)
+{
+    pclear(&e->pool);
+    free(e);
+}
+
+/* Removes the least recently used entry. */
+static void evict(serql_cache_t cache)
+{
+    struct entry **p, **victim = NULL;
+    size_t n;
+
+    for(n = 0; n < cache->nbuckets; ++n)
+        for(p = &cache->buckets[n]; *p; p = &(*p)->next)
+            if(victim == NULL || (*p)->used < (*victim)->used)
+                victim = p;
+
+    if(victim != NULL)
+    {
+        struct entry *e = *victim;
+        *victim = e->next;
+        free_entry(e);
+        --cache->count;
+    }
+}
+
+serql_cache_t serql_cache_open(db_t db, int capacity)
+{
+    serql_cache_t cache;
+
+    if(capacity <= 0)
+        capacity = DEFAULT_CAPACITY;
+
+    if((cache = (serql_cache_t)malloc(sizeof(struct serql_cache))) == NULL)
+        return NULL;
+    memset(cache, 0, sizeof(struct serql_cache));
+
+    for(cache->nbuckets = 16; cache->nbuckets < (size_t)capacity; cache->nbuckets *= 2) { };
+    cache->buckets = (struct entry**)calloc(cache->nbuckets, sizeof(struct entry*));
+    if(cache->buckets == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+    cache->db       = db;
+    cache->capacity = capacity;
+
+    return cache;
+}
+
+void serql_cache_close(serql_cache_t cache)
+{
+    struct entry *e, *next;
+    size_t n;
+
+    for(n = 0; n < cache->nbuckets; ++n)
+        for(e = cache->buckets[n]; e; e = next)
+        {
+            next = e->next;
+            free_entry(e);
+        }
+    free(cache->buckets);
+    free(cache);
+}
+
+serql_stmt_t serql_cache_prepare( serql_cache_t cache, const char *data,
+                                  size_t size, char **error )
+{
+    struct entry *e;
+    struct pool pool = { NULL };
+    char *text;
+    size_t len, hash;
+
+    text = (char*)palloc(&pool, size + 1);
+    len  = normalize(data, size, text);
+    hash = hash_text(text);
+
+    for(e = cache->buckets[hash & (cache->nbuckets - 1)]; e; e = e->next)
+        if(e->hash == hash && strcmp(e->text, text) == 0)
+            break;
+
+    if(e != NULL)
+    {
+        pclear(&pool);
+        ++cache->hits;
+    }
+    else
+    {
+        ++cache->misses;
+        if(cache->count == cache->capacity)
+            evict(cache);
+
+        if((e = (struct entry*)malloc(sizeof(struct entry))) == NULL)
+        {
+            pclear(&pool);
+            if(error != NULL)
+                *error = "out of memory";
+            return NULL;
+        }
+        memset(e, 0, sizeof(struct entry));
+        e->pool  = pool;
+        e->hash  = hash;
+        e->text  = text;
+        e->error = NULL;
+        e->stmt  = serql_prepare(cache->db, &e->pool, text, len, &e->error);
+
+        e->next = cache->buckets[hash & (cache->nbuckets - 1)];
+        cache->buckets[hash & (cache->nbuckets - 1)] = e;
+        ++cache->count;
+    }
+
+    e->used = ++cache->clock;
+    if(e->stmt == NULL && error != NULL)
+        *error = e->error;
+
+    return e->stmt;
+}
+
+void serql_cache_stats(serql_cache_t cache, long *hits, long *misses)
+{
+    if(hits != NULL)
+        *hits = cache->hits;
+    if(misses != NULL)
+        *misses = cache->misses;
+}
@@ -0,0 +1,1836 @@
+#include "serql.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Executes SerQL queries on node identifiers.
+ *
+ * Every variable of a table query gets a slot in a row of identifiers
+ * (0 meaning unbound), and operators pass the same row up the plan:
+ *
+ *   seed       produces its input row once; the leaf of every plan
+ *   scan/join  matches a triple pattern, probing the indices with the
+ *              values bound so far (index nested loop join)
+ *   hash       matches a triple pattern against a hash table, built from
+ *              a single scan of the pattern on first use
+ *   filter     passes rows that satisfy (part of) a WHERE clause
+ *   optional   left outer join with a sub-plan that is run for each row
+ *
+ * The patterns of each group are ordered by dynamic programming over
+ * left-deep plans, using cardinality estimates from rdf_estimate().
+ *
+ * A prepared query keeps its plans and runs them again for each set of
+ * bindings of its placeholders; the identifiers of constants are looked
+ * up again before each run, as the database may have changed.
+ */
+
+/* Variables are tracked in bit sets */
+typedef unsigned long long varset_t;
+#define MAX_VARS            (64)
+#define VAR(n)              ((varset_t)1 << (n))
+
+/* Largest number of distinct placeholders in a query */
+#define MAX_PARAMS          (32)
+
+/* Groups with more patterns than this are ordered greedily */
+#define MAX_DP_PATTERNS     (12)
+
+/* Cost units, relative to reading one triple from an index */
+#define PROBE_COST          (4.0)   /* index lookup */
+#define BUILD_COST          (2.0)   /* adding a triple to a hash table */
+
+#define XSD_NS "http://www.w3.org/2001/XMLSchema#"
+
+struct pattern
+{
+    struct value    *term[3];       /* subject, predicate, object */
+    nid_t           id[3];          /* identifiers of constants */
+    int             var[3];         /* variable numbers, or -1 */
+    int             params;         /* positions holding placeholders */
+    varset_t        vars;
+    int             empty;          /* a constant is not in the database */
+    double          est[8];         /* estimates by bound positions */
+};
+
+struct hash_entry
+{
+    struct hash_entry   *next;
+    nid_t               t[3];
+};
+
+enum op_type { op_seed, op_scan, op_join, op_hash, op_filter, op_optional };
+
+/* How an operator uses each position of its pattern */
+enum { pos_const, pos_probe, pos_bind, pos_check };
+
+struct op
+{
+    enum op_type        type;
+    struct op           *input;
+    double              card, cost;     /* estimates */
+
+    /* scan, join, hash */
+    struct pattern      *pat;
+    int                 pos[3];
+
+    /* filter */
+    struct expression   *expr;
+
+    /* optional */
+    struct op           *sub;
+    varset_t            sub_vars;       /* cleared if the sub-plan fails */
+
+    /* Execution state */
+    int                 active, matched;
+    rdf_it_t            it;
+    struct hash_entry   **table, *entry;
+    size_t              buckets;
+    int                 built;
+};
+
+/* A set of rows of identifiers, in insertion order */
+struct rowset
+{
+    int         width;
+    nid_t       *rows;
+    char        *dead;              /* removed rows */
+    size_t      count, cap;
+    size_t      *table;             /* row index + 1, or 0 if free */
+    size_t      buckets;
+};
+
+struct member
+{
+    struct member       *next;
+    struct table_query  *tq;
+    struct op           *plan;
+
+    /* Variables, and the variable of each column (or -1 for constants,
+       with their pseudo-identifier in `consts') */
+    const char          **names;
+    int                 nvars;
+    int                 *vars;
+    nid_t               *consts;
+};
+
+/* A placeholder, and the value bound to it (null while unbound) */
+struct param
+{
+    const char          *name;
+    struct value        value;
+};
+
+struct serql_cursor
+{
+    db_t            db;
+    pool_t          pool;
+    struct query    *query;
+    char            *error;
+
+    /* Variables of the table query being planned */
+    const char      *names[MAX_VARS];
+    int             nvars;
+
+    /* Placeholders; shared by all runs of a prepared query */
+    struct param    *params;
+    int             nparams;
+
+    /* Set for runs of a prepared query, whose plans belong to it */
+    int             shared;
+
+    /* Result columns; constants are given negative identifiers */
+    int             columns;
+    const char      **column_names;
+    const char      **consts;
+    int             nconsts, consts_cap;
+
+    struct member   *members, *last_member;
+    struct rowset   result;
+    size_t          pos;
+
+    /* Terms returned by serql_next() */
+    nid_t           *ids;
+    const char      **terms;
+    char            *values;
+    size_t          values_size;
+};
+
+/* A prepared query is a cursor whose members are planned but not run. */
+struct serql_stmt
+{
+    struct serql_cursor plan;
+};
+
+
+static int fail(serql_cursor_t c, const char *fmt, const char *arg)
+{
+    if(c->error == NULL)
+        c->error = pprintf(c->pool, fmt, arg);
+    return -1;
+}
+
+
+/*
+ *  Row sets
+ */
+
+/* FNV-1a over the identifiers of a row */
+static size_t hash_row(const nid_t *row, int width)
+{
+    unsigned h = 2166136261u;
+    int n;
+
+    for(n = 0; n < width; ++n)
+        h = (h ^ (unsigned)(row[n] ^ (row[n] >> 32))) * 16777619u;
+
+    return h;
+}
+
+/* Returns the slot of `row' in the hash table: the slot holding it, or the
+   free slot where it belongs. */
+static size_t rs_slot(struct rowset *rs, const nid_t *row)
+{
+    size_t n = hash_row(row, rs->width) & (rs->buckets - 1), i;
+
+    while((i = rs->table[n]) != 0 &&
+          memcmp(rs->rows + (i - 1)*rs->width, row, rs->width*sizeof(nid_t)) != 0)
+        n = (n + 1) & (rs->buckets - 1);
+
+    return n;
+}
+
+static int rs_grow(struct rowset *rs)
+{
+    size_t n, *table, buckets = rs->buckets ? 2*rs->buckets : 64;
+
+    if((table = (size_t*)calloc(buckets, sizeof(size_t))) == NULL)
+        return -1;
+    free(rs->table);
+    rs->table   = table;
+    rs->buckets = buckets;
+
+    /* Rehash rows; only the first copy of duplicate rows is indexed. */
+    for(n = 0; n < rs->count; ++n)
+    {
+        size_t slot = rs_slot(rs, rs->rows + n*rs->width);
+        if(table[slot] == 0)
+            table[slot] = n + 1;
+    }
+
+    return 0;
+}
+
+/* Returns non-zero if `row' is in the set (and not removed). */
+static int rs_contains(struct rowset *rs, const nid_t *row)
+{
+    size_t i;
+
+    if(rs->buckets == 0)
+        return 0;
+    i = rs->table[rs_slot(rs, row)];
+    return i != 0 && !rs->dead[i - 1];
+}
+
+/* Adds a row; if `distinct' is set, rows already present are skipped.
+   Returns 1 if the row was added, 0 if not, or -1 on failure. */
+static int rs_add(struct rowset *rs, const nid_t *row, int distinct)
+{
+    size_t slot, i;
+
+    if(2*(rs->count + 1) > rs->buckets && rs_grow(rs) != 0)
+        return -1;
+
+    slot = rs_slot(rs, row);
+    if((i = rs->table[slot]) != 0 && distinct)
+    {
+        if(!rs->dead[i - 1])
+            return 0;
+        rs->dead[i - 1] = 0;
+        return 1;
+    }
+
+    if(rs->count == rs->cap)
+    {
+        size_t cap = rs->cap ? 2*rs->cap : 64;
+        nid_t *rows = (nid_t*)realloc(rs->rows, cap*rs->width*sizeof(nid_t));
+        char *dead;
+
+        if(rows == NULL)
+            return -1;
+        rs->rows = rows;
+        if((dead = (char*)realloc(rs->dead, cap)) == NULL)
+            return -1;
+        rs->dead = dead;
+        rs->cap  = cap;
+    }
+
+    memcpy(rs->rows + rs->count*rs->width, row, rs->width*sizeof(nid_t));
+    rs->dead[rs->count] = 0;
+    if(i == 0)
+        rs->table[slot] = rs->count + 1;
+    ++rs->count;
+
+    return 1;
+}
+
+static void rs_free(struct rowset *rs)
+{
+    free(rs->rows);
+    free(rs->dead);
+    free(rs->table);
+    memset(rs, 0, sizeof(struct rowset));
+}
+
+
+/*
+ *  Planning
+ */
+
+static int find_var(serql_cursor_t c, const char *name)
+{
+    int n;
+
+    for(n = 0; n < c->nvars; ++n)
+        if(strcmp(c->names[n], name) == 0)
+            return n;
+
+    return -1;
+}
+
+static int add_var(serql_cursor_t c, const char *name)
+{
+    int n;
+
+    if((n = find_var(c, name)) >= 0)
+        return n;
+    if(c->nvars == MAX_VARS)
+        return fail(c, "query uses more than %s variables", "64");
+
+    c->names[c->nvars] = name;
+    return c->nvars++;
+}
+
+static int find_param(serql_cursor_t c, const char *name)
+{
+    int n;
+
+    for(n = 0; n < c->nparams; ++n)
+        if(strcmp(c->params[n].name, name) == 0)
+            return n;
+
+    return -1;
+}
+
+static int add_param(serql_cursor_t c, const char *name)
+{
+    int n;
+
+    if((n = find_param(c, name)) >= 0)
+        return n;
+    if(c->nparams == MAX_PARAMS)
+        return fail(c, "query uses more than %s placeholders", "32");
+
+    if(c->params == NULL)
+        c->params = (struct param*)palloc(c->pool, MAX_PARAMS*sizeof(struct param));
+    c->params[c->nparams].name = name;
+    c->params[c->nparams].value.type = null;
+    return c->nparams++;
+}
+
+/* Returns the value bound to a placeholder, or the value itself. */
+static struct value *value_of(serql_cursor_t c, struct value *v)
+{
+    int n;
+
+    if(v->type == parameter && (n = find_param(c, v->identifier)) >= 0)
+        return &c->params[n].value;
+
+    return v;
+}
+
+/* Returns the identifier of a constant term, or 0 if it does not occur in
+   the database. */
+static nid_t const_id(serql_cursor_t c, struct value *v)
+{
+    char buffer[64];
+
+    v = value_of(c, v);
+    switch(v->type)
+    {
+    case uri:
+        return rdf_term_id(c->db, serql_expand_uri(c->pool, c->query, v->uri),
+                           NULL, NULL);
+
+    case string:
+        return rdf_term_id( c->db, v->lexical,
+            v->datatype ? serql_expand_uri(c->pool, c->query, v->datatype) : "",
+            v->language ? v->language : "" );
+
+    case integer:
+        sprintf(buffer, "%lld", v->integer);
+        return rdf_term_id(c->db, buffer, XSD_NS "integer", "");
+
+    case real:
+        sprintf(buffer, "%.17g", v->real);
+        return rdf_term_id(c->db, buffer, XSD_NS "double", "");
+
+    default:
+        return 0;
+    }
+}
+
+static struct pattern *make_pattern( serql_cursor_t c, struct value *subj,
+                                     struct value *pred, struct value *obj )
+{
+    struct pattern *pat = (struct pattern*)palloc(c->pool, sizeof(struct pattern));
+    int n;
+
+    pat->term[0] = subj;
+    pat->term[1] = pred;
+    pat->term[2] = obj;
+    pat->vars    = 0;
+    pat->params  = 0;
+    pat->empty   = 0;
+    for(n = 0; n < 8; ++n)
+        pat->est[n] = -1;
+
+    for(n = 0; n < 3; ++n)
+    {
+        if(pat->term[n]->type == variable)
+        {
+            if((pat->var[n] = add_var(c, pat->term[n]->identifier)) < 0)
+                return NULL;
+            pat->id[n] = 0;
+            pat->vars |= VAR(pat->var[n]);
+        }
+        else
+        if(pat->term[n]->type == parameter)
+        {
+            if(add_param(c, pat->term[n]->identifier) < 0)
+                return NULL;
+            pat->var[n] = -1;
+            pat->id[n]  = 0;
+            pat->params |= 1 << n;
+        }
+        else
+        {
+            pat->var[n] = -1;
+            if((pat->id[n] = const_id(c, pat->term[n])) == 0)
+                pat->empty = 1;
+        }
+    }
+
+    return pat;
+}
+
+/* Returns the positions of a pattern whose variables are in `bound'. */
+static int bound_positions(struct pattern *pat, varset_t bound)
+{
+    int n, mask = 0;
+
+    for(n = 0; n < 3; ++n)
+        if(pat->var[n] >= 0 && (bound & VAR(pat->var[n])))
+            mask |= 1 << n;
+
+    return mask;
+}
+
+/* Estimates the number of triples matching a pattern for each row, with
+   the variables at positions `mask' bound. Placeholders are estimated as
+   an average value. */
+static double estimate(serql_cursor_t c, struct pattern *pat, int mask)
+{
+    nid_t id[3];
+    int n;
+
+    if(pat->empty)
+        return 0;
+
+    if(pat->est[mask] < 0)
+    {
+        for(n = 0; n < 3; ++n)
+            id[n] = (pat->params & (1 << n)) ? RDF_ID_BOUND :
+                    (pat->var[n] < 0) ? pat->id[n] :
+                    (mask & (1 << n)) ? RDF_ID_BOUND : 0;
+        pat->est[mask] = rdf_estimate(c->db, id[0], id[1], id[2]);
+        if(pat->est[mask] < 0)
+            pat->est[mask] = 0;
+    }
+
+    return pat->est[mask];
+}
+
+/* Computes the cost of joining rows of cardinality `card' (with variables
+   `bound') with a pattern. Sets *out to the resulting cardinality and
+   *type to the cheapest join operator. */
+static double step_cost( serql_cursor_t c, struct pattern *pat, varset_t bound,
+                         double card, double *out, enum op_type *type )
+{
+    int mask = bound_positions(pat, bound);
+    double fanout = estimate(c, pat, mask), nested, hash;
+
+    *out  = card*fanout;
+    *type = mask ? op_join : op_scan;
+    nested = card*(PROBE_COST + fanout);
+
+    if(mask != 0)
+    {
+        /* Build a hash table from one scan, then probe it for each row. */
+        hash = BUILD_COST*estimate(c, pat, 0) + card*(1 + fanout);
+        if(hash < nested)
+        {
+            *type = op_hash;
+            return hash;
+        }
+    }
+
+    return nested;
+}
+
+static struct op *new_op(serql_cursor_t c, enum op_type type, struct op *input)
+{
+    struct op *op = (struct op*)palloc(c->pool, sizeof(struct op));
+
+    memset(op, 0, sizeof(struct op));
+    op->type  = type;
+    op->input = input;
+    if(input)
+    {
+        op->card = input->card;
+        op->cost = input->cost;
+    }
+
+    return op;
+}
+
+static struct op *pattern_op( serql_cursor_t c, enum op_type type,
+                              struct op *input, struct pattern *pat,
+                              varset_t bound )
+{
+    struct op *op = new_op(c, type, input);
+    varset_t vars = bound;
+    double card;
+    int n;
+
+    op->pat  = pat;
+    op->cost = input->cost + step_cost(c, pat, bound, input->card, &card, &type);
+    op->card = card;
+
+    for(n = 0; n < 3; ++n)
+    {
+        if(pat->var[n] < 0)
+            op->pos[n] = pos_const;
+        else
+        if(bound & VAR(pat->var[n]))
+            op->pos[n] = pos_probe;
+        else
+        if(vars & VAR(pat->var[n]))
+            op->pos[n] = pos_check;     /* repeated within the pattern */
+        else
+        {
+            op->pos[n] = pos_bind;
+            vars |= VAR(pat->var[n]);
+        }
+    }
+
+    return op;
+}
+
+/* Orders the patterns of a group, returning the order in `order'. */
+static void order_patterns( serql_cursor_t c, struct pattern **pats, int count,
+                            varset_t bound, double card, int *order )
+{
+    struct dp_state { double cost, card; int last; } *dp;
+    double out, cost, best;
+    enum op_type type;
+    varset_t vars;
+    int mask, full = (1 << count) - 1, n, i, pick;
+
+    if(count > MAX_DP_PATTERNS)
+    {
+        /* Greedy: repeatedly add the cheapest pattern */
+        for(mask = 0, i = 0; i < count; ++i)
+        {
+            pick = -1;
+            best = 0;
+            for(n = 0; n < count; ++n)
+            {
+                if(mask & (1 << n))
+                    continue;
+                cost = step_cost(c, pats[n], bound, card, &out, &type);
+                if(pick < 0 || cost < best)
+                    pick = n, best = cost;
+            }
+            order[i] = pick;
+            mask |= 1 << pick;
+            step_cost(c, pats[pick], bound, card, &card, &type);
+            bound |= pats[pick]->vars;
+        }
+        return;
+    }
+
+    /* Dynamic programming over subsets of patterns */
+    dp = (struct dp_state*)palloc(c->pool, (full + 1)*sizeof(struct dp_state));
+    for(mask = 0; mask <= full; ++mask)
+        dp[mask].last = -1;
+    dp[0].cost = 0;
+    dp[0].card = card;
+
+    for(mask = 0; mask < full; ++mask)
+    {
+        if(mask != 0 && dp[mask].last < 0)
+            continue;
+
+        for(vars = bound, n = 0; n < count; ++n)
+            if(mask & (1 << n))
+                vars |= pats[n]->vars;
+
+        for(n = 0; n < count; ++n)
+        {
+            int next = mask | (1 << n);
+
+            if(mask & (1 << n))
+                continue;
+            cost = dp[mask].cost +
+                   step_cost(c, pats[n], vars, dp[mask].card, &out, &type);
+            if(dp[next].last < 0 || cost < dp[next].cost)
+            {
+                dp[next].cost = cost;
+                dp[next].card = out;
+                dp[next].last = n;
+            }
+        }
+    }
+
+    for(mask = full, i = count; i > 0; mask &= ~(1 << order[i]))
+        order[--i] = dp[mask].last;
+}
+
+/* Collects the variables used in an expression. */
+static int expr_vars(serql_cursor_t c, struct expression *e, varset_t *vars)
+{
+    struct value *v[2];
+    int n, var;
+
+    if(e == NULL)
+        return fail(c, "unsupported expression in WHERE clause", NULL);
+
+    switch(e->type)
+    {
+    case value:
+        if(e->value.type != integer)
+            return fail(c, "unsupported expression in WHERE clause", NULL);
+        return 0;
+
+    case negation:
+        return expr_vars(c, e->left, vars);
+
+    case conjunction:
+    case disjunction:
+        if(expr_vars(c, e->left, vars) != 0)
+            return -1;
+        return expr_vars(c, e->right, vars);
+
+    default:
+        v[0] = &e->left->value;
+        v[1] = &e->right->value;
+        for(n = 0; n < 2; ++n)
+        {
+            if(v[n]->type == UNIMPLEMENTED)
+                return fail(c, "unsupported value in WHERE clause", NULL);
+            if(v[n]->type == parameter && add_param(c, v[n]->identifier) < 0)
+                return -1;
+            if(v[n]->type != variable)
+                continue;
+            if((var = find_var(c, v[n]->identifier)) < 0)
+                return fail(c, "unbound variable '%s' in WHERE clause",
+                            v[n]->identifier);
+            *vars |= VAR(var);
+        }
+        return 0;
+    }
+}
+
+/* A conjunct of a WHERE clause, waiting to be placed in the plan */
+struct conjunct
+{
+    struct conjunct     *next;
+    struct expression   *expr;
+    varset_t            vars;
+    int                 placed;
+};
+
+static struct conjunct *split_where( serql_cursor_t c, struct expression *e,
+                                     struct conjunct *list )
+{
+    struct conjunct *conj;
+
+    if(e != NULL && e->type == conjunction)
+        return split_where(c, e->right, split_where(c, e->left, list));
+
+    conj = (struct conjunct*)palloc(c->pool, sizeof(struct conjunct));
+    conj->next   = list;
+    conj->expr   = e;
+    conj->vars   = 0;
+    conj->placed = 0;
+    return conj;
+}
+
+/* Looks up the identifiers of the URIs and strings in an expression, so
+   that comparisons need not look them up for every row. */
+static void bind_expr(serql_cursor_t c, struct expression *e)
+{
+    struct value *v;
+
+    if(e->type == value)
+    {
+        v = value_of(c, &e->value);
+        e->id = (v->type == uri || v->type == string) ? const_id(c, v) : 0;
+        return;
+    }
+
+    if(e->left)
+        bind_expr(c, e->left);
+    if(e->right)
+        bind_expr(c, e->right);
+}
+
+/* Adds filters for the conjuncts whose variables are all in `bound'. */
+static struct op *place_filters( serql_cursor_t c, struct op *op,
+                                 struct conjunct *conj, varset_t bound )
+{
+    for( ; conj; conj = conj->next)
+    {
+        if(conj->placed || (conj->vars & ~bound) != 0)
+            continue;
+        op = new_op(c, op_filter, op);
+        op->expr = conj->expr;
+        op->cost = op->input->cost + op->input->card;
+        bind_expr(c, op->expr);
+        conj->placed = 1;
+    }
+
+    return op;
+}
+
+/* Registers the variables of a graph expression and its optional parts. */
+static int register_vars(serql_cursor_t c, struct graph_expr *ge)
+{
+    struct path_expr *pe;
+    struct node_elem *subj, *obj;
+
+    for(pe = ge->mandatory; pe; pe = pe->next)
+    {
+        if(pe->pred.type == variable && add_var(c, pe->pred.identifier) < 0)
+            return -1;
+        for(subj = pe->subj; subj; subj = subj->next)
+            if(subj->value.type == variable && add_var(c, subj->value.identifier) < 0)
+                return -1;
+        for(obj = pe->obj; obj; obj = obj->next)
+            if(obj->value.type == variable && add_var(c, obj->value.identifier) < 0)
+                return -1;
+    }
+
+    for(ge = ge->optional; ge; ge = ge->next)
+        if(register_vars(c, ge) != 0)
+            return -1;
+
+    return 0;
+}
+
+/* Plans a graph expression on top of `input', which binds `*bound'.
+   Variables bound by the group are added to `*bound'. */
+static struct op *plan_group( serql_cursor_t c, struct graph_expr *ge,
+                              struct op *input, varset_t *bound )
+{
+    struct path_expr *pe;
+    struct node_elem *subj, *obj;
+    struct graph_expr *opt;
+    struct pattern **pats;
+    struct conjunct *conjs = NULL, *conj;
+    struct op *op = input, *sub, *seed;
+    int count = 0, n, *order;
+    varset_t sub_bound;
+    enum op_type type;
+    double out;
+
+    /* Collect patterns, one for each subject/object combination */
+    for(pe = ge->mandatory; pe; pe = pe->next)
+    {
+        if(pe->subj == NULL)
+        {
+            fail(c, "path expression without subject", NULL);
+            return NULL;
+        }
+        for(subj = pe->subj; subj; subj = subj->next)
+            for(obj = pe->obj; obj; obj = obj->next)
+                ++count;
+    }
+    pats  = (struct pattern**)palloc(c->pool, (count + 1)*sizeof(struct pattern*));
+    order = (int*)palloc(c->pool, (count + 1)*sizeof(int));
+    count = 0;
+    for(pe = ge->mandatory; pe; pe = pe->next)
+        for(subj = pe->subj; subj; subj = subj->next)
+            for(obj = pe->obj; obj; obj = obj->next)
+                if((pats[count++] = make_pattern(
+                    c, &subj->value, &pe->pred, &obj->value)) == NULL)
+                    return NULL;
+
+    /* The WHERE clause may refer to variables of optional patterns */
+    for(opt = ge->optional; opt; opt = opt->next)
+        if(register_vars(c, opt) != 0)
+            return NULL;
+
+    if(ge->where)
+    {
+        conjs = split_where(c, ge->where, NULL);
+        for(conj = conjs; conj; conj = conj->next)
+            if(expr_vars(c, conj->expr, &conj->vars) != 0)
+                return NULL;
+    }
+
+    /* Mandatory patterns, in order of increasing cost */
+    order_patterns(c, pats, count, *bound, input->card, order);
+    op = place_filters(c, op, conjs, *bound);
+    for(n = 0; n < count; ++n)
+    {
+        step_cost(c, pats[order[n]], *bound, op->card, &out, &type);
+        op = pattern_op(c, type, op, pats[order[n]], *bound);
+        *bound |= pats[order[n]]->vars;
+        op = place_filters(c, op, conjs, *bound);
+    }
+
+    /* Optional groups, each joined with a plan evaluated per row */
+    for(opt = ge->optional; opt; opt = opt->next)
+    {
+        seed = new_op(c, op_seed, NULL);
+        seed->card = 1;
+        sub_bound  = *bound;
+        if((sub = plan_group(c, opt, seed, &sub_bound)) == NULL)
+            return NULL;
+
+        op = new_op(c, op_optional, op);
+        op->sub      = sub;
+        op->sub_vars = sub_bound & ~*bound;
+        op->cost    += op->input->card*sub->cost;
+        op->card    *= (sub->card > 1) ? sub->card : 1;
+        *bound = sub_bound;
+    }
+
+    /* Remaining conditions refer to optional variables */
+    return place_filters(c, op, conjs, ~(varset_t)0);
+}
+
+
+/*
+ *  Execution
+ */
+
+static void reset_op(struct op *op)
+{
+    for( ; op; op = op->input)
+    {
+        if(op->it != NULL)
+        {
+            rdf_cancel(op->it);
+            op->it = NULL;
+        }
+        op->active = 0;
+        op->entry  = NULL;
+        if(op->sub)
+            reset_op(op->sub);
+    }
+}
+
+/* Prepares a plan for another run: looks up the identifiers of its
+   constants and placeholders, and forgets hash tables built before. */
+static void bind_plan(serql_cursor_t c, struct op *op)
+{
+    struct pattern *pat;
+    int n;
+
+    for( ; op; op = op->input)
+    {
+        if((pat = op->pat) != NULL)
+        {
+            pat->empty = 0;
+            for(n = 0; n < 3; ++n)
+                if(pat->var[n] < 0 && (pat->id[n] = const_id(c, pat->term[n])) == 0)
+                    pat->empty = 1;
+        }
+        if(op->expr)
+            bind_expr(c, op->expr);
+        op->table = NULL;
+        op->built = 0;
+        if(op->sub)
+            bind_plan(c, op->sub);
+    }
+}
+
+/* Stores the parts of triple `t' bound by a pattern operator in the row;
+   returns 0 if the triple does not match. Probed positions are already
+   matched by index lookups, but not by hash table lookups. */
+static int bind_triple(struct op *op, nid_t *row, const nid_t *t)
+{
+    int n;
+
+    for(n = 0; n < 3; ++n)
+    {
+        if(op->pos[n] == pos_bind)
+            row[op->pat->var[n]] = t[n];
+        else
+        if(op->pos[n] == pos_check && row[op->pat->var[n]] != t[n])
+            return 0;
+        else
+        if(op->pos[n] == pos_probe && op->type == op_hash &&
+           row[op->pat->var[n]] != t[n])
+            return 0;   /* hash collision */
+    }
+
+    return 1;
+}
+
+/* Looks up the values for the probed positions; returns 0 if a probed
+   variable is unbound, so that nothing can match. */
+static int probe_values(struct op *op, const nid_t *row, nid_t *id)
+{
+    int n;
+
+    for(n = 0; n < 3; ++n)
+    {
+        id[n] = 0;
+        if(op->pos[n] == pos_const)
+            id[n] = op->pat->id[n];
+        else
+        if(op->pos[n] == pos_probe && (id[n] = row[op->pat->var[n]]) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static size_t hash_key(struct op *op, const nid_t *t)
+{
+    nid_t key[3];
+    int n;
+
+    for(n = 0; n < 3; ++n)
+        key[n] = (op->pos[n] == pos_probe) ? t[n] : 0;
+
+    return hash_row(key, 3) & (op->buckets - 1);
+}
+
+/* Builds the hash table of a hash join operator. */
+static int build_table(serql_cursor_t c, struct op *op)
+{
+    struct hash_entry *list = NULL, *e;
+    size_t count = 0, n;
+    nid_t id[3];
+    int r;
+
+    for(n = 0; n < 3; ++n)
+        id[n] = (op->pos[n] == pos_const) ? op->pat->id[n] : 0;
+
+    if((op->it = rdf_find_ids(c->db, id[0], id[1], id[2])) == NULL)
+        return -1;
+    for(;;)
+    {
+        e = (struct hash_entry*)palloc(c->pool, sizeof(struct hash_entry));
+        if((r = rdf_next_ids(op->it, &e->t[0], &e->t[1], &e->t[2])) <= 0)
+            break;
+        e->next = list;
+        list = e;
+        ++count;
+    }
+    op->it = NULL;
+    if(r < 0)
+        return -1;
+
+    for(op->buckets = 16; op->buckets < count; op->buckets *= 2) { };
+    op->table = (struct hash_entry**)palloc(
+        c->pool, op->buckets*sizeof(struct hash_entry*) );
+    memset(op->table, 0, op->buckets*sizeof(struct hash_entry*));
+    for(e = list; e; e = list)
+    {
+        list = e->next;
+        n = hash_key(op, e->t);
+        e->next = op->table[n];
+        op->table[n] = e;
+    }
+
+    op->built = 1;
+    return 0;
+}
+
+static int eval_expr(serql_cursor_t c, struct expression *e, const nid_t *row);
+
+/* Returns the next row from an operator in `row': 1 if a row was
+   produced, 0 at the end, or -1 on error. */
+static int next_row(serql_cursor_t c, struct op *op, nid_t *row)
+{
+    nid_t id[3], t[3];
+    int r, n;
+
+    switch(op->type)
+    {
+    case op_seed:
+        if(op->active)
+            return 0;
+        op->active = 1;
+        return 1;
+
+    case op_scan:
+    case op_join:
+        if(op->pat->empty)
+            return 0;
+        for(;;)
+        {
+            if(op->it == NULL)
+            {
+                if((r = next_row(c, op->input, row)) <= 0)
+                    return r;
+                if(!probe_values(op, row, id))
+                    continue;
+                if((op->it = rdf_find_ids(c->db, id[0], id[1], id[2])) == NULL)
+                    return -1;
+            }
+            if((r = rdf_next_ids(op->it, &t[0], &t[1], &t[2])) <= 0)
+            {
+                op->it = NULL;
+                if(r < 0)
+                    return -1;
+                continue;
+            }
+            if(bind_triple(op, row, t))
+                return 1;
+        }
+
+    case op_hash:
+        if(op->pat->empty)
+            return 0;
+        if(!op->built && build_table(c, op) != 0)
+            return -1;
+        for(;;)
+        {
+            while(op->entry != NULL)
+            {
+                struct hash_entry *e = op->entry;
+                op->entry = e->next;
+                if(bind_triple(op, row, e->t))
+                    return 1;
+            }
+            if((r = next_row(c, op->input, row)) <= 0)
+                return r;
+            if(probe_values(op, row, id))
+                op->entry = op->table[hash_key(op, id)];
+        }
+
+    case op_filter:
+        for(;;)
+        {
+            if((r = next_row(c, op->input, row)) <= 0)
+                return r;
+            if((r = eval_expr(c, op->expr, row)) == 1)
+                return 1;
+            if(r == -2)
+                return -1;
+        }
+
+    case op_optional:
+        for(;;)
+        {
+            if(!op->active)
+            {
+                if((r = next_row(c, op->input, row)) <= 0)
+                    return r;
+                reset_op(op->sub);
+                op->active  = 1;
+                op->matched = 0;
+            }
+            if((r = next_row(c, op->sub, row)) < 0)
+                return -1;
+            if(r > 0)
+            {
+                op->matched = 1;
+                return 1;
+            }
+            op->active = 0;
+            if(!op->matched)
+            {
+                /* No match; the optional variables stay unbound. */
+                for(n = 0; n < MAX_VARS; ++n)
+                    if(op->sub_vars & VAR(n))
+                        row[n] = 0;
+                return 1;
+            }
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+ *  Expressions, evaluated with SQL's three-valued logic: 1 is true, 0 is
+ *  false, -1 is unknown and -2 an error.
+ */
+
+/* The value of an operand, for comparisons */
+struct operand
+{
+    nid_t       id;             /* identifier, or 0 for unbound/missing */
+    const char  *text;          /* literal text, or NULL */
+    int         numeric;        /* a numeric constant */
+    double      number;
+};
+
+/* Evaluates the operand `e' of a comparison. The identifiers of constants
+   were looked up by bind_plan(). */
+static int get_operand( serql_cursor_t c, struct expression *e, const nid_t *row,
+                        int need_text, struct operand *op )
+{
+    struct value *v = value_of(c, &e->value);
+    const char *lexical, *type;
+    char buffer[64];
+    int r;
+
+    op->id      = 0;
+    op->text    = NULL;
+    op->numeric = 0;
+    op->number  = 0;
+
+    switch(v->type)
+    {
+    case variable:
+        op->id = row[find_var(c, v->identifier)];
+        if(need_text && op->id != 0)
+        {
+            if((r = rdf_decode_id(c->db, op->id, &lexical, &type, NULL)) < 0)
+                return -1;
+            if(r > 0 && type != NULL)
+                op->text = pstrdup(c->pool, lexical);
+        }
+        break;
+
+    case string:
+        op->text = v->lexical;
+        if(!need_text)
+            op->id = e->id;
+        break;
+
+    case integer:
+    case real:
+        op->numeric = 1;
+        op->number  = (v->type == integer) ? (double)v->integer : v->real;
+        if(v->type == integer)
+            sprintf(buffer, "%lld", v->integer);
+        else
+            sprintf(buffer, "%.17g", v->real);
+        op->text = pstrdup(c->pool, buffer);
+        break;
+
+    case uri:
+        if(!need_text)
+            op->id = e->id;
+        break;
+
+    default:
+        break;
+    }
+
+    if(op->text && !op->numeric)
+        op->number = strtod(op->text, NULL);
+
+    return 0;
+}
+
+static int eval_expr(serql_cursor_t c, struct expression *e, const nid_t *row)
+{
+    struct operand l, r;
+    struct value *lv, *rv;
+    pool_mark_t mark;
+    int a, b, numeric, result;
+
+    switch(e->type)
+    {
+    case value:
+        return e->value.integer ? 1 : 0;
+
+    case negation:
+        a = eval_expr(c, e->left, row);
+        return (a < 0) ? a : !a;
+
+    case conjunction:
+        if((a = eval_expr(c, e->left, row)) == 0 || a == -2)
+            return a;
+        if((b = eval_expr(c, e->right, row)) == 0 || b == -2)
+            return b;
+        return (a == 1 && b == 1) ? 1 : -1;
+
+    case disjunction:
+        if((a = eval_expr(c, e->left, row)) == 1 || a == -2)
+            return a;
+        if((b = eval_expr(c, e->right, row)) == 1 || b == -2)
+            return b;
+        return (a == 0 && b == 0) ? 0 : -1;
+
+    default:
+        break;
+    }
+
+    lv = value_of(c, &e->left->value);
+    rv = value_of(c, &e->right->value);
+
+    /* Comparison with NULL tests whether a variable is bound */
+    if(lv->type == null || rv->type == null)
+    {
+        struct value *v = (lv->type == null) ? rv : lv;
+        if(e->type != equal && e->type != unequal)
+            return -1;
+        a = (v->type == null) || (v->type == variable &&
+                                  row[find_var(c, v->identifier)] == 0);
+        return (e->type == equal) ? a : !a;
+    }
+
+    mark = pmark(c->pool);
+    numeric = lv->type == integer || lv->type == real ||
+              rv->type == integer || rv->type == real;
+    if( get_operand(c, e->left, row,
+                    numeric || (e->type != equal && e->type != unequal), &l) != 0 ||
+        get_operand(c, e->right, row,
+                    numeric || (e->type != equal && e->type != unequal), &r) != 0 )
+    {
+        prelease(c->pool, mark);
+        return -2;
+    }
+
+    if(!numeric && (e->type == equal || e->type == unequal))
+    {
+        /* Compare identities */
+        if(l.id == 0 || r.id == 0)
+            result = -1;
+        else
+            result = (l.id == r.id) == (e->type == equal);
+    }
+    else
+    if(l.text == NULL || r.text == NULL)
+        result = -1;
+    else
+    if(numeric)
+    {
+        switch(e->type)
+        {
+        case equal:         result = l.number == r.number; break;
+        case unequal:       result = l.number != r.number; break;
+        case less:          result = l.number <  r.number; break;
+        default:            result = l.number <= r.number; break;
+        }
+    }
+    else
+    {
+        a = strcmp(l.text, r.text);
+        result = (e->type == less) ? (a < 0) : (a <= 0);
+    }
+
+    prelease(c->pool, mark);
+    return result;
+}
+
+
+/*
+ *  Queries
+ */
+
+/* Returns the pseudo-identifier of a constant in the projection. */
+static nid_t const_column(serql_cursor_t c, const char *text)
+{
+    int n;
+
+    for(n = 0; n < c->nconsts; ++n)
+        if(strcmp(c->consts[n], text) == 0)
+            return -(nid_t)(n + 1);
+
+    if(c->nconsts == c->consts_cap)
+    {
+        const char **consts;
+
+        c->consts_cap = c->consts_cap ? 2*c->consts_cap : 8;
+        consts = (const char**)palloc(c->pool, c->consts_cap*sizeof(const char*));
+        if(c->nconsts > 0)
+            memcpy(consts, c->consts, c->nconsts*sizeof(const char*));
+        c->consts = consts;
+    }
+    c->consts[c->nconsts] = text;
+    return -(nid_t)(++c->nconsts);
+}
+
+/* Determines the result columns of a table query: a variable number for
+   each column, or -1 for constants (with their pseudo-identifier). */
+static int projection( serql_cursor_t c, struct table_query *tq,
+                       int *vars, nid_t *consts, const char **names )
+{
+    struct projection *proj;
+    struct value *v;
+    char buffer[64];
+    int count = 0, n;
+
+    if(tq->projection == NULL)
+    {
+        /* All named variables */
+        for(n = 0; n < c->nvars; ++n)
+        {
+            if(c->names[n][0] == '.')
+                continue;
+            if(vars)
+                vars[count] = n, names[count] = c->names[n];
+            ++count;
+        }
+        if(count == 0)
+            return fail(c, "query has no variables to select", NULL);
+        return count;
+    }
+
+    for(proj = tq->projection; proj; proj = proj->next, ++count)
+    {
+        if(vars == NULL)
+            continue;
+
+        v = &proj->value;
+        names[count] = proj->alias;
+        vars[count]  = -1;
+        switch(v->type)
+        {
+        case variable:
+            if((vars[count] = find_var(c, v->identifier)) < 0)
+                return fail(c, "unbound variable '%s' in projection", v->identifier);
+            if(names[count] == NULL)
+                names[count] = v->identifier;
+            break;
+
+        case uri:
+            consts[count] = const_column(
+                c, serql_expand_uri(c->pool, c->query, v->uri) );
+            break;
+
+        case string:
+            consts[count] = const_column(c, v->lexical);
+            break;
+
+        case integer:
+            sprintf(buffer, "%lld", v->integer);
+            consts[count] = const_column(c, pstrdup(c->pool, buffer));
+            break;
+
+        case real:
+            sprintf(buffer, "%.17g", v->real);
+            consts[count] = const_column(c, pstrdup(c->pool, buffer));
+            break;
+
+        case null:
+            consts[count] = 0;
+            break;
+
+        case parameter:
+            return fail(c, "placeholder '$%s' in projection", v->identifier);
+
+        default:
+            return fail(c, "unsupported value in projection", NULL);
+        }
+        if(names[count] == NULL)
+            names[count] = pprintf(c->pool, "%d", count + 1);
+    }
+
+    return count;
+}
+
+/* Plans a table query and determines its result columns. */
+static int plan_member(serql_cursor_t c, struct table_query *tq)
+{
+    struct member *m;
+    struct op *seed;
+    varset_t bound = 0;
+    const char **names;
+    int columns;
+
+    c->nvars = 0;
+
+    m = (struct member*)palloc(c->pool, sizeof(struct member));
+    memset(m, 0, sizeof(struct member));
+    m->tq = tq;
+    if(c->last_member)
+        c->last_member->next = m;
+    else
+        c->members = m;
+    c->last_member = m;
+
+    seed = new_op(c, op_seed, NULL);
+    seed->card = 1;
+    if(tq->from == NULL)
+        m->plan = seed;
+    else
+    if((m->plan = plan_group(c, tq->from, seed, &bound)) == NULL)
+        return -1;
+
+    if((columns = projection(c, tq, NULL, NULL, NULL)) < 0)
+        return -1;
+    m->vars   = (int*)palloc(c->pool, columns*sizeof(int));
+    m->consts = (nid_t*)palloc(c->pool, columns*sizeof(nid_t));
+    names     = (const char**)palloc(c->pool, columns*sizeof(const char*));
+    if(projection(c, tq, m->vars, m->consts, names) < 0)
+        return -1;
+
+    if(c->column_names == NULL)
+    {
+        c->columns      = columns;
+        c->column_names = names;
+    }
+    else
+    if(columns != c->columns)
+        return fail(c, "members of %s have different numbers of columns",
+                    "set operation");
+
+    /* Expressions look up variables by name when the member is run */
+    m->nvars = c->nvars;
+    m->names = (const char**)palloc(c->pool, (c->nvars + 1)*sizeof(const char*));
+    memcpy(m->names, c->names, c->nvars*sizeof(const char*));
+
+    return 0;
+}
+
+/* Runs the plan of a table query, collecting its result rows in `rs'. */
+static int run_member(serql_cursor_t c, struct member *m, struct rowset *rs)
+{
+    struct table_query *tq = m->tq;
+    struct rowset seen;
+    nid_t *row, *out;
+    long long skip = tq->offset, left = tq->limit;
+    int columns = c->columns, n, r;
+
+    c->nvars = m->nvars;
+    memcpy(c->names, m->names, m->nvars*sizeof(const char*));
+
+    rs->width = columns;
+    row = (nid_t*)palloc(c->pool, (c->nvars + 1)*sizeof(nid_t));
+    out = (nid_t*)palloc(c->pool, columns*sizeof(nid_t));
+    memset(row, 0, (c->nvars + 1)*sizeof(nid_t));
+
+    memset(&seen, 0, sizeof(seen));
+    seen.width = columns;
+
+    r = 0;
+    while(left != 0 && (r = next_row(c, m->plan, row)) > 0)
+    {
+        for(n = 0; n < columns; ++n)
+            out[n] = (m->vars[n] >= 0) ? row[m->vars[n]] : m->consts[n];
+
+        /* DISTINCT applies before OFFSET and LIMIT */
+        if(tq->distinct && (r = rs_add(&seen, out, 1)) <= 0)
+        {
+            if(r < 0)
+                break;
+            continue;
+        }
+        if(skip > 0)
+        {
+            --skip;
+            continue;
+        }
+        if(rs_add(rs, out, 0) < 0)
+        {
+            r = -1;
+            break;
+        }
+        if(left > 0)
+            --left;
+    }
+    reset_op(m->plan);
+    rs_free(&seen);
+
+    if(r < 0)
+        return fail(c, "%s", "error reading from the database");
+
+    return 0;
+}
+
+static int plan_query(serql_cursor_t c)
+{
+    struct table_query *tq;
+
+    for(tq = c->query->queries; tq; tq = tq->next)
+        if(plan_member(c, tq) != 0)
+            return -1;
+
+    return 0;
+}
+
+/* Runs all members of a planned query and combines their results. */
+static int run_query(serql_cursor_t c)
+{
+    struct member *m;
+    struct rowset rs;
+    size_t n;
+    int i, setop = setop_union;
+
+    for(i = 0; i < c->nparams; ++i)
+        if(c->params[i].value.type == null)
+            return fail(c, "placeholder '$%s' is not bound", c->params[i].name);
+
+    c->ids   = (nid_t*)palloc(c->pool, c->columns*sizeof(nid_t));
+    c->terms = (const char**)palloc(c->pool, c->columns*sizeof(const char*));
+
+    for(m = c->members; m; m = m->next)
+    {
+        memset(&rs, 0, sizeof(rs));
+        if(run_member(c, m, &rs) != 0)
+        {
+            rs_free(&rs);
+            return -1;
+        }
+
+        if(m == c->members && m->next == NULL)
+        {
+            /* Single query; keep rows as they are */
+            c->result = rs;
+            break;
+        }
+
+        /* Set operations remove duplicates */
+        if(m == c->members || setop == setop_union)
+        {
+            c->result.width = rs.width;
+            for(n = 0; n < rs.count; ++n)
+                if(rs_add(&c->result, rs.rows + n*rs.width, 1) < 0)
+                    fail(c, "%s", "out of memory");
+        }
+        else
+        {
+            for(n = 0; n < c->result.count; ++n)
+                if( !c->result.dead[n] &&
+                    rs_contains(&rs, c->result.rows + n*rs.width) ==
+                        (setop == setop_minus) )
+                    c->result.dead[n] = 1;
+        }
+        setop = m->tq->setop;
+        rs_free(&rs);
+    }
+
+    return 0;
+}
+
+serql_cursor_t serql_execute( db_t db, pool_t pool,
+                              struct query *query, char **error )
+{
+    serql_cursor_t c;
+
+    c = (serql_cursor_t)palloc(pool, sizeof(struct serql_cursor));
+    memset(c, 0, sizeof(struct serql_cursor));
+    c->db    = db;
+    c->pool  = pool;
+    c->query = query;
+
+    if(plan_query(c) == 0)
+        run_query(c);
+
+    if(c->error)
+    {
+        if(error != NULL)
+            *error = c->error;
+        serql_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+serql_stmt_t serql_prepare( db_t db, pool_t pool, const char *data,
+                            size_t size, char **error )
+{
+    serql_stmt_t stmt;
+    serql_cursor_t c;
+    struct query *query;
+
+    if((query = parse_serql_buffer(data, size, pool, error)) == NULL)
+        return NULL;
+
+    stmt = (serql_stmt_t)palloc(pool, sizeof(struct serql_stmt));
+    c = &stmt->plan;
+    memset(c, 0, sizeof(struct serql_cursor));
+    c->db    = db;
+    c->pool  = pool;
+    c->query = query;
+
+    if(plan_query(c) != 0)
+    {
+        if(error != NULL)
+            *error = c->error;
+        return NULL;
+    }
+
+    return stmt;
+}
+
+int serql_parameters(serql_stmt_t stmt)
+{
+    return stmt->plan.nparams;
+}
+
+const char *serql_parameter_name(serql_stmt_t stmt, int n)
+{
+    return (n >= 0 && n < stmt->plan.nparams) ? stmt->plan.params[n].name : NULL;
+}
+
+int serql_bind( serql_stmt_t stmt, const char *name, const char *lexical,
+                const char *datatype, const char *language )
+{
+    struct value *v;
+    int n;
+
+    if((n = find_param(&stmt->plan, name)) < 0)
+        return -1;
+    v = &stmt->plan.params[n].value;
+
+    if(datatype == NULL)
+    {
+        v->type = uri;
+        v->uri  = (char*)lexical;
+    }
+    else
+    if(strcmp(datatype, XSD_NS "integer") == 0 &&
+       sscanf(lexical, "%lld", &v->integer) == 1)
+        v->type = integer;
+    else
+    if(strcmp(datatype, XSD_NS "double") == 0 &&
+       sscanf(lexical, "%lf", &v->real) == 1)
+        v->type = real;
+    else
+    {
+        v->type     = string;
+        v->lexical  = (char*)lexical;
+        v->datatype = *datatype ? (char*)datatype : NULL;
+        v->language = (language && *language) ? (char*)language : NULL;
+    }
+
+    return 0;
+}
+
+/* Copies `count' strings, and the array holding them, into `pool'. */
+static const char **copy_strings(pool_t pool, const char **strings, int count)
+{
+    const char **copy;
+    int n;
+
+    if(count == 0)
+        return NULL;
+
+    copy = (const char**)palloc(pool, count*sizeof(const char*));
+    for(n = 0; n < count; ++n)
+        copy[n] = strings[n] ? pstrdup(pool, strings[n]) : NULL;
+    return copy;
+}
+
+serql_cursor_t serql_run(serql_stmt_t stmt, pool_t pool, char **error)
+{
+    serql_cursor_t c;
+    struct member *m;
+
+    /* The cursor shares the plans, but keeps its results in `pool', with
+       the column names and constants it returns, so that it outlives
+       the prepared query (as when a cache evicts it). */
+    c = (serql_cursor_t)palloc(pool, sizeof(struct serql_cursor));
+    *c = stmt->plan;
+    c->pool         = pool;
+    c->shared       = 1;
+    c->column_names = copy_strings(pool, c->column_names, c->columns);
+    c->consts       = copy_strings(pool, c->consts, c->nconsts);
+    c->consts_cap   = c->nconsts;
+
+    for(m = c->members; m; m = m->next)
+        bind_plan(c, m->plan);
+    run_query(c);
+
+    if(c->error)
+    {
+        if(error != NULL)
+            *error = c->error;
+        serql_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+int serql_columns(serql_cursor_t c)
+{
+    return c->columns;
+}
+
+const char *serql_column_name(serql_cursor_t c, int column)
+{
+    return (column >= 0 && column < c->columns) ? c->column_names[column] : NULL;
+}
+
+int serql_next(serql_cursor_t c, const char **values)
+{
+    const nid_t *row;
+    nid_t *ids = c->ids;
+    const char **terms = c->terms;
+    size_t used = 0, len;
+    int n, count;
+
+    while(c->pos < c->result.count && c->result.dead[c->pos])
+        ++c->pos;
+    if(c->pos == c->result.count)
+        return 0;
+    row = c->result.rows + c->pos++*c->result.width;
+
+    /* Decode all terms of the row at once */
+    for(n = 0, count = 0; n < c->columns; ++n)
+        if(row[n] > 0)
+            ids[count++] = row[n];
+    if(rdf_decode_ids(c->db, ids, count, terms, NULL, NULL) != 0)
+        return -1;
+
+    /* Copy them into the cursor's buffer, so they stay valid while the
+       database is used; pointers into it are only set at the end, since
+       it may move while growing. */
+    for(n = 0; n < count; ++n)
+    {
+        if(terms[n] == NULL)
+            continue;
+        len = strlen(terms[n]) + 1;
+        if(used + len > c->values_size)
+        {
+            size_t size = 2*(used + len);
+            char *buf = (char*)realloc(c->values, size);
+            if(buf == NULL)
+                return -1;
+            c->values      = buf;
+            c->values_size = size;
+        }
+        memcpy(c->values + used, terms[n], len);
+        used += len;
+    }
+
+    for(n = 0, count = 0, used = 0; n < c->columns; ++n)
+    {
+        values[n] = NULL;
+        if(row[n] < 0)
+            values[n] = c->consts[-row[n] - 1];
+        else
+        if(row[n] > 0 && terms[count++] != NULL)
+        {
+            values[n] = c->values + used;
+            used += strlen(values[n]) + 1;
+        }
+    }
+
+    return 1;
+}
+
+void serql_close(serql_cursor_t c)
+{
+    struct member *m;
+
+    /* Shared plans were reset by run_member(), and may be gone. */
+    if(!c->shared)
+        for(m = c->members; m; m = m->next)
+            reset_op(m->plan);
+    rs_free(&c->result);
+    free(c->values);
+    c->values      = NULL;
+    c->values_size = 0;
+}
+
+
+/*
+ *  Plan output
+ */
+
+static void print_value(FILE *fp, struct value *v)
+{
+    switch(v->type)
+    {
+    case variable:  fprintf(fp, "%s", v->identifier); break;
+    case uri:       fprintf(fp, "<%s>", v->uri); break;
+    case string:    fprintf(fp, "\"%s\"", v->lexical); break;
+    case integer:   fprintf(fp, "%lld", v->integer); break;
+    case real:      fprintf(fp, "%g", v->real); break;
+    case null:      fprintf(fp, "NULL"); break;
+    case parameter: fprintf(fp, "$%s", v->identifier); break;
+    default:        fprintf(fp, "?"); break;
+    }
+}
+
+static void print_expr(FILE *fp, struct expression *e)
+{
+    static const char * const ops[] = { "=", "!=", "<", "<=" };
+
+    switch(e->type)
+    {
+    case value:
+        fprintf(fp, e->value.integer ? "TRUE" : "FALSE");
+        break;
+
+    case negation:
+        fprintf(fp, "NOT ");
+        print_expr(fp, e->left);
+        break;
+
+    case conjunction:
+    case disjunction:
+        fprintf(fp, "(");
+        print_expr(fp, e->left);
+        fprintf(fp, (e->type == conjunction) ? " AND " : " OR ");
+        print_expr(fp, e->right);
+        fprintf(fp, ")");
+        break;
+
+    default:
+        print_value(fp, &e->left->value);
+        fprintf(fp, " %s ", ops[e->type - equal]);
+        print_value(fp, &e->right->value);
+    }
+}
+
+static void print_plan(FILE *fp, struct op *op, int depth)
+{
+    static const char * const names[] = {
+        "seed", "scan", "join", "hash join", "filter", "optional" };
+
+    for( ; op; op = op->input, ++depth)
+    {
+        fprintf(fp, "%*s%s", 2*depth, "", names[op->type]);
+        if(op->pat)
+        {
+            fprintf(fp, " {");
+            print_value(fp, op->pat->term[0]);
+            fprintf(fp, "} ");
+            print_value(fp, op->pat->term[1]);
+            fprintf(fp, " {");
+            print_value(fp, op->pat->term[2]);
+            fprintf(fp, "}");
+        }
+        if(op->expr)
+        {
+            fprintf(fp, " ");
+            print_expr(fp, op->expr);
+        }
+        fprintf(fp, "  (rows=%.0f cost=%.0f)\n", op->card, op->cost);
+        if(op->sub)
+            print_plan(fp, op->sub, depth + 2);
+    }
+}
+
+void serql_explain(serql_cursor_t c, FILE *fp)
+{
+    struct member *m;
+    int n = 0;
+
+    for(m = c->members; m; m = m->next)
+    {
+        if(c->members->next)
+            fprintf(fp, "member %d:\n", ++n);
+        print_plan(fp, m->plan, 0);
+    }
+}
@@ -0,0 +1,680 @@
+#include "serql.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Compiles SerQL queries into SQL over the rdfdb schema.
+ *
+ * Every triple pattern becomes an alias of the Triple table, and all joins
+ * are performed on node identifiers. A variable is bound to the column of
+ * its first occurrence; later occurrences become equality conditions.
+ * Optional path expressions become LEFT JOINs, with their conditions and
+ * WHERE clause in the ON clause. Node and Literal are only joined to decode
+ * the projected variables.
+ */
+
+#define XSD_NS "http://www.w3.org/2001/XMLSchema#"
+
+static const char * const default_namespaces[][2] = {
+    { "rdf",    "http://www.w3.org/1999/02/22-rdf-syntax-ns#" },
+    { "rdfs",   "http://www.w3.org/2000/01/rdf-schema#" },
+    { "xsd",    XSD_NS },
+    { "owl",    "http://www.w3.org/2002/07/owl#" },
+    { "serql",  "http://www.openrdf.org/schema/serql#" },
+    { NULL,     NULL } };
+
+/* A growable string, allocated from the pool */
+struct sbuf
+{
+    char    *data;
+    size_t  len, cap;
+};
+
+/* A variable and the column it is bound to */
+struct binding
+{
+    struct binding  *next;
+
+    const char      *name;
+    char            *column;
+};
+
+struct compiler
+{
+    pool_t          pool;
+    struct query    *query;
+    struct binding  *vars, *last_var;
+    int             tables;
+    char            *error;
+};
+
+
+/*
+ *  String building
+ */
+
+/* Makes room for `len' more characters plus a terminating zero. */
+static void sb_reserve(struct compiler *c, struct sbuf *sb, size_t len)
+{
+    size_t cap;
+    char *data;
+
+    if(sb->len + len + 1 <= sb->cap)
+        return;
+
+    cap = (sb->cap > 0) ? 2*sb->cap : 256;
+    while(cap < sb->len + len + 1)
+        cap *= 2;
+    data = (char*)palloc(c->pool, cap);
+    if(sb->len > 0)
+        memcpy(data, sb->data, sb->len);
+    sb->data = data;
+    sb->cap  = cap;
+}
+
+static void sb_append(struct compiler *c, struct sbuf *sb, const char *str, size_t len)
+{
+    sb_reserve(c, sb, len);
+    memcpy(sb->data + sb->len, str, len);
+    sb->len += len;
+    sb->data[sb->len] = '\0';
+}
+
+static void sb_puts(struct compiler *c, struct sbuf *sb, const char *str)
+{
+    sb_append(c, sb, str, strlen(str));
+}
+
+static void sb_printf(struct compiler *c, struct sbuf *sb, const char *fmt, ...)
+{
+    int vsnprintf(char *str, size_t size, const char *format, va_list ap);
+
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    sb_reserve(c, sb, len);
+    va_start(ap, fmt);
+    vsnprintf(sb->data + sb->len, len + 1, fmt, ap);
+    va_end(ap);
+    sb->len += len;
+}
+
+/* Appends `str' as an SQL string literal. */
+static void sb_quote(struct compiler *c, struct sbuf *sb, const char *str)
+{
+    const char *p;
+
+    sb_puts(c, sb, "'");
+    for(p = str; *p; ++p)
+    {
+        /* Double embedded quotes */
+        if(*p == '\'')
+            sb_append(c, sb, p, 1);
+        sb_append(c, sb, p, 1);
+    }
+    sb_puts(c, sb, "'");
+}
+
+/* Appends a condition to a list of conditions joined by AND. */
+static void add_cond(struct compiler *c, struct sbuf *conds, struct sbuf *cond)
+{
+    if(conds->len > 0)
+        sb_puts(c, conds, " AND ");
+    sb_append(c, conds, cond->data, cond->len);
+}
+
+static int fail(struct compiler *c, const char *message, const char *arg)
+{
+    if(c->error == NULL)
+        c->error = arg ? pprintf(c->pool, message, arg)
+                       : pstrdup(c->pool, message);
+    return -1;
+}
+
+
+/*
+ *  Terms
+ */
+
+const char *serql_expand_uri(pool_t pool, struct query *query, const char *uri)
+{
+    struct namespace_decl *ns;
+    const char *colon = strchr(uri, ':');
+    size_t len;
+    int n;
+
+    if(colon == NULL || colon[1] == '/')
+        return uri;
+    len = colon - uri;
+
+    for(ns = query->namespace_decls; ns; ns = ns->next)
+        if(strlen(ns->prefix) == len && strncmp(ns->prefix, uri, len) == 0)
+            return pprintf(pool, "%s%s", ns->uri, colon + 1);
+
+    for(n = 0; default_namespaces[n][0]; ++n)
+        if( strlen(default_namespaces[n][0]) == len &&
+            strncmp(default_namespaces[n][0], uri, len) == 0 )
+            return pprintf(pool, "%s%s", default_namespaces[n][1], colon + 1);
+
+    return uri;
+}
+
+static const char *expand_uri(struct compiler *c, const char *uri)
+{
+    return serql_expand_uri(c->pool, c->query, uri);
+}
+
+static struct binding *find_var(struct compiler *c, const char *name)
+{
+    struct binding *b;
+
+    for(b = c->vars; b; b = b->next)
+        if(strcmp(b->name, name) == 0)
+            return b;
+
+    return NULL;
+}
+
+/* Appends an expression for the identifier of a constant term. */
+static int term_id(struct compiler *c, struct sbuf *sb, struct value *v)
+{
+    switch(v->type)
+    {
+    case uri:
+        sb_puts(c, sb, "(SELECT id FROM Node WHERE uri=");
+        sb_quote(c, sb, expand_uri(c, v->uri));
+        sb_puts(c, sb, ")");
+        return 0;
+
+    case string:
+        sb_puts(c, sb, "(SELECT id FROM Literal WHERE data=");
+        sb_quote(c, sb, v->lexical);
+        sb_puts(c, sb, " AND type=");
+        sb_quote(c, sb, v->datatype ? expand_uri(c, v->datatype) : "");
+        sb_puts(c, sb, " AND language=");
+        sb_quote(c, sb, v->language ? v->language : "");
+        sb_puts(c, sb, ")");
+        return 0;
+
+    case integer:
+        sb_printf(c, sb, "(SELECT id FROM Literal WHERE data='%lld'"
+                         " AND type='" XSD_NS "integer' AND language='')",
+                  v->integer);
+        return 0;
+
+    case real:
+        sb_printf(c, sb, "(SELECT id FROM Literal WHERE data='%.17g'"
+                         " AND type='" XSD_NS "double' AND language='')",
+                  v->real);
+        return 0;
+
+    default:
+        return fail(c, "unsupported value in path expression", NULL);
+    }
+}
+
+/* Matches `column' against a node element: binds or compares a variable,
+   or compares with a constant. */
+static int match_term( struct compiler *c, struct value *v,
+                       const char *column, struct sbuf *conds )
+{
+    struct binding *b;
+    struct sbuf cond = { NULL, 0, 0 };
+
+    if(v->type == variable)
+    {
+        if((b = find_var(c, v->identifier)) == NULL)
+        {
+            /* First occurrence; bind variable to this column */
+            b = (struct binding*)palloc(c->pool, sizeof(struct binding));
+            b->next   = NULL;
+            b->name   = v->identifier;
+            b->column = pstrdup(c->pool, column);
+            if(c->last_var)
+                c->last_var->next = b;
+            else
+                c->vars = b;
+            c->last_var = b;
+            return 0;
+        }
+        sb_printf(c, &cond, "%s=%s", column, b->column);
+    }
+    else
+    {
+        sb_printf(c, &cond, "%s=", column);
+        if(term_id(c, &cond, v) != 0)
+            return -1;
+    }
+
+    add_cond(c, conds, &cond);
+    return 0;
+}
+
+
+/*
+ *  Expressions
+ */
+
+static int is_numeric(struct value *v)
+{
+    return v->type == integer || v->type == real;
+}
+
+/* Appends an expression for the value of an operand, for comparisons on
+   values rather than identity. */
+static int operand_value(struct compiler *c, struct sbuf *sb, struct value *v)
+{
+    struct binding *b;
+
+    switch(v->type)
+    {
+    case variable:
+        if((b = find_var(c, v->identifier)) == NULL)
+            return fail(c, "unbound variable '%s' in WHERE clause", v->identifier);
+        sb_printf(c, sb, "(SELECT data FROM Literal WHERE id=%s)", b->column);
+        return 0;
+
+    case string:
+        sb_quote(c, sb, v->lexical);
+        return 0;
+
+    case integer:
+        sb_printf(c, sb, "%lld", v->integer);
+        return 0;
+
+    case real:
+        sb_printf(c, sb, "%.17g", v->real);
+        return 0;
+
+    default:
+        return fail(c, "unsupported value in comparison", NULL);
+    }
+}
+
+/* Appends an expression for the identifier of an operand. */
+static int operand_id(struct compiler *c, struct sbuf *sb, struct value *v)
+{
+    struct binding *b;
+
+    if(v->type != variable)
+        return term_id(c, sb, v);
+
+    if((b = find_var(c, v->identifier)) == NULL)
+        return fail(c, "unbound variable '%s' in WHERE clause", v->identifier);
+    sb_puts(c, sb, b->column);
+    return 0;
+}
+
+static int compile_expr(struct compiler *c, struct sbuf *sb, struct expression *e)
+{
+    struct value *l, *r;
+
+    if(e == NULL)
+        return fail(c, "unsupported expression in WHERE clause", NULL);
+
+    switch(e->type)
+    {
+    case value:
+        if(e->value.type != integer)
+            return fail(c, "unsupported expression in WHERE clause", NULL);
+        sb_puts(c, sb, e->value.integer ? "1" : "0");
+        return 0;
+
+    case negation:
+        sb_puts(c, sb, "(NOT ");
+        if(compile_expr(c, sb, e->left) != 0)
+            return -1;
+        sb_puts(c, sb, ")");
+        return 0;
+
+    case conjunction:
+    case disjunction:
+        sb_puts(c, sb, "(");
+        if(compile_expr(c, sb, e->left) != 0)
+            return -1;
+        sb_puts(c, sb, (e->type == conjunction) ? " AND " : " OR ");
+        if(compile_expr(c, sb, e->right) != 0)
+            return -1;
+        sb_puts(c, sb, ")");
+        return 0;
+
+    default:
+        break;
+    }
+
+    /* Comparison */
+    l = &e->left->value;
+    r = &e->right->value;
+
+    if(e->type == equal || e->type == unequal)
+    {
+        const char *op = (e->type == equal) ? "=" : "<>";
+
+        if(l->type == null || r->type == null)
+        {
+            /* Comparison with NULL; test whether a variable is bound */
+            struct value *v = (l->type == null) ? r : l;
+            if(v->type == null)
+            {
+                sb_puts(c, sb, (e->type == equal) ? "1" : "0");
+                return 0;
+            }
+            if(operand_id(c, sb, v) != 0)
+                return -1;
+            sb_puts(c, sb, (e->type == equal) ? " IS NULL" : " IS NOT NULL");
+            return 0;
+        }
+
+        if(!is_numeric(l) && !is_numeric(r))
+        {
+            /* Compare term identity */
+            sb_puts(c, sb, "(");
+            if(operand_id(c, sb, l) != 0)
+                return -1;
+            sb_puts(c, sb, op);
+            if(operand_id(c, sb, r) != 0)
+                return -1;
+            sb_puts(c, sb, ")");
+            return 0;
+        }
+
+        /* Numeric comparison; fall through */
+        sb_puts(c, sb, "(CAST(");
+        if(operand_value(c, sb, l) != 0)
+            return -1;
+        sb_printf(c, sb, " AS NUMERIC)%sCAST(", op);
+        if(operand_value(c, sb, r) != 0)
+            return -1;
+        sb_puts(c, sb, " AS NUMERIC))");
+        return 0;
+    }
+
+    /* Ordering comparison on values */
+    sb_puts(c, sb, "(");
+    if(is_numeric(l) || is_numeric(r))
+        sb_puts(c, sb, "CAST(");
+    if(operand_value(c, sb, l) != 0)
+        return -1;
+    if(is_numeric(l) || is_numeric(r))
+        sb_puts(c, sb, " AS NUMERIC)");
+    sb_puts(c, sb, (e->type == less) ? "<" : "<=");
+    if(is_numeric(l) || is_numeric(r))
+        sb_puts(c, sb, "CAST(");
+    if(operand_value(c, sb, r) != 0)
+        return -1;
+    if(is_numeric(l) || is_numeric(r))
+        sb_puts(c, sb, " AS NUMERIC)");
+    sb_puts(c, sb, ")");
+    return 0;
+}
+
+
+/*
+ *  Graph patterns
+ */
+
+/* Adds a table for every mandatory triple pattern in `ge' to `tables', and
+   the conditions on them to `conds'. */
+static int compile_patterns( struct compiler *c, struct graph_expr *ge,
+                             struct sbuf *tables, struct sbuf *conds )
+{
+    struct path_expr *pe;
+    struct node_elem *subj, *obj;
+    char column[32];
+    int t;
+
+    for(pe = ge->mandatory; pe; pe = pe->next)
+    {
+        if(pe->subj == NULL)
+            return fail(c, "path expression without subject", NULL);
+
+        for(subj = pe->subj; subj; subj = subj->next)
+            for(obj = pe->obj; obj; obj = obj->next)
+            {
+                t = ++c->tables;
+                sb_printf( c, tables, "%sTriple AS t%d",
+                           (tables->len > 0) ? " JOIN " : "", t );
+
+                sprintf(column, "t%d.subject", t);
+                if(match_term(c, &subj->value, column, conds) != 0)
+                    return -1;
+                sprintf(column, "t%d.predicate", t);
+                if(match_term(c, &pe->pred, column, conds) != 0)
+                    return -1;
+                sprintf(column, "t%d.object", t);
+                if(match_term(c, &obj->value, column, conds) != 0)
+                    return -1;
+            }
+    }
+
+    return 0;
+}
+
+static int compile_where(struct compiler *c, struct graph_expr *ge, struct sbuf *conds)
+{
+    struct sbuf cond = { NULL, 0, 0 };
+
+    if(ge->where == NULL)
+        return 0;
+    if(compile_expr(c, &cond, ge->where) != 0)
+        return -1;
+    add_cond(c, conds, &cond);
+    return 0;
+}
+
+/* Appends a LEFT JOIN to `from' for each optional graph expression in `ge'.
+   Nested optional expressions follow their parent, rather than being
+   nested in its join, since SQLite does not allow the ON clause of a
+   nested join to refer to tables outside it. Instead, `guard' makes
+   them fail when the parent did not match. */
+static int compile_optionals( struct compiler *c, struct graph_expr *ge,
+                              struct sbuf *from, const char *guard )
+{
+    struct sbuf tables, conds;
+    const char *nested;
+    int first;
+
+    for(ge = ge->optional; ge; ge = ge->next)
+    {
+        memset(&tables, 0, sizeof(tables));
+        memset(&conds, 0, sizeof(conds));
+        first = c->tables + 1;
+
+        if( compile_patterns(c, ge, &tables, &conds) != 0 ||
+            compile_where(c, ge, &conds) != 0 )
+            return -1;
+
+        nested = guard;
+        if(tables.len > 0)
+        {
+            if(guard != NULL)
+            {
+                struct sbuf cond = { NULL, 0, 0 };
+                sb_puts(c, &cond, guard);
+                add_cond(c, &conds, &cond);
+            }
+            nested = pprintf(c->pool, "t%d.id IS NOT NULL", first);
+
+            if(from->len == 0)
+                sb_puts(c, from, "(SELECT 1) AS root");
+
+            /* Group multiple patterns, so that they match (or fail) together. */
+            if(c->tables > first)
+                sb_printf(c, from, " LEFT JOIN (%s)", tables.data);
+            else
+                sb_printf(c, from, " LEFT JOIN %s", tables.data);
+            sb_printf(c, from, " ON %s", (conds.len > 0) ? conds.data : "1");
+        }
+
+        if(compile_optionals(c, ge, from, nested) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ *  Queries
+ */
+
+/* Appends a result column for a projected variable or value. */
+static int compile_column( struct compiler *c, struct value *v, const char *alias,
+                           struct sbuf *columns, struct sbuf *decode )
+{
+    struct binding *b;
+    int n;
+
+    if(columns->len > 0)
+        sb_puts(c, columns, ", ");
+
+    switch(v->type)
+    {
+    case variable:
+        if((b = find_var(c, v->identifier)) == NULL)
+            return fail(c, "unbound variable '%s' in projection", v->identifier);
+
+        /* Decode the identifier through Node and Literal */
+        n = ++c->tables;
+        sb_printf( c, decode, " LEFT JOIN Node AS n%d ON n%d.id=%s"
+                              " LEFT JOIN Literal AS l%d ON l%d.id=%s",
+                   n, n, b->column, n, n, b->column );
+        sb_printf(c, columns, "COALESCE(n%d.uri, l%d.data)", n, n);
+        if(alias == NULL)
+            alias = v->identifier;
+        break;
+
+    case uri:
+        sb_quote(c, columns, expand_uri(c, v->uri));
+        break;
+
+    case string:
+        sb_quote(c, columns, v->lexical);
+        break;
+
+    case integer:
+        sb_printf(c, columns, "%lld", v->integer);
+        break;
+
+    case real:
+        sb_printf(c, columns, "%.17g", v->real);
+        break;
+
+    case null:
+        sb_puts(c, columns, "NULL");
+        break;
+
+    default:
+        return fail(c, "unsupported value in projection", NULL);
+    }
+
+    if(alias)
+    {
+        sb_puts(c, columns, " AS \"");
+        sb_puts(c, columns, alias);
+        sb_puts(c, columns, "\"");
+    }
+
+    return 0;
+}
+
+static int compile_select(struct compiler *c, struct table_query *tq, struct sbuf *sql)
+{
+    struct sbuf from = { NULL, 0, 0 }, conds = { NULL, 0, 0 },
+                columns = { NULL, 0, 0 }, decode = { NULL, 0, 0 };
+    struct projection *proj;
+    struct binding *b;
+
+    c->vars = c->last_var = NULL;
+    c->tables = 0;
+
+    if( tq->from && (compile_patterns(c, tq->from, &from, &conds) != 0 ||
+                     compile_optionals(c, tq->from, &from, NULL) != 0 ||
+                     compile_where(c, tq->from, &conds) != 0) )
+        return -1;
+
+    /* Projection */
+    if(tq->projection)
+    {
+        for(proj = tq->projection; proj; proj = proj->next)
+            if(compile_column(c, &proj->value, proj->alias, &columns, &decode) != 0)
+                return -1;
+    }
+    else
+    {
+        struct value v;
+
+        v.type = variable;
+        for(b = c->vars; b; b = b->next)
+        {
+            /* Skip anonymous variables, created for empty nodes */
+            if(b->name[0] == '.')
+                continue;
+            v.identifier = (char*)b->name;
+            if(compile_column(c, &v, NULL, &columns, &decode) != 0)
+                return -1;
+        }
+        if(columns.len == 0)
+            return fail(c, "query has no variables to select", NULL);
+    }
+
+    sb_printf(c, sql, "SELECT %s%s", tq->distinct ? "DISTINCT " : "", columns.data);
+    if(from.len > 0)
+        sb_printf(c, sql, " FROM %s", from.data);
+    if(decode.len > 0)
+        sb_puts(c, sql, decode.data);
+    if(conds.len > 0)
+        sb_printf(c, sql, " WHERE %s", conds.data);
+    if(tq->limit >= 0)
+        sb_printf(c, sql, " LIMIT %lld", tq->limit);
+    if(tq->offset >= 0)
+        sb_printf(c, sql, "%s OFFSET %lld", (tq->limit < 0) ? " LIMIT -1" : "", tq->offset);
+
+    return 0;
+}
+
+char *serql_to_sql(pool_t pool, struct query *query, char **error)
+{
+    struct compiler c;
+    struct sbuf sql = { NULL, 0, 0 }, sub;
+    struct table_query *tq;
+    static const char * const setops[] = { " INTERSECT ", " UNION ", " EXCEPT " };
+
+    memset(&c, 0, sizeof(c));
+    c.pool  = pool;
+    c.query = query;
+
+    for(tq = query->queries; tq; tq = tq->next)
+    {
+        if(tq->next == NULL && tq == query->queries)
+        {
+            /* Single query */
+            if(compile_select(&c, tq, &sql) != 0)
+                break;
+            continue;
+        }
+
+        /* Member of a compound query; wrap it, since LIMIT and OFFSET
+           apply to each member separately. */
+        memset(&sub, 0, sizeof(sub));
+        if(compile_select(&c, tq, &sub) != 0)
+            break;
+        sb_printf(&c, &sql, "SELECT * FROM (%s)", sub.data);
+        if(tq->next)
+            sb_puts(&c, &sql, setops[tq->setop]);
+    }
+
+    if(c.error)
+    {
+        if(error != NULL)
+            *error = c.error;
+        return NULL;
+    }
+
+    return sql.data;
+}
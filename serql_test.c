@@ -1,78 +1,233 @@
 #include "serql.h"
+#include "storage.h"
+#include <stdlib.h>
+#include <string.h>
 
-#define SERQL_PARSE_ERROR 1
-#define SERQL_NO_MANDATORY_PATH 2
+#define MAX_BINDINGS    16
 
-int annotate(struct graph_expr *graph_expr)
+/* A value given on the command line for a placeholder */
+struct binding
 {
-    struct graph_expr *ge;
-    int r = 0;
+    const char  *name;
+    const char  *lexical;
+    const char  *datatype;      /* NULL for a URI */
+};
 
-    if(graph_expr->mandatory == NULL)
-        return SERQL_NO_MANDATORY_PATH;
-
-    for(ge = graph_expr->optional; ge; ge = ge->next)
-        if((r = annotate(ge)) != 0)
-            break;
-
-    return r;
-}
-
-char *create_graph_expression(struct graph_expr *graph_expr)
+/* Prints the plan and the result rows of a cursor, and closes it. */
+static void print_cursor(serql_cursor_t cursor)
 {
-    struct path_expr *pe;
-    struct graph_expr *ge;
-
-    /* Output mandatory path expressions */
-    for(pe = graph_expr->mandatory; pe; pe->next)
+    const char *values[64];
+    int n, columns;
+
+    serql_explain(cursor, stdout);
+    columns = serql_columns(cursor);
+    if(columns > 64)
+        columns = 64;
+    while(serql_next(cursor, values) > 0)
     {
-        /* TODO */
+        for(n = 0; n < columns; ++n)
+            fprintf( stdout, "%s%s", (n > 0) ? "\t" : "",
+                     values[n] ? values[n] : "NULL" );
+        fputc('\n', stdout);
     }
+    serql_close(cursor);
+}
 
-    /* Output optional path expressions */
-    for(ge = graph_expr->optional; ge; ge = ge->next)
-        create_graph_expression(graph_expr);
+/* Reads all of `fp' into memory allocated with malloc(). Returns NULL on
+   error. */
+static char *read_all(FILE *fp, size_t *size)
+{
+    char *data = NULL, *p;
+    size_t cap = 0, len = 0;
+
+    do {
+        if(len == cap)
+        {
+            cap = cap ? 2*cap : 4096;
+            if((p = (char*)realloc(data, cap)) == NULL)
+            {
+                free(data);
+                return NULL;
+            }
+            data = p;
+        }
+        len += fread(data + len, 1, cap - len, fp);
+    } while(!feof(fp) && !ferror(fp));
 
-    return "";  /* TEMP */
+    *size = len;
+    return data;
 }
 
-char *create_rdf_query(pool_t pool, struct query *query)
+/* Prepares the query on standard input, binds the placeholders and runs
+   it, printing the result like the native mode does. Returns 0, or 1 on
+   error. */
+static int run_prepared( db_t db, pool_t pool,
+                         const struct binding *bindings, int nbindings )
 {
-    struct table_query *tq;
+    serql_stmt_t stmt;
+    serql_cursor_t cursor;
+    char *data, *error;
+    size_t size;
+    int n, result = 1;
 
-    for(tq = query->queries; tq; tq = tq->next)
-    {
-        /* table query */
-        if(tq->next)
-        { 
-            create_graph_expression(tq->from);
+    if((data = read_all(stdin, &size)) == NULL)
+        return 1;
 
-            /* output other members */
+    if((stmt = serql_prepare(db, pool, data, size, &error)) == NULL)
+        fprintf(stdout, "Prepare error: %s!\n", error);
+    else
+    {
+        fprintf(stdout, "Prepared OK!");
+        for(n = 0; n < serql_parameters(stmt); ++n)
+            fprintf(stdout, " $%s", serql_parameter_name(stmt, n));
+        fputc('\n', stdout);
+
+        for(n = 0; n < nbindings; ++n)
+            if(serql_bind( stmt, bindings[n].name, bindings[n].lexical,
+                           bindings[n].datatype, NULL ) != 0)
+                fprintf(stdout, "No placeholder $%s!\n", bindings[n].name);
+
+        if((cursor = serql_run(stmt, pool, &error)) == NULL)
+            fprintf(stdout, "Execution error: %s!\n", error);
+        else
+        {
+            print_cursor(cursor);
+            result = 0;
         }
     }
-    /* output namespaces */
 
-    return "";  /* TEMP */
+    free(data);
+    return result;
 }
 
-int main()
+/* Reads a SerQL query from standard input and prints the SQL it compiles
+   to. If a database file is given, the query is also executed, and the
+   result rows are printed separated by tabs. By default, the query is
+   executed natively and its plan is printed; with -s, the SQL is run.
+
+   With -u name=uri or -l name=literal, the query is prepared instead, the
+   value is bound to placeholder $name, and the query is run natively. A
+   literal may be typed as lexical^^datatype, where the datatype is a full
+   URI. Both options can be repeated. */
+int main(int argc, char *argv[])
 {
     struct query *query;
     struct pool pool = { NULL };
-    char *error;
+    struct binding bindings[MAX_BINDINGS];
+    char *error, *sql, *value, *type;
+    const char *values[64];
+    db_t db;
+    rdf_it_t it;
+    serql_cursor_t cursor;
+    int n, columns, nbindings = 0, use_sql = 0, result = 1;
+
+    while(argc > 1 && argv[1][0] == '-')
+    {
+        if(strcmp(argv[1], "-s") == 0)
+            use_sql = 1;
+        else
+        if( (strcmp(argv[1], "-u") == 0 || strcmp(argv[1], "-l") == 0) &&
+            argc > 2 && nbindings < MAX_BINDINGS &&
+            (value = strchr(argv[2], '=')) != NULL )
+        {
+            *value++ = '\0';
+            bindings[nbindings].name     = argv[2];
+            bindings[nbindings].lexical  = value;
+            bindings[nbindings].datatype = NULL;
+            if(argv[1][1] == 'l')
+            {
+                bindings[nbindings].datatype = "";
+                if((type = strstr(value, "^^")) != NULL)
+                {
+                    *type = '\0';
+                    bindings[nbindings].datatype = type + 2;
+                }
+            }
+            ++nbindings;
+            --argc, ++argv;
+        }
+        else
+        {
+            fprintf(stderr, "usage: serql_test [-s] [-u name=uri] "
+                            "[-l name=literal] [database]\n");
+            return 1;
+        }
+        --argc, ++argv;
+    }
 
-    query = parse_serql(stdin, &pool, &error);
-    if(query)
+    if(nbindings > 0)
     {
-        fprintf(stdout, "Parsed OK!\n");
-        create_rdf_query(&pool, query);
+        if(argc < 2 || use_sql)
+        {
+            fprintf(stderr, "Placeholders need a database, and no -s!\n");
+            return 1;
+        }
+        if((db = rdf_db_open(argv[1])) == NULL)
+        {
+            fprintf(stderr, "Unable to open database \"%s\"!\n", argv[1]);
+            return 1;
+        }
+        result = run_prepared(db, &pool, bindings, nbindings);
+        rdf_db_close(db);
+        goto done;
     }
-    else
+
+    query = parse_serql(stdin, &pool, &error);
+    if(query == NULL)
     {
         fprintf(stdout, "Parse error: %s!\n", error);
+        goto done;
     }
+    fprintf(stdout, "Parsed OK!\n");
+
+    if((sql = serql_to_sql(&pool, query, &error)) == NULL)
+    {
+        fprintf(stdout, "Compile error: %s!\n", error);
+        goto done;
+    }
+    fprintf(stdout, "%s\n", sql);
+
+    if(argc > 1)
+    {
+        if((db = rdf_db_open(argv[1])) == NULL)
+        {
+            fprintf(stderr, "Unable to open database \"%s\"!\n", argv[1]);
+            goto done;
+        }
+
+        if(!use_sql)
+        {
+            if((cursor = serql_execute(db, &pool, query, &error)) == NULL)
+                fprintf(stdout, "Execution error: %s!\n", error);
+            else
+            {
+                print_cursor(cursor);
+                result = 0;
+            }
+        }
+        else
+        if((it = rdf_query(db, sql)) != NULL)
+        {
+            columns = rdf_columns(it);
+            if(columns > 64)
+                columns = 64;
+            while(rdf_next_row(it, values, columns) > 0)
+            {
+                for(n = 0; n < columns; ++n)
+                    fprintf( stdout, "%s%s", (n > 0) ? "\t" : "",
+                             values[n] ? values[n] : "NULL" );
+                fputc('\n', stdout);
+            }
+            result = 0;
+        }
+
+        rdf_db_close(db);
+    }
+    else
+        result = 0;
 
+done:
     pclear(&pool);
 
-    return 0;
+    return result;
 }
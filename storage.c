@@ -1,8 +1,14 @@
+#define _POSIX_C_SOURCE 200112L    /* for clock_gettime() */
 #include "storage.h"
+#include "termcache.h"
+#include "bloom.h"
+#include "mmstore.h"
+#include "pool.h"
 #include <sqlite3.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 /* For ANSI Linux */
@@ -13,25 +19,56 @@ char *strdup(const char *);
  * SQL script for creating a new database.
  */
 static const char * const creation_script =
-    "CREATE TABLE Node (id INTEGER PRIMARY KEY, uri TEXT);"
-    "CREATE UNIQUE INDEX Node_id ON Node(id);"
-    "CREATE UNIQUE INDEX Node_uri ON Node(uri);"
+    "CREATE TABLE IF NOT EXISTS Node (id INTEGER PRIMARY KEY, uri TEXT);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS Node_id ON Node(id);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS Node_uri ON Node(uri);"
 
-    "CREATE TABLE Literal (id INTEGER PRIMARY KEY, data, type TEXT, language TEXT);"
-    "CREATE UNIQUE INDEX Literal_id ON Literal(id);"
-    "CREATE UNIQUE INDEX Literal_value ON Literal(type,data,language);"
+    "CREATE TABLE IF NOT EXISTS Literal (id INTEGER PRIMARY KEY, data, type TEXT, language TEXT);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS Literal_id ON Literal(id);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS Literal_value ON Literal(type,data,language);"
 
-    "CREATE TABLE Triple (id INTEGER PRIMARY KEY, subject INTEGER, predicate INTEGER, object INTEGER);"
-    "CREATE UNIQUE INDEX Triple_id ON Triple(id);"
-    "CREATE UNIQUE INDEX Triple_spo ON Triple(subject,predicate,object);"
-    "CREATE INDEX Triple_po ON Triple(predicate,object);";
+    "CREATE TABLE IF NOT EXISTS Triple (id INTEGER PRIMARY KEY, subject INTEGER, predicate INTEGER, object INTEGER);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS Triple_id ON Triple(id);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS Triple_spo ON Triple(subject,predicate,object);"
+
+    "CREATE TABLE IF NOT EXISTS Sequence (name TEXT PRIMARY KEY, next INTEGER);"
+
+    "CREATE TABLE IF NOT EXISTS Statistics (predicate INTEGER PRIMARY KEY, triples INTEGER, subjects INTEGER, objects INTEGER);"
+    "CREATE TABLE IF NOT EXISTS Histogram (predicate INTEGER, object INTEGER, count INTEGER, PRIMARY KEY (predicate, object));"
+
+    "CREATE TABLE IF NOT EXISTS Garbage (id INTEGER PRIMARY KEY);"
+
+    "CREATE TABLE IF NOT EXISTS Filter (capacity INTEGER, count INTEGER, bits BLOB);";
+
+
+/*
+ * Indices on the Triple table, besides Triple_spo (which is always present,
+ * since it enforces uniqueness of triples). New databases are created with
+ * RDF_INDEX_DEFAULT; rdf_db_initialize() adds missing ones to existing
+ * databases.
+ */
+
+/* Index on (predicate, object), created by older versions */
+#define INDEX_PO    (8)
+
+static const struct index_def
+{
+    int         flag;
+    const char  *name;
+    const char  *columns;
+} index_defs[] = {
+    { RDF_INDEX_SPO, "Triple_spo", "subject,predicate,object" },
+    { RDF_INDEX_POS, "Triple_pos", "predicate,object,subject" },
+    { RDF_INDEX_OSP, "Triple_osp", "object,subject,predicate" },
+    { INDEX_PO,      "Triple_po",  "predicate,object" },
+    { 0, NULL, NULL } };
 
 
 /*
  * SQL statements used.
  */
 
-#define STATEMENTS 8
+#define STATEMENTS 26
 
 static const char * const statements[STATEMENTS] = {
 #define SQL_FIND_NODE_BY_URI        ( 0)
@@ -47,10 +84,10 @@ static const char * const statements[STATEMENTS] = {
     "INSERT INTO Literal (id, data, type, language) VALUES (?1, ?2, ?3, ?4)",
 
 #define SQL_NEXT_NODE_ID            ( 4)
-    "SELECT IFNULL(MAX(m),0)+1 FROM ("
-    "   SELECT MAX(id) AS m FROM Node"
-    "   UNION"
-    "   SELECT MAX(id) AS m FROM Literal )",
+    "SELECT MAX( IFNULL((SELECT MAX(id) FROM Node), 0),"
+    "            IFNULL((SELECT MAX(id) FROM Literal), 0),"
+    "            IFNULL((SELECT MAX(id) FROM Triple), 0),"
+    "            IFNULL((SELECT next - 1 FROM Sequence WHERE name='id'), 0) ) + 1",
 
 #define SQL_FIND_TRIPLE             ( 5)
     "SELECT id FROM Triple WHERE subject=?1 AND predicate=?2 AND object=?3",
@@ -59,21 +96,386 @@ static const char * const statements[STATEMENTS] = {
     "INSERT INTO Triple (id, subject, predicate, object) VALUES (?1, ?2, ?3, ?4)",
 
 #define SQL_DROP_TRIPLE             ( 7)
-    "DELETE FROM Triple WHERE subject=?1 AND predicate=?2 AND object=?3"
+    "DELETE FROM Triple WHERE subject=?1 AND predicate=?2 AND object=?3",
+
+#define SQL_BEGIN                   ( 8)
+    "BEGIN IMMEDIATE",
+
+#define SQL_COMMIT                  ( 9)
+    "COMMIT",
+
+#define SQL_ROLLBACK                (10)
+    "ROLLBACK",
+
+#define SQL_RESERVE_IDS             (11)
+    "INSERT OR REPLACE INTO Sequence (name, next) VALUES ('id', ?1)",
+
+#define SQL_FIND_NODE_BY_ID         (12)
+    "SELECT uri FROM Node WHERE id=?1",
+
+#define SQL_FIND_LITERAL_BY_ID      (13)
+    "SELECT data, type, language FROM Literal WHERE id=?1",
+
+#define SQL_GET_STATS               (14)
+    "SELECT triples, subjects, objects FROM Statistics WHERE predicate=?1",
+
+#define SQL_UPDATE_STATS            (15)
+    "UPDATE Statistics SET triples=triples+?2, subjects=subjects+?3,"
+    " objects=objects+?4 WHERE predicate=?1",
+
+#define SQL_INSERT_STATS            (16)
+    "INSERT INTO Statistics (predicate, triples, subjects, objects)"
+    " VALUES (?1, ?2, ?3, ?4)",
+
+#define SQL_DELETE_STATS            (17)
+    "DELETE FROM Statistics WHERE predicate=?1 AND triples<=0",
+
+#define SQL_GET_HISTOGRAM           (18)
+    "SELECT count FROM Histogram WHERE predicate=?1 AND object=?2",
+
+#define SQL_UPDATE_HISTOGRAM        (19)
+    "UPDATE Histogram SET count=count+?3 WHERE predicate=?1 AND object=?2",
+
+#define SQL_COUNT_PREDICATES        (20)
+    "SELECT COUNT(*) FROM Statistics WHERE predicate<>0",
+
+#define SQL_COUNT_MATCHES           (21)
+    "SELECT (SELECT COUNT(*) FROM (SELECT 1 FROM Triple"
+    "         WHERE subject=?1 AND predicate=?2 LIMIT 2)),"
+    "       (SELECT COUNT(*) FROM (SELECT 1 FROM Triple"
+    "         WHERE subject=?1 LIMIT 2)),"
+    "       (SELECT COUNT(*) FROM (SELECT 1 FROM Triple"
+    "         WHERE predicate=?2 AND object=?3 LIMIT 2)),"
+    "       (SELECT COUNT(*) FROM (SELECT 1 FROM Triple"
+    "         WHERE object=?3 LIMIT 2))",
+
+#define SQL_HISTOGRAM_USED          (22)
+    "SELECT EXISTS (SELECT 1 FROM Histogram)",
+
+#define SQL_BEGIN_READ              (23)
+    "BEGIN",
+
+#define SQL_GET_GENERATION          (24)
+    "SELECT next FROM Sequence WHERE name='generation'",
+
+#define SQL_BUMP_GENERATION         (25)
+    "INSERT OR REPLACE INTO Sequence (name, next) VALUES ('generation',"
+    " IFNULL((SELECT next FROM Sequence WHERE name='generation'), 0) + 1)"
+
+};
+
 
+/*
+ * Statements used by rdf_gc(). They are prepared when first used, since
+ * read-only handles may open databases without a Garbage table.
+ */
+
+#define GC_STATEMENTS 7
+
+static const char * const gc_statements[GC_STATEMENTS] = {
+#define GC_ADD_CANDIDATE            (0)
+    "INSERT OR IGNORE INTO Garbage (id) VALUES (?1)",
+
+#define GC_NEXT_CANDIDATES          (1)
+    "SELECT id FROM Garbage ORDER BY id LIMIT ?1",
+
+#define GC_DELETE_CANDIDATE         (2)
+    "DELETE FROM Garbage WHERE id=?1",
+
+#define GC_TERM_USED                (3)
+    "SELECT EXISTS (SELECT 1 FROM Triple WHERE subject=?1)"
+    "    OR EXISTS (SELECT 1 FROM Triple WHERE predicate=?1)"
+    "    OR EXISTS (SELECT 1 FROM Triple WHERE object=?1)",
+
+#define GC_DELETE_NODE              (4)
+    "DELETE FROM Node WHERE id=?1",
+
+#define GC_DELETE_LITERAL           (5)
+    "DELETE FROM Literal WHERE id=?1",
+
+#define GC_FREE_PAGES               (6)
+    "SELECT freelist_count FROM pragma_freelist_count, pragma_auto_vacuum"
+    " WHERE auto_vacuum=2"
+};
+
+/* Candidates examined per transaction by rdf_gc() */
+#define GC_BATCH        (64)
+
+/* Pages released per transaction by rdf_gc() */
+#define GC_VACUUM_PAGES (256)
+
+
+/*
+ * Snapshots written by rdf_dump() consist of DUMP_MAGIC followed by blocks
+ * of at most DUMP_BLOCK bytes, each preceded by its size and its Adler-32
+ * checksum (32-bit little-endian). Together, the blocks hold a sequence of
+ * unsigned varints and strings (length + 1, or 0 for NULL, and the bytes):
+ *
+ *   nodes:     (id delta, uri)* 0
+ *   literals:  (id delta, data, type, language)* 0
+ *   triples:   (subject delta + 1, predicate, object)* 0
+ *   number of nodes, literals and triples
+ *
+ * Terms are in order of identifier, and triples in SPO order; a predicate
+ * is stored as a delta if the subject is the same as in the previous
+ * triple, and an object too if the predicate is the same as well.
+ */
+
+#define DUMP_MAGIC      "rdfdump1"
+#define DUMP_BLOCK      (65536)
+
+/* Drops the indices that creation_script builds, before bulk loading */
+static const char * const bulk_script =
+    "DROP INDEX IF EXISTS Node_id;"
+    "DROP INDEX IF EXISTS Node_uri;"
+    "DROP INDEX IF EXISTS Literal_id;"
+    "DROP INDEX IF EXISTS Literal_value;"
+    "DROP INDEX IF EXISTS Triple_id;"
+    "DROP INDEX IF EXISTS Triple_spo;";
+
+
+/*
+ * Instrumented operations: the statements above, followed by the ones below.
+ */
+
+#define OP_TERM_CACHED      (STATEMENTS + 0)    /* term found in the cache */
+#define OP_TERM_FOUND       (STATEMENTS + 1)    /* term found in the database */
+#define OP_TERM_MISSING     (STATEMENTS + 2)    /* term not found */
+#define OP_NEW_NODE         (STATEMENTS + 3)    /* node inserted */
+#define OP_NEW_LITERAL      (STATEMENTS + 4)    /* literal inserted */
+#define OP_FIND_PREPARE     (STATEMENTS + 5)    /* rdf_find() statement prepared */
+#define OP_FILTER_NEGATIVE  (STATEMENTS + 6)    /* absent according to the filter */
+#define OP_FILTER_BUILD     (STATEMENTS + 7)    /* Bloom filter built */
+#define OPERATIONS          (STATEMENTS + 8)
+
+static const char * const op_names[OPERATIONS] = {
+    "find_node_by_uri", "insert_node", "find_literal_by_value",
+    "insert_literal", "next_node_id", "find_triple", "insert_triple",
+    "drop_triple", "begin", "commit", "rollback", "reserve_ids",
+    "find_node_by_id", "find_literal_by_id", "get_stats", "update_stats",
+    "insert_stats", "delete_stats", "get_histogram", "update_histogram",
+    "count_predicates", "count_matches", "histogram_used", "begin_read",
+    "get_generation", "bump_generation", "term_cached", "term_found", "term_missing", "new_node", "new_literal",
+    "find_prepare", "filter_negative", "filter_build" };
+
+struct op_stats
+{
+    long long count;
+    long long nanoseconds;
+    long long latency[RDF_LATENCY_BUCKETS];
 };
 
 
+/*
+ * Statements used by rdf_find(); one for each combination of bound subject
+ * (1), predicate (2) and object (4). rdf_find_ids() uses a second set,
+ * which selects identifiers only.
+ */
+
+#define FIND_SHAPES     8
+#define FIND_IDS        FIND_SHAPES
+#define FIND_STATEMENTS (2*FIND_SHAPES)
+
+static const char * const find_select =
+    "SELECT SubjectNode.uri   AS subject_uri,"
+    "       PredicateNode.uri AS predicate_uri,"
+    "       COALESCE(ObjectNode.uri, Literal.data) AS object_lexical,"
+    "       Literal.type      AS object_type,"
+    "       Literal.language  AS object_language "
+    "FROM Triple ";
+
+static const char * const find_ids_select =
+    "SELECT subject, predicate, object FROM Triple ";
+
+static const char * const find_joins =
+    "LEFT JOIN Node AS SubjectNode   ON SubjectNode.id   = subject "
+    "LEFT JOIN Node AS PredicateNode ON PredicateNode.id = predicate "
+    "LEFT JOIN Node AS ObjectNode    ON ObjectNode.id    = object "
+    "LEFT JOIN Literal               ON Literal.id       = object ";
+
+static const char * const find_conditions[FIND_SHAPES] = {
+    "",
+    "WHERE subject=?1",
+    "WHERE predicate=?2",
+    "WHERE subject=?1 AND predicate=?2",
+    "WHERE object=?3",
+    "WHERE subject=?1 AND object=?3",
+    "WHERE predicate=?2 AND object=?3",
+    "WHERE subject=?1 AND predicate=?2 AND object=?3" };
+
+/* Access paths for each shape, in order of preference. If none of these
+   indices is available, the choice is left to SQLite (usually a scan). */
+static const int find_paths[FIND_SHAPES][3] = {
+    { 0 },
+    { RDF_INDEX_SPO },
+    { RDF_INDEX_POS, INDEX_PO },
+    { RDF_INDEX_SPO },
+    { RDF_INDEX_OSP },
+    { RDF_INDEX_OSP, RDF_INDEX_SPO },
+    { RDF_INDEX_POS, INDEX_PO, RDF_INDEX_OSP },
+    { RDF_INDEX_SPO } };
+
+
+/* Number of identifiers looked up at once by rdf_decode_ids() */
+#define DECODE_BATCH    (32)
+
+/* Maximum number of triples sampled by rdf_estimate() */
+#define ESTIMATE_LIMIT  (10000)
+
+/* Number of most frequent objects per predicate kept by rdf_db_initialize() */
+#define HISTOGRAM_SIZE  (32)
+
+/* Indices needed to maintain the statistics efficiently */
+#define STATS_INDEXES(indexes) \
+    (((indexes) & (RDF_INDEX_POS | INDEX_PO)) && ((indexes) & RDF_INDEX_OSP))
+
+/* Recomputes the Statistics table from scratch. The row for predicate 0
+   holds the totals over all triples. */
+static const char * const stats_script =
+    "DELETE FROM Statistics;"
+    "DELETE FROM Histogram;"
+    "INSERT INTO Statistics (predicate, triples, subjects, objects)"
+    "  SELECT predicate, COUNT(*), COUNT(DISTINCT subject),"
+    "         COUNT(DISTINCT object)"
+    "  FROM Triple GROUP BY predicate;"
+    "INSERT INTO Statistics (predicate, triples, subjects, objects)"
+    "  SELECT 0, (SELECT COUNT(*) FROM Triple),"
+    "            (SELECT COUNT(DISTINCT subject) FROM Triple),"
+    "            (SELECT COUNT(DISTINCT object) FROM Triple);";
+
+/* Fills the Histogram table with the most frequent objects per predicate;
+   objects that occur only once are left out. */
+static const char * const histogram_script =
+    "INSERT INTO Histogram (predicate, object, count)"
+    "  SELECT predicate, object, count FROM"
+    "    ( SELECT predicate, object, COUNT(*) AS count,"
+    "             ROW_NUMBER() OVER (PARTITION BY predicate"
+    "                                ORDER BY COUNT(*) DESC) AS rank"
+    "      FROM Triple GROUP BY predicate, object )"
+    "  WHERE rank <= %d AND count > 1;";
+
+
 /*
  * More type definitions
  */
 
-typedef long long int nid_t;
+/* Iterator over the results of rdf_find(). Each handle owns one iterator
+   per find statement, which is reset (rather than finalized) when
+   iteration ends. If that iterator is still in use, rdf_find() uses a
+   private one instead; these are kept for reuse too, up to MAX_SPARES
+   per statement, so that nested iteration does not prepare statements
+   over and over. */
+struct rdf_it
+{
+    db_t            db;
+    sqlite3_stmt    *stmt;
+    int             shared;     /* owned by the handle; reset after use */
+    int             busy;       /* shared iterator is in use */
+    int             find;       /* find statement, or -1 for queries */
+    int             gen;        /* value of db->find_gen when prepared */
+    int             done;       /* last rows returned by rdf_next_batch() */
+    struct rdf_it   *next;      /* next spare iterator */
+    struct pool     pool;       /* strings returned by rdf_next_batch() */
+    mm_cursor_t     cursor;     /* used instead of stmt on mapped stores */
+    struct mm_term  terms[3];   /* terms returned from mapped stores */
+};
+
+#define MAX_SPARES      (8)
+
+/* Pending changes to the statistics of a predicate */
+struct stats_delta
+{
+    nid_t           pred;       /* 0 for the totals, or an unused slot */
+    long long       triples;
+    long long       subjects;
+    long long       objects;
+};
+
+/* Size of the hash table of pending statistics */
+#define STATS_DELTAS    (64)
+
+/* Default memory budget of the term cache */
+#define TERM_CACHE_SIZE (4<<20)
+
+/* Maximum size of a term cache key; longer terms are not cached */
+#define TERM_KEY_MAX    (512)
+
+/* Milliseconds to wait for a lock held by another connection (WAL only) */
+#define BUSY_TIMEOUT    (10000)
 
 struct db
 {
     sqlite3 *db;
     sqlite3_stmt *stmts[STATEMENTS];
+    struct rdf_it finds[FIND_STATEMENTS];
+    struct rdf_it *spares[FIND_STATEMENTS];
+    int nspares[FIND_STATEMENTS];
+    int find_gen;               /* incremented when finds are re-prepared */
+    struct rdf_it empty;        /* iterator over an empty result set */
+    sqlite3_stmt *counts[FIND_SHAPES];  /* used by rdf_estimate() */
+    sqlite3_stmt *decode;               /* used by rdf_decode_ids() */
+    sqlite3_stmt *gc[GC_STATEMENTS];    /* used by rdf_gc() */
+
+    /* Buffer holding the terms returned by rdf_decode_id(s)() */
+    char *term;
+    size_t term_size;
+    size_t *offsets;            /* term offsets for rdf_decode_ids() */
+    size_t offsets_size;
+
+    /* Explicit (batch) transaction state */
+    int batch;                  /* non-zero while a batch is open */
+    long long batch_size;       /* commit every batch_size triples; 0 = never */
+    long long batch_count;      /* triples inserted since last commit */
+
+    /* Node identifier allocator */
+    nid_t id_next;              /* next identifier to hand out; 0 = unseeded */
+    nid_t id_end;               /* end of reserved range (if id_reserve > 0) */
+    long long id_reserve;       /* size of reserved ranges; 0 = none */
+    long long id_version;       /* data_version when seeded (if id_reserve == 0) */
+
+    /* Indices present on the Triple table */
+    int indexes;
+
+    /* Statistics are up to date and maintained on insert and drop */
+    int stats;
+    int histogram;              /* Histogram table is not empty */
+    struct stats_delta deltas[STATS_DELTAS];
+    struct stats_delta totals;
+    int ndeltas;                /* used slots in deltas */
+
+    /* Bulk loading state (see rdf_bulk_begin()) */
+    int bulk;                   /* non-zero while bulk loading */
+    int bulk_indexes;           /* indices to build at the end */
+    nid_t bulk_max_id;          /* largest term identifier added */
+    nid_t bulk_triples;         /* triples added */
+
+    /* Cache mapping terms to node identifiers, valid for a generation of
+       deleted terms (see check_cache()) */
+    termcache_t cache;
+    long long cache_generation;
+    long long cache_version;    /* data_version when last checked */
+
+    /* Bloom filter of the terms and triples in the database (see
+       RDF_OPEN_BLOOM), or NULL if there is none (yet) */
+    bloom_t filter;
+    int filter_flags;           /* RDF_OPEN_BLOOM* flags of the handle */
+    int filter_save;            /* saved in the database on close */
+    int filter_dirty;           /* changed since it was loaded */
+    int filter_cleared;         /* saved filter deleted in this transaction */
+    sqlite3_stmt *clear_filter; /* deletes the saved filter */
+    long long filter_version;   /* data_version it is up to date with */
+    sqlite3_stmt *data_version; /* reads PRAGMA data_version */
+
+    /* Memory-mapped store opened with RDF_OPEN_MMAP, which serves all
+       reads; the connection then holds an empty, query-only database */
+    mmstore_t mm;
+    struct mm_term mm_term;     /* returned by rdf_decode_id() */
+
+    /* Instrumentation */
+    struct op_stats ops[OPERATIONS];
+    FILE *dump_fp;              /* periodic dumps are written here */
+    long long dump_interval;    /* nanoseconds between dumps */
+    long long dump_next;        /* time of the next dump */
 };
 
 
@@ -81,373 +483,3473 @@ struct db
  *  Helper functions
  */
 
-static nid_t next_id(db_t db)
+/* Returns a monotonic time in nanoseconds. */
+static long long clock_ns()
 {
-    nid_t id = 0;
-    sqlite3_stmt *stmt = db->stmts[SQL_NEXT_NODE_ID];
-
-    if(sqlite3_step(stmt) == SQLITE_ROW)
-        id = sqlite3_column_int64(stmt, 0);
-    sqlite3_reset(stmt);
+    struct timespec ts;
 
-    return id;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000000000 + ts.tv_nsec;
 }
 
-static nid_t uri_to_id(db_t db, const char *uri)
+/* Records an operation that ran from `start' to `end'. */
+static void record(db_t db, int op, long long start, long long end)
 {
-    nid_t id = 0;
-    sqlite3_stmt *stmt;
-
-    /* Make sure all paramters are provided */
-    if(!uri)
-        return 0;
+    struct op_stats *ops = &db->ops[op];
+    long long ns = end - start;
+    int b;
 
-    /* Try to find existing node */
-    stmt = db->stmts[SQL_FIND_NODE_BY_URI];
-    sqlite3_bind_text(stmt, 1, uri, -1, SQLITE_STATIC);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
-        id = sqlite3_column_int64(stmt, 0);
-    sqlite3_reset(stmt);
+    for(b = 0; b < RDF_LATENCY_BUCKETS - 1 && (ns >> b) != 0; ++b) { };
+    ++ops->count;
+    ops->nanoseconds += ns;
+    ++ops->latency[b];
 
-    if(id == 0)
+    if(db->dump_fp != NULL && end >= db->dump_next)
     {
-        /* Insert new node */
-        stmt = db->stmts[SQL_INSERT_NODE];
-        sqlite3_bind_int64(stmt, 1, next_id(db));
-        sqlite3_bind_text(stmt, 2, uri, -1, SQLITE_STATIC);
-        if(sqlite3_step(stmt) == SQLITE_DONE)
-            id = sqlite3_last_insert_rowid(db->db);
-        sqlite3_reset(stmt);
+        db->dump_next = end + db->dump_interval;
+        rdf_db_stats_dump(db, db->dump_fp);
     }
-
-    return id;
 }
 
-static nid_t lit_to_id(
-    db_t db, const char *data, const char *type, const char *lang )
+/* Steps one of the prepared statements, recording the time taken. */
+static int step(db_t db, int n)
 {
-    nid_t id = 0;
-    sqlite3_stmt *stmt;
+    long long start = clock_ns();
+    int result = sqlite3_step(db->stmts[n]);
 
-    /* Make sure all parameters are provided. */
-    if(!data || !type || !lang)
-        return 0;
+    record(db, n, start, clock_ns());
+    return result;
+}
 
-    /* Try to find existing literal */
-    stmt = db->stmts[SQL_FIND_LITERAL_BY_VALUE];
-    sqlite3_bind_text(stmt, 1, data, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, type, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, lang, -1, SQLITE_STATIC);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
-        id = sqlite3_column_int64(stmt, 0);
+static int exec_stmt(db_t db, int n)
+{
+    sqlite3_stmt *stmt = db->stmts[n];
+    int result = step(db, n);
     sqlite3_reset(stmt);
+    return (result == SQLITE_DONE) ? 0 : -1;
+}
 
-    if(id == 0)
-    {
-        /* Not found; insert new literal */
-        stmt = db->stmts[SQL_INSERT_LITERAL];
-        sqlite3_bind_int64(stmt, 1, next_id(db));
-        sqlite3_bind_text(stmt, 2, data, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 4, lang, -1, SQLITE_STATIC);
-        if(sqlite3_step(stmt) == SQLITE_DONE)
-            id = sqlite3_last_insert_rowid(db->db);
-        sqlite3_reset(stmt);
-    }
+static const struct index_def *find_index(int flag)
+{
+    const struct index_def *def;
 
-    return id;
+    for(def = index_defs; def->flag != flag; ++def) { };
+    return def;
 }
 
-static nid_t tri_to_id(
-    db_t db, nid_t subj_id, nid_t pred_id, nid_t obj_id )
+/* Determines which indices exist on the Triple table. */
+static int detect_indexes(db_t db)
 {
-    nid_t id = 0;
+    const struct index_def *def;
     sqlite3_stmt *stmt;
 
-    /* Make sure all parameters are provided */
-    if(!subj_id || !pred_id || !obj_id)
-        return 0;
+    if(sqlite3_prepare_v2(db->db,
+        "SELECT name FROM sqlite_master WHERE type='index' AND tbl_name='Triple'",
+        -1, &stmt, NULL) != SQLITE_OK)
+    {
+        return -1;
+    }
 
-    /* Try to find extisting triple */
-    stmt = db->stmts[SQL_FIND_TRIPLE];
-    sqlite3_bind_int64(stmt, 1, subj_id);
-    sqlite3_bind_int64(stmt, 2, pred_id);
-    sqlite3_bind_int64(stmt, 3, obj_id);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
+    db->indexes = 0;
+    while(sqlite3_step(stmt) == SQLITE_ROW)
     {
-        id = sqlite3_column_int64(stmt, 0);
+        const char *name = (const char*)sqlite3_column_text(stmt, 0);
+        for(def = index_defs; def->flag; ++def)
+            if(strcmp(def->name, name) == 0)
+                db->indexes |= def->flag;
     }
-    sqlite3_reset(stmt);
 
-    if(id == 0)
+    return (sqlite3_finalize(stmt) == SQLITE_OK) ? 0 : -1;
+}
+
+/* Prepares find statement `find', using the preferred access path among
+   the available indices. */
+static sqlite3_stmt *prepare_find(db_t db, int find)
+{
+    sqlite3_stmt *stmt;
+    char buffer[1024];
+    int n, result, shape = find % FIND_SHAPES;
+    long long start;
+
+    strcpy(buffer, (find >= FIND_IDS) ? find_ids_select : find_select);
+    for(n = 0; n < 3 && find_paths[shape][n]; ++n)
     {
-        /* Not found; insert new triple */
-        stmt = db->stmts[SQL_INSERT_TRIPLE];
-        sqlite3_bind_int64(stmt, 1, next_id(db));
-        sqlite3_bind_int64(stmt, 2, subj_id);
-        sqlite3_bind_int64(stmt, 3, pred_id);
-        sqlite3_bind_int64(stmt, 4, obj_id);
-        if(sqlite3_step(stmt) == SQLITE_DONE)
+        if(db->indexes & find_paths[shape][n])
         {
-            id = sqlite3_last_insert_rowid(db->db);
+            sprintf( buffer + strlen(buffer), "INDEXED BY %s ",
+                     find_index(find_paths[shape][n])->name );
+            break;
         }
-        sqlite3_reset(stmt);
+    }
+    if(find < FIND_IDS)
+        strcat(buffer, find_joins);
+    strcat(buffer, find_conditions[shape]);
+    start = clock_ns();
+    result = sqlite3_prepare_v2(db->db, buffer, -1, &stmt, NULL);
+    record(db, OP_FIND_PREPARE, start, clock_ns());
+    if(result != SQLITE_OK)
+    {
+        fprintf( stderr, "rdfdb: INTERNAL ERROR -- "
+                         "unable to prepare statement \"%s\"\n", buffer );
+        return NULL;
     }
 
-    return id;
+    return stmt;
 }
 
-
-/*
- * API implementation
- */
-
-db_t rdf_db_open(const char *filepath)
+/* Ends iteration; shared iterators are reset for reuse, and private ones
+   are kept as spares if their statement is still current. */
+static void release_it(rdf_it_t it)
 {
+    db_t db = it->db;
     int n;
 
-    /* Allocate handle */
-    db_t db = (db_t)malloc(sizeof(struct db));
-    if(db == NULL)
-        return NULL;
-    memset(db, 0, sizeof(db_t));
-
-    /* Open database */
-    if(sqlite3_open(filepath, &db->db) != SQLITE_OK)
+    it->done = 0;
+    if(it->cursor != NULL)
     {
-        rdf_db_close(db);
-        return NULL;
+        mm_cursor_free(it->cursor);
+        for(n = 0; n < 3; ++n)
+            free(it->terms[n].data);
+        pclear(&it->pool);
+        free(it);
+    }
+    else
+    if(it->shared)
+    {
+        sqlite3_reset(it->stmt);
+        it->busy = 0;
+    }
+    else
+    if( it->find >= 0 && it->gen == db->find_gen &&
+        db->nspares[it->find] < MAX_SPARES )
+    {
+        sqlite3_reset(it->stmt);
+        it->next = db->spares[it->find];
+        db->spares[it->find] = it;
+        ++db->nspares[it->find];
     }
+    else
+    {
+        sqlite3_finalize(it->stmt);
+        pclear(&it->pool);
+        free(it);
+    }
+}
 
-    /* Create database structure */
-    sqlite3_exec(db->db, creation_script, NULL, NULL, NULL);
+/* Returns an iterator for find statement `find': the shared one if it is
+   free, or else a spare or newly prepared private one. */
+static rdf_it_t open_find(db_t db, int find)
+{
+    rdf_it_t it = &db->finds[find];
 
-    /* Prepare statements */
-    for(n = 0; n < STATEMENTS; ++n)
+    if(it->busy)
     {
-        if(sqlite3_prepare(db->db, statements[n], -1, &db->stmts[n], NULL) != SQLITE_OK)
+        if((it = db->spares[find]) != NULL)
         {
-            fprintf( stderr, "rdfdb: INTERNAL ERROR -- "
-                             "unable to prepare statement \"%s\"\n", statements[n] );
-            rdf_db_close(db);
-            return NULL;
+            db->spares[find] = it->next;
+            --db->nspares[find];
+        }
+        else
+        {
+            if((it = (rdf_it_t)malloc(sizeof(struct rdf_it))) == NULL)
+                return NULL;
+            memset(it, 0, sizeof(struct rdf_it));
+            it->db     = db;
+            it->shared = 0;
+            it->find   = find;
+            it->gen    = db->find_gen;
+            if((it->stmt = prepare_find(db, find)) == NULL)
+            {
+                free(it);
+                return NULL;
+            }
         }
     }
+    it->busy = 1;
 
-    return db;
+    return it;
 }
 
-void rdf_db_close(db_t db)
+/* Finalizes all spare iterators. */
+static void free_spares(db_t db)
 {
+    rdf_it_t it;
     int n;
 
-    /* Clean up prepared statements */
-    for(n = 0; n < STATEMENTS; ++n)
-        if(db->stmts[n] != NULL)
-            sqlite3_finalize(db->stmts[n]);
-
-    /* Close database */
-    sqlite3_close(db->db);
-
-    /* Deallocate handle */
-    free(db);
+    for(n = 0; n < FIND_STATEMENTS; ++n)
+    {
+        while((it = db->spares[n]) != NULL)
+        {
+            db->spares[n] = it->next;
+            sqlite3_finalize(it->stmt);
+            pclear(&it->pool);
+            free(it);
+        }
+        db->nspares[n] = 0;
+    }
 }
 
-char *rdf_anon_uri(db_t db)
+static long long count_triples(db_t db)
 {
-    nid_t id;
     sqlite3_stmt *stmt;
-    char uri[32];
-    char *result = NULL;
+    long long count = -1;
 
-    /* Allocate node identifier for anonymous resource */
-    if((id = next_id(db)))
+    if(sqlite3_prepare_v2(db->db, "SELECT COUNT(*) FROM Triple",
+                          -1, &stmt, NULL) == SQLITE_OK)
     {
-        /* Create URI */
-        sprintf(uri, "_:%lld", id);
-
-        /* Insert new anonymous node */
-        stmt = db->stmts[SQL_INSERT_NODE];
-        sqlite3_bind_int64(stmt, 1, id);
-        sqlite3_bind_text(stmt, 2, uri, -1, SQLITE_STATIC);
-        if(sqlite3_step(stmt) == SQLITE_DONE)
-            result = strdup(uri);
-        sqlite3_reset(stmt);
+        if(sqlite3_step(stmt) == SQLITE_ROW)
+            count = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
     }
 
-    return result;
+    return count;
 }
 
-int rdf_insert( db_t db,
-                const char *subj_uri,
-                const char *pred_uri,
-                const char *obj_lexical,
-                const char *obj_type,
-                const char *obj_lang )
+/* Reads the statistics of a predicate, or the totals if `pred' is 0.
+   Returns 1 if found, 0 if not, or -1 on error. */
+static int get_stats(db_t db, nid_t pred, struct rdf_pred_stats *stats)
 {
-    nid_t subj_id, pred_id, obj_id;
+    sqlite3_stmt *stmt = db->stmts[SQL_GET_STATS];
+    int result;
 
-    subj_id = uri_to_id(db, subj_uri);
-    pred_id = uri_to_id(db, pred_uri);
-    if(obj_type == NULL)
-    {
-        /* Object is a resource */
-        obj_id = uri_to_id(db, obj_lexical);
-    }
-    else
+    sqlite3_bind_int64(stmt, 1, pred);
+    if((result = step(db, SQL_GET_STATS)) == SQLITE_ROW)
     {
-        /* Object is a literal */
-        obj_id = lit_to_id(db, obj_lexical, obj_type, obj_lang);
+        stats->triples  = sqlite3_column_int64(stmt, 0);
+        stats->subjects = sqlite3_column_int64(stmt, 1);
+        stats->objects  = sqlite3_column_int64(stmt, 2);
     }
+    sqlite3_reset(stmt);
 
-    if( subj_id && pred_id && obj_id &&
-        tri_to_id(db, subj_id, pred_id, obj_id) )
+    return (result == SQLITE_ROW) ? 1 : (result == SQLITE_DONE) ? 0 : -1;
+}
+
+/* Determines whether the statistics are present and can be maintained.
+   The statistics of an empty database are set up right away; those of an
+   existing database are built by rdf_rebuild_stats(). */
+static void check_stats(db_t db)
+{
+    struct rdf_pred_stats totals;
+    sqlite3_stmt *stmt;
+    int n;
+
+    db->stats = 0;
+    if(!STATS_INDEXES(db->indexes))
+        return;
+
+    if((n = get_stats(db, 0, &totals)) == 0 && count_triples(db) == 0)
     {
-        return 0;
+        stmt = db->stmts[SQL_INSERT_STATS];
+        for(n = 1; n <= 4; ++n)
+            sqlite3_bind_int64(stmt, n, 0);
+        n = (exec_stmt(db, SQL_INSERT_STATS) == 0);
+    }
+    db->stats = (n > 0);
+
+    stmt = db->stmts[SQL_HISTOGRAM_USED];
+    db->histogram = (step(db, SQL_HISTOGRAM_USED) == SQLITE_ROW) &&
+                    sqlite3_column_int(stmt, 0);
+    sqlite3_reset(stmt);
+}
+
+/* Adds a delta to a row of the Statistics table. Returns the number of
+   rows changed, or -1 on error. */
+static int update_stats(db_t db, const struct stats_delta *delta)
+{
+    sqlite3_stmt *stmt = db->stmts[SQL_UPDATE_STATS];
+
+    sqlite3_bind_int64(stmt, 1, delta->pred);
+    sqlite3_bind_int64(stmt, 2, delta->triples);
+    sqlite3_bind_int64(stmt, 3, delta->subjects);
+    sqlite3_bind_int64(stmt, 4, delta->objects);
+    if(exec_stmt(db, SQL_UPDATE_STATS) != 0)
+        return -1;
+
+    return sqlite3_changes(db->db);
+}
+
+/* Forgets the pending changes to the statistics. */
+static void discard_stats(db_t db)
+{
+    memset(db->deltas, 0, sizeof(db->deltas));
+    memset(&db->totals, 0, sizeof(db->totals));
+    db->ndeltas = 0;
+}
+
+/* Writes the pending changes to the statistics to the database. */
+static int flush_stats(db_t db)
+{
+    struct stats_delta *delta;
+    sqlite3_stmt *stmt;
+    int n = 1, i;
+
+    if(db->ndeltas == 0)
+        return 0;
+
+    /* The totals are missing if another handle invalidated the statistics. */
+    if((n = update_stats(db, &db->totals)) == 0)
+        db->stats = 0;
+
+    for(i = 0; i < STATS_DELTAS && n > 0; ++i)
+    {
+        delta = &db->deltas[i];
+        if(delta->pred == 0)
+            continue;
+
+        if((n = update_stats(db, delta)) == 0 && delta->triples > 0)
+        {
+            /* First triples with this predicate */
+            stmt = db->stmts[SQL_INSERT_STATS];
+            sqlite3_bind_int64(stmt, 1, delta->pred);
+            sqlite3_bind_int64(stmt, 2, delta->triples);
+            sqlite3_bind_int64(stmt, 3, delta->subjects);
+            sqlite3_bind_int64(stmt, 4, delta->objects);
+            n = (exec_stmt(db, SQL_INSERT_STATS) == 0) ? 1 : -1;
+        }
+        else
+        if(n > 0 && delta->triples < 0)
+        {
+            /* Remove the predicate if its last triples were dropped */
+            stmt = db->stmts[SQL_DELETE_STATS];
+            sqlite3_bind_int64(stmt, 1, delta->pred);
+            n = (exec_stmt(db, SQL_DELETE_STATS) == 0) ? 1 : -1;
+        }
+    }
+
+    discard_stats(db);
+    return (n < 0) ? -1 : 0;
+}
+
+/* Adds changes to the statistics of a predicate to the pending ones. */
+static int add_stats(db_t db, nid_t pred, int triples, int subjects, int objects)
+{
+    struct stats_delta *delta;
+    int i;
+
+    i = (int)(pred % STATS_DELTAS);
+    while(db->deltas[i].pred != 0 && db->deltas[i].pred != pred)
+        i = (i + 1) % STATS_DELTAS;
+
+    delta = &db->deltas[i];
+    if(delta->pred == 0)
+    {
+        /* Keep the table sparse; write everything out when it fills up. */
+        if(4*(db->ndeltas + 1) > 3*STATS_DELTAS)
+        {
+            if(flush_stats(db) != 0)
+                return -1;
+            return add_stats(db, pred, triples, subjects, objects);
+        }
+        delta->pred = pred;
+        ++db->ndeltas;
+    }
+    delta->triples  += triples;
+    delta->subjects += subjects;
+    delta->objects  += objects;
+
+    return 0;
+}
+
+/* Updates the statistics for a triple that was just inserted (delta 1) or
+   dropped (delta -1). A subject or object is counted as distinct when the
+   triple is the first one with it, or no longer counted when it was the
+   last one. Changes to the Statistics table are kept in memory until the
+   transaction is committed. */
+static int count_triple(db_t db, nid_t subj, nid_t pred, nid_t obj, int delta)
+{
+    sqlite3_stmt *stmt;
+    int last = (delta > 0) ? 1 : 0;     /* remaining matches if first/last */
+    int count[4], n;
+
+    if(!db->stats)
+        return 0;
+
+    /* Count the remaining triples with the same subject and predicate,
+       subject, predicate and object, and object; up to two of each. */
+    stmt = db->stmts[SQL_COUNT_MATCHES];
+    sqlite3_bind_int64(stmt, 1, subj);
+    sqlite3_bind_int64(stmt, 2, pred);
+    sqlite3_bind_int64(stmt, 3, obj);
+    if(step(db, SQL_COUNT_MATCHES) != SQLITE_ROW)
+    {
+        sqlite3_reset(stmt);
+        return -1;
+    }
+    for(n = 0; n < 4; ++n)
+        count[n] = (sqlite3_column_int(stmt, n) == last) ? delta : 0;
+    sqlite3_reset(stmt);
+
+    if(add_stats(db, pred, delta, count[0], count[2]) != 0)
+        return -1;
+    db->totals.triples  += delta;
+    db->totals.subjects += count[1];
+    db->totals.objects  += count[3];
+
+    /* Objects not in the histogram are not tracked. */
+    if(!db->histogram)
+        return 0;
+    stmt = db->stmts[SQL_UPDATE_HISTOGRAM];
+    sqlite3_bind_int64(stmt, 1, pred);
+    sqlite3_bind_int64(stmt, 2, obj);
+    sqlite3_bind_int(stmt, 3, delta);
+    return exec_stmt(db, SQL_UPDATE_HISTOGRAM);
+}
+
+/* Recomputes the statistics, and the histogram if top_k > 0, in the
+   current transaction. Pending changes are included. */
+static int build_stats(db_t db, int top_k)
+{
+    char sql[1024];
+    int result;
+
+    discard_stats(db);
+
+    result = sqlite3_exec(db->db, stats_script, NULL, NULL, NULL);
+    if(result == SQLITE_OK && top_k > 0)
+    {
+        sprintf(sql, histogram_script, top_k);
+        result = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+    }
+
+    return (result == SQLITE_OK) ? 0 : -1;
+}
+
+/* Commits the current transaction, after writing pending statistics. */
+static int commit(db_t db)
+{
+    if(flush_stats(db) != 0)
+        return -1;
+
+    db->filter_cleared = 0;
+    return exec_stmt(db, SQL_COMMIT);
+}
+
+/* Makes sure the term buffer can hold at least `size' bytes. */
+static int reserve_term(db_t db, size_t size)
+{
+    char *term;
+
+    if(size <= db->term_size)
+        return 0;
+
+    if(size < 2*db->term_size)
+        size = 2*db->term_size;
+    if((term = (char*)realloc(db->term, size)) == NULL)
+        return -1;
+    db->term      = term;
+    db->term_size = size;
+
+    return 0;
+}
+
+/* Prepares the statement used by rdf_decode_ids(), which looks up
+   DECODE_BATCH identifiers among both nodes and literals. */
+static sqlite3_stmt *prepare_decode(db_t db)
+{
+    char sql[2048], list[512];
+    int n;
+
+    if(db->decode != NULL)
+        return db->decode;
+
+    for(n = 0, list[0] = '\0'; n < DECODE_BATCH; ++n)
+        sprintf(list + strlen(list), "%s?%d", n ? "," : "", n + 1);
+    sprintf( sql, "SELECT id, uri, NULL, NULL FROM Node WHERE id IN (%s)"
+                  " UNION ALL "
+                  "SELECT id, data, type, language FROM Literal"
+                  " WHERE id IN (%s)", list, list );
+    if(sqlite3_prepare_v2(db->db, sql, -1, &db->decode, NULL) != SQLITE_OK)
+    {
+        fprintf( stderr, "rdfdb: INTERNAL ERROR -- "
+                         "unable to prepare statement \"%s\"\n", sql );
+        sqlite3_finalize(db->decode);
+        db->decode = NULL;
+    }
+
+    return db->decode;
+}
+
+/* Returns the data version of the database, which changes whenever
+   another connection commits a change, or -1 on error. */
+static long long data_version(db_t db)
+{
+    long long version = -1;
+
+    if( db->data_version == NULL &&
+        sqlite3_prepare_v2( db->db, "PRAGMA data_version", -1,
+                            &db->data_version, NULL ) != SQLITE_OK )
+        return -1;
+
+    if(sqlite3_step(db->data_version) == SQLITE_ROW)
+        version = sqlite3_column_int64(db->data_version, 0);
+    sqlite3_reset(db->data_version);
+    return version;
+}
+
+/* Forgets the cached terms if another connection deleted terms (with
+   rdf_purge() or rdf_gc()) since the cache was last checked, since cached
+   identifiers may belong to those terms. Deleting terms bumps a
+   generation number in Sequence, which is only read when data_version
+   shows that another connection committed. Called when a transaction
+   starts, so that the cache stays valid until it ends. */
+static void check_cache(db_t db)
+{
+    sqlite3_stmt *stmt = db->stmts[SQL_GET_GENERATION];
+    long long version, generation = 0;
+
+    if(db->mm != NULL || (version = data_version(db)) == db->cache_version)
+        return;
+
+    if(step(db, SQL_GET_GENERATION) == SQLITE_ROW)
+        generation = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+
+    if(generation != db->cache_generation)
+    {
+        tc_clear(db->cache);
+        db->cache_generation = generation;
+    }
+    db->cache_version = version;
+}
+
+/* Records that terms are about to be deleted in the current transaction,
+   which makes other connections forget their cached terms (see
+   check_cache()). The identifier counter in Sequence is first raised past
+   the terms, so that their identifiers are never handed out again. */
+static int bump_generation(db_t db)
+{
+    sqlite3_stmt *stmt = db->stmts[SQL_NEXT_NODE_ID];
+    nid_t id = 0;
+
+    if(step(db, SQL_NEXT_NODE_ID) == SQLITE_ROW)
+        id = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+    if(id <= 0)
+        return -1;
+
+    stmt = db->stmts[SQL_RESERVE_IDS];
+    sqlite3_bind_int64(stmt, 1, id);
+    if( exec_stmt(db, SQL_RESERVE_IDS) != 0 ||
+        exec_stmt(db, SQL_BUMP_GENERATION) != 0 )
+        return -1;
+
+    stmt = db->stmts[SQL_GET_GENERATION];
+    if(step(db, SQL_GET_GENERATION) == SQLITE_ROW)
+        db->cache_generation = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+    return 0;
+}
+
+/* Starts a write transaction. Without reservations, the identifier
+   counter is stale if another connection committed since it was seeded;
+   no other connection can commit while the transaction holds the write
+   lock, so this is the one place where that is checked, as is the term
+   cache. Returns 0, or -1 on error. */
+static int begin(db_t db)
+{
+    if(exec_stmt(db, SQL_BEGIN) != 0)
+        return -1;
+
+    check_cache(db);
+
+    if( db->id_reserve == 0 && db->id_next != 0 &&
+        data_version(db) != db->id_version )
+        db->id_next = 0;    /* seeded again by next_id() */
+
+    return 0;
+}
+
+/* (Re)initializes the identifier allocator. Without reservations, the
+   allocator is seeded with the highest identifier in use, which requires
+   the write lock (see begin()). With reservations, a range of id_reserve
+   identifiers is claimed by advancing the persistent counter in Sequence,
+   so that writers on different handles never hand out the same identifier. */
+static int seed_ids(db_t db)
+{
+    sqlite3_stmt *stmt;
+    nid_t id = 0;
+    int own_txn = 0, result = -1;
+
+    if(db->id_reserve > 0 && sqlite3_get_autocommit(db->db))
+    {
+        /* Reservation must be atomic; use a transaction of our own. */
+        if(begin(db) != 0)
+            return -1;
+        own_txn = 1;
+    }
+
+    stmt = db->stmts[SQL_NEXT_NODE_ID];
+    if(step(db, SQL_NEXT_NODE_ID) == SQLITE_ROW)
+        id = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+
+    if(id > 0)
+    {
+        if(db->id_reserve == 0)
+            result = 0;
+        else
+        {
+            stmt = db->stmts[SQL_RESERVE_IDS];
+            sqlite3_bind_int64(stmt, 1, id + db->id_reserve);
+            result = exec_stmt(db, SQL_RESERVE_IDS);
+        }
+    }
+
+    if(own_txn)
+    {
+        if(result == 0)
+            result = exec_stmt(db, SQL_COMMIT);
+        if(result != 0)
+            exec_stmt(db, SQL_ROLLBACK);
+    }
+
+    if(result != 0)
+        return -1;
+
+    db->id_next    = id;
+    db->id_end     = id + db->id_reserve;
+    db->id_version = data_version(db);
+    return 0;
+}
+
+static nid_t next_id(db_t db)
+{
+    if( db->id_next == 0 ||
+        (db->id_reserve > 0 && db->id_next >= db->id_end) )
+    {
+        if(seed_ids(db) != 0)
+            return 0;
+    }
+
+    return db->id_next++;
+}
+
+/* Rolls back the current transaction. A reserved identifier range may have
+   been claimed in the transaction, so it is discarded as well. */
+static int rollback(db_t db)
+{
+    int result;
+
+    if(db->id_reserve > 0)
+        db->id_next = 0;
+
+    /* Terms inserted in this transaction may have been cached. */
+    tc_clear(db->cache);
+    db->filter_cleared = 0;
+
+    result = exec_stmt(db, SQL_ROLLBACK);
+
+    /* The transaction may have rebuilt or invalidated the statistics. */
+    discard_stats(db);
+    check_stats(db);
+
+    return result;
+}
+
+/* Builds the term cache key for a resource into `key', which must have
+   room for TERM_KEY_MAX bytes. Returns the key length, or 0 if the URI is
+   too long to be cached. */
+static size_t uri_key(char *key, const char *uri)
+{
+    size_t len = strlen(uri);
+
+    if(len + 1 > TERM_KEY_MAX)
+        return 0;
+
+    key[0] = 'U';
+    memcpy(key + 1, uri, len);
+    return len + 1;
+}
+
+/* Builds the term cache key for a literal; see uri_key(). */
+static size_t lit_key(
+    char *key, const char *data, const char *type, const char *lang )
+{
+    size_t data_len = strlen(data), type_len = strlen(type),
+           lang_len = strlen(lang);
+
+    if(data_len + type_len + lang_len + 3 > TERM_KEY_MAX)
+        return 0;
+
+    key[0] = 'L';
+    memcpy(key + 1, type, type_len + 1);
+    memcpy(key + 2 + type_len, lang, lang_len + 1);
+    memcpy(key + 3 + type_len + lang_len, data, data_len);
+    return data_len + type_len + lang_len + 3;
+}
+
+/* Hashes identifying a resource, literal or triple in the Bloom filter */
+static unsigned long long uri_hash(const char *uri)
+{
+    return bloom_hash(bloom_hash(BLOOM_HASH_INIT, "U", 1), uri, strlen(uri));
+}
+
+static unsigned long long lit_hash(
+    const char *data, const char *type, const char *lang )
+{
+    unsigned long long hash = bloom_hash(BLOOM_HASH_INIT, "L", 1);
+
+    hash = bloom_hash(hash, type, strlen(type) + 1);
+    hash = bloom_hash(hash, lang, strlen(lang) + 1);
+    return bloom_hash(hash, data, strlen(data));
+}
+
+static unsigned long long tri_hash(nid_t subj, nid_t pred, nid_t obj)
+{
+    unsigned char bytes[25];
+    nid_t ids[3];
+    int n, i;
+
+    /* Identifiers are hashed in little-endian order, so that saved
+       filters can be used on other platforms. */
+    ids[0] = subj;
+    ids[1] = pred;
+    ids[2] = obj;
+    bytes[0] = 'T';
+    for(n = 0; n < 3; ++n)
+        for(i = 0; i < 8; ++i)
+            bytes[1 + 8*n + i] = (unsigned char)(ids[n] >> 8*i);
+    return bloom_hash(BLOOM_HASH_INIT, bytes, sizeof(bytes));
+}
+
+static void drop_filter(db_t db)
+{
+    if(db->filter != NULL)
+        bloom_destroy(db->filter);
+    db->filter = NULL;
+}
+
+/* Builds the Bloom filter from the database, with room for as many more
+   elements as it holds now. Returns 0, or -1 (leaving the handle without
+   a filter) on failure. */
+static int build_filter(db_t db)
+{
+    static const char * const queries[3] = {
+        "SELECT uri FROM Node",
+        "SELECT data, type, language FROM Literal",
+        "SELECT subject, predicate, object FROM Triple" };
+    static const char * const count_query =
+        "SELECT (SELECT COUNT(*) FROM Node) + (SELECT COUNT(*) FROM Literal)"
+        "     + (SELECT COUNT(*) FROM Triple)";
+    sqlite3_stmt *stmt;
+    const char *text[3];
+    unsigned long long hash;
+    bloom_t filter = NULL;
+    long long start = clock_ns(), version = -1;
+    int own, n, i, rc = SQLITE_ERROR;
+
+    drop_filter(db);
+
+    /* The data version must be that of the snapshot that is read. */
+    own = sqlite3_get_autocommit(db->db);
+    if(own && sqlite3_exec(db->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+        return -1;
+
+    if(sqlite3_prepare_v2(db->db, count_query, -1, &stmt, NULL) == SQLITE_OK)
+    {
+        if(sqlite3_step(stmt) == SQLITE_ROW && (version = data_version(db)) >= 0)
+            filter = bloom_create(2*(size_t)sqlite3_column_int64(stmt, 0));
+        sqlite3_finalize(stmt);
+    }
+
+    for(n = 0; n < 3 && filter != NULL; ++n)
+    {
+        if(sqlite3_prepare_v2(db->db, queries[n], -1, &stmt, NULL) != SQLITE_OK)
+        {
+            rc = SQLITE_ERROR;
+            break;
+        }
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            /* NULLs and non-text values never match a lookup, so adding
+               them as something else gives false positives only. */
+            for(i = 0; i < 3; ++i)
+                if((text[i] = (const char*)sqlite3_column_text(stmt, i)) == NULL)
+                    text[i] = "";
+            if(n == 0)
+                hash = uri_hash(text[0]);
+            else
+            if(n == 1)
+                hash = lit_hash(text[0], text[1], text[2]);
+            else
+                hash = tri_hash( sqlite3_column_int64(stmt, 0),
+                                 sqlite3_column_int64(stmt, 1),
+                                 sqlite3_column_int64(stmt, 2) );
+            bloom_add(filter, hash);
+        }
+        sqlite3_finalize(stmt);
+        if(rc != SQLITE_DONE)
+            break;
+    }
+
+    if(own)
+        sqlite3_exec(db->db, "COMMIT", NULL, NULL, NULL);
+
+    if(filter != NULL && rc != SQLITE_DONE)
+    {
+        bloom_destroy(filter);
+        filter = NULL;
+    }
+    if(filter == NULL)
+        return -1;
+
+    db->filter         = filter;
+    db->filter_version = version;
+    db->filter_dirty   = 1;
+    record(db, OP_FILTER_BUILD, start, clock_ns());
+    return 0;
+}
+
+/* Returns 0 if the Bloom filter shows that an element is not in the
+   database, or 1 if it may be. Elements added by other connections are
+   not in the filter, so it is dropped once they have committed changes. */
+static int filter_has(db_t db, unsigned long long hash)
+{
+    if(db->filter == NULL || bloom_test(db->filter, hash))
+        return 1;
+
+    if(data_version(db) != db->filter_version)
+    {
+        drop_filter(db);
+        return 1;
+    }
+
+    ++db->ops[OP_FILTER_NEGATIVE].count;
+    return 0;
+}
+
+/* Adds an element inserted into the database to the Bloom filter, which is
+   rebuilt (larger) once it is full. Elements of transactions that are
+   rolled back stay in the filter, which is harmless. */
+static void filter_add(db_t db, unsigned long long hash)
+{
+    if(db->filter == NULL)
+        return;
+
+    bloom_add(db->filter, hash);
+    db->filter_dirty = 1;
+    if(bloom_full(db->filter))
+        build_filter(db);
+}
+
+/* Loads the Bloom filter saved in the database, if there is one. Must be
+   called in a transaction. Returns 1 if it was loaded, or 0 if not. */
+static int load_filter(db_t db)
+{
+    sqlite3_stmt *stmt;
+    long long version;
+
+    if(sqlite3_prepare_v2( db->db, "SELECT capacity, count, bits FROM Filter",
+                           -1, &stmt, NULL ) != SQLITE_OK)
+        return 0;
+
+    if(sqlite3_step(stmt) == SQLITE_ROW && (version = data_version(db)) >= 0)
+    {
+        db->filter = bloom_load( sqlite3_column_blob(stmt, 2),
+                                 (size_t)sqlite3_column_bytes(stmt, 2),
+                                 (size_t)sqlite3_column_int64(stmt, 0),
+                                 (size_t)sqlite3_column_int64(stmt, 1) );
+        db->filter_version = version;
+        db->filter_dirty   = 0;
+    }
+    sqlite3_finalize(stmt);
+
+    return db->filter != NULL;
+}
+
+/* Loads the saved Bloom filter, or builds one if there is none. */
+static int open_filter(db_t db)
+{
+    int result = 0;
+
+    if(sqlite3_exec(db->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+        return -1;
+    if(!load_filter(db))
+        result = build_filter(db);
+    sqlite3_exec(db->db, "COMMIT", NULL, NULL, NULL);
+
+    return result;
+}
+
+/* Deletes the filter saved in the database (by any handle), which does not
+   hold the terms and triples added in the current transaction; called
+   before the first is added. Returns 0, or -1 on error. */
+static int clear_saved_filter(db_t db)
+{
+    /* The WHERE clause keeps SQLite from rewriting the table's (empty)
+       root page every time. */
+    static const char * const clear_query =
+        "DELETE FROM Filter WHERE rowid IS NOT NULL";
+
+    if(db->filter_cleared)
+        return 0;
+
+    if( db->clear_filter == NULL &&
+        sqlite3_prepare_v2( db->db, clear_query, -1,
+                            &db->clear_filter, NULL ) != SQLITE_OK )
+        return -1;
+
+    if(sqlite3_step(db->clear_filter) != SQLITE_DONE)
+    {
+        sqlite3_reset(db->clear_filter);
+        return -1;
+    }
+    sqlite3_reset(db->clear_filter);
+    db->filter_cleared = 1;
+    return 0;
+}
+
+/* Saves the Bloom filter in the database, unless it is unchanged since it
+   was loaded. A filter that misses changes made by other connections is
+   not saved; this is checked while holding the write lock, so that none
+   can be committed in the meantime. */
+static void save_filter(db_t db)
+{
+    static const char * const insert_query =
+        "INSERT INTO Filter (capacity, count, bits) VALUES (?1, ?2, ?3)";
+    sqlite3_stmt *stmt;
+    const void *bits;
+    size_t size, capacity, count;
+    int result = -1;
+
+    if( !db->filter_save || db->filter == NULL || !db->filter_dirty ||
+        db->batch || begin(db) != 0 )
+        return;
+
+    bits = bloom_data(db->filter, &size);
+    bloom_stats(db->filter, &capacity, &count);
+    if( data_version(db) == db->filter_version &&
+        sqlite3_exec(db->db, "DELETE FROM Filter", NULL, NULL, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db->db, insert_query, -1, &stmt, NULL) == SQLITE_OK )
+    {
+        sqlite3_bind_int64(stmt, 1, (sqlite3_int64)capacity);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)count);
+        sqlite3_bind_blob64(stmt, 3, bits, (sqlite3_uint64)size, SQLITE_STATIC);
+        if(sqlite3_step(stmt) == SQLITE_DONE)
+            result = 0;
+        sqlite3_finalize(stmt);
+    }
+
+    if(result == 0)
+        result = commit(db);
+    if(result != 0)
+        rollback(db);
+}
+
+/* Looks up the identifier of an existing node; returns 0 if not found. */
+static nid_t find_uri_id(db_t db, const char *uri)
+{
+    nid_t id = 0;
+    sqlite3_stmt *stmt;
+    char key[TERM_KEY_MAX];
+    size_t key_len;
+    long long start, end;
+
+    /* Make sure all paramters are provided */
+    if(!uri)
+        return 0;
+
+    if(db->mm != NULL)
+        return mm_lookup(db->mm, uri, NULL, NULL);
+
+    /* Check the term cache */
+    if((key_len = uri_key(key, uri)) && (id = tc_lookup(db->cache, key, key_len)))
+    {
+        ++db->ops[OP_TERM_CACHED].count;
+        return id;
+    }
+    if(db->filter != NULL && !filter_has(db, uri_hash(uri)))
+        return 0;
+
+    /* Try to find existing node */
+    stmt = db->stmts[SQL_FIND_NODE_BY_URI];
+    sqlite3_bind_text(stmt, 1, uri, -1, SQLITE_STATIC);
+    start = clock_ns();
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+        id = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+    end = clock_ns();
+    record(db, SQL_FIND_NODE_BY_URI, start, end);
+    record(db, id ? OP_TERM_FOUND : OP_TERM_MISSING, start, end);
+
+    if(id && key_len)
+        tc_insert(db->cache, key, key_len, id);
+
+    return id;
+}
+
+/* Looks up the identifier of an existing literal; returns 0 if not found. */
+static nid_t find_lit_id(
+    db_t db, const char *data, const char *type, const char *lang )
+{
+    nid_t id = 0;
+    sqlite3_stmt *stmt;
+    char key[TERM_KEY_MAX];
+    size_t key_len;
+    long long start, end;
+
+    /* Make sure all parameters are provided. */
+    if(!data || !type || !lang)
+        return 0;
+
+    if(db->mm != NULL)
+        return mm_lookup(db->mm, data, type, lang);
+
+    /* Check the term cache */
+    if( (key_len = lit_key(key, data, type, lang)) &&
+        (id = tc_lookup(db->cache, key, key_len)) )
+    {
+        ++db->ops[OP_TERM_CACHED].count;
+        return id;
+    }
+    if(db->filter != NULL && !filter_has(db, lit_hash(data, type, lang)))
+        return 0;
+
+    /* Try to find existing literal */
+    stmt = db->stmts[SQL_FIND_LITERAL_BY_VALUE];
+    sqlite3_bind_text(stmt, 1, data, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, type, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, lang, -1, SQLITE_STATIC);
+    start = clock_ns();
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+        id = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+    end = clock_ns();
+    record(db, SQL_FIND_LITERAL_BY_VALUE, start, end);
+    record(db, id ? OP_TERM_FOUND : OP_TERM_MISSING, start, end);
+
+    if(id && key_len)
+        tc_insert(db->cache, key, key_len, id);
+
+    return id;
+}
+
+/* Looks up the identifier of an existing object, which is a resource if
+   `type' is NULL, or a literal otherwise. */
+static nid_t find_obj_id(
+    db_t db, const char *lexical, const char *type, const char *lang )
+{
+    if(type == NULL)
+        return find_uri_id(db, lexical);
+    else
+        return find_lit_id(db, lexical, type, lang);
+}
+
+/* Returns the identifier of a node, inserting it if necessary. */
+static nid_t uri_to_id(db_t db, const char *uri)
+{
+    nid_t id;
+    sqlite3_stmt *stmt;
+    char key[TERM_KEY_MAX];
+    size_t key_len;
+    long long start;
+
+    if(!uri)
+        return 0;
+    if((id = find_uri_id(db, uri)))
+        return id;
+    if(clear_saved_filter(db) != 0)
+        return 0;
+
+    /* Insert new node */
+    start = clock_ns();
+    stmt = db->stmts[SQL_INSERT_NODE];
+    sqlite3_bind_int64(stmt, 1, next_id(db));
+    sqlite3_bind_text(stmt, 2, uri, -1, SQLITE_STATIC);
+    if(step(db, SQL_INSERT_NODE) == SQLITE_DONE)
+        id = sqlite3_last_insert_rowid(db->db);
+    sqlite3_reset(stmt);
+    record(db, OP_NEW_NODE, start, clock_ns());
+
+    if(id && (key_len = uri_key(key, uri)))
+        tc_insert(db->cache, key, key_len, id);
+    if(id && db->filter != NULL)
+        filter_add(db, uri_hash(uri));
+
+    return id;
+}
+
+/* Returns the identifier of a literal, inserting it if necessary. */
+static nid_t lit_to_id(
+    db_t db, const char *data, const char *type, const char *lang )
+{
+    nid_t id;
+    sqlite3_stmt *stmt;
+    char key[TERM_KEY_MAX];
+    size_t key_len;
+    long long start;
+
+    if(!data || !type || !lang)
+        return 0;
+    if((id = find_lit_id(db, data, type, lang)))
+        return id;
+    if(clear_saved_filter(db) != 0)
+        return 0;
+
+    /* Not found; insert new literal */
+    start = clock_ns();
+    stmt = db->stmts[SQL_INSERT_LITERAL];
+    sqlite3_bind_int64(stmt, 1, next_id(db));
+    sqlite3_bind_text(stmt, 2, data, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, lang, -1, SQLITE_STATIC);
+    if(step(db, SQL_INSERT_LITERAL) == SQLITE_DONE)
+        id = sqlite3_last_insert_rowid(db->db);
+    sqlite3_reset(stmt);
+    record(db, OP_NEW_LITERAL, start, clock_ns());
+
+    if(id && (key_len = lit_key(key, data, type, lang)))
+        tc_insert(db->cache, key, key_len, id);
+    if(id && db->filter != NULL)
+        filter_add(db, lit_hash(data, type, lang));
+
+    return id;
+}
+
+static nid_t tri_to_id(
+    db_t db, nid_t subj_id, nid_t pred_id, nid_t obj_id )
+{
+    nid_t id = 0;
+    sqlite3_stmt *stmt;
+    unsigned long long hash = 0;
+
+    /* Make sure all parameters are provided */
+    if(!subj_id || !pred_id || !obj_id)
+        return 0;
+
+    /* Try to find extisting triple, unless the filter rules it out */
+    if(db->filter != NULL)
+        hash = tri_hash(subj_id, pred_id, obj_id);
+    if(db->filter == NULL || filter_has(db, hash))
+    {
+        stmt = db->stmts[SQL_FIND_TRIPLE];
+        sqlite3_bind_int64(stmt, 1, subj_id);
+        sqlite3_bind_int64(stmt, 2, pred_id);
+        sqlite3_bind_int64(stmt, 3, obj_id);
+        if(step(db, SQL_FIND_TRIPLE) == SQLITE_ROW)
+        {
+            id = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_reset(stmt);
+    }
+
+    if(id == 0)
+    {
+        if(clear_saved_filter(db) != 0)
+            return 0;
+
+        /* Not found; insert new triple */
+        stmt = db->stmts[SQL_INSERT_TRIPLE];
+        sqlite3_bind_int64(stmt, 1, next_id(db));
+        sqlite3_bind_int64(stmt, 2, subj_id);
+        sqlite3_bind_int64(stmt, 3, pred_id);
+        sqlite3_bind_int64(stmt, 4, obj_id);
+        if(step(db, SQL_INSERT_TRIPLE) == SQLITE_DONE)
+        {
+            id = sqlite3_last_insert_rowid(db->db);
+        }
+        sqlite3_reset(stmt);
+
+        if(id)
+            filter_add(db, hash);
+
+        if(id && count_triple(db, subj_id, pred_id, obj_id, 1) != 0)
+            id = 0;
+    }
+
+    return id;
+}
+
+
+/* Creates the given indices if they do not exist yet. */
+static int build_indexes(db_t db, int flags)
+{
+    const struct index_def *def;
+    char sql[256];
+
+    for(def = index_defs; def->flag; ++def)
+    {
+        if((flags & def->flag) && !(db->indexes & def->flag))
+        {
+            sprintf( sql, "CREATE %sINDEX IF NOT EXISTS %s ON Triple(%s)",
+                     (def->flag == RDF_INDEX_SPO) ? "UNIQUE " : "",
+                     def->name, def->columns );
+            if(sqlite3_exec(db->db, sql, NULL, NULL, NULL) != SQLITE_OK)
+                return -1;
+            db->indexes |= def->flag;
+        }
+    }
+
+    return 0;
+}
+
+/* Drops the given indices (except Triple_spo) if they exist. */
+static int drop_indexes(db_t db, int flags)
+{
+    const struct index_def *def;
+    char sql[256];
+
+    for(def = index_defs; def->flag; ++def)
+    {
+        if( (flags & def->flag) && (db->indexes & def->flag) &&
+            def->flag != RDF_INDEX_SPO )
+        {
+            sprintf(sql, "DROP INDEX IF EXISTS %s", def->name);
+            if(sqlite3_exec(db->db, sql, NULL, NULL, NULL) != SQLITE_OK)
+                return -1;
+            db->indexes &= ~def->flag;
+        }
+    }
+
+    return 0;
+}
+
+/* Returns whether any of the shared find statements is in use. */
+static int finds_busy(db_t db)
+{
+    int n;
+
+    for(n = 0; n < FIND_STATEMENTS; ++n)
+        if(db->finds[n].busy)
+            return 1;
+
+    return 0;
+}
+
+/* (Re)prepares the shared find statements, e.g. after the available
+   indices changed. Fails if any of them is in use. */
+static int prepare_finds(db_t db)
+{
+    int n;
+
+    if(finds_busy(db))
+        return -1;
+
+    /* Private iterators prepared before now are not reused. */
+    free_spares(db);
+    ++db->find_gen;
+
+    for(n = 0; n < FIND_STATEMENTS; ++n)
+    {
+        if(db->finds[n].stmt != NULL)
+            sqlite3_finalize(db->finds[n].stmt);
+        if((db->finds[n].stmt = prepare_find(db, n)) == NULL)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/* Returns one of the statements used by rdf_gc(), preparing it first if
+   necessary, or NULL on error. */
+static sqlite3_stmt *gc_stmt(db_t db, int n)
+{
+    if( db->gc[n] == NULL &&
+        sqlite3_prepare_v2(db->db, gc_statements[n], -1, &db->gc[n], NULL)
+            != SQLITE_OK )
+    {
+        fprintf( stderr, "rdfdb: unable to prepare statement \"%s\": %s\n",
+                         gc_statements[n], sqlite3_errmsg(db->db) );
+        sqlite3_finalize(db->gc[n]);
+        db->gc[n] = NULL;
+    }
+
+    return db->gc[n];
+}
+
+/* Runs a statement used by rdf_gc() that takes an identifier and returns
+   no rows. */
+static int exec_gc(db_t db, int n, nid_t id)
+{
+    sqlite3_stmt *stmt;
+    int result;
+
+    if((stmt = gc_stmt(db, n)) == NULL)
+        return -1;
+    sqlite3_bind_int64(stmt, 1, id);
+    result = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    return (result == SQLITE_DONE) ? 0 : -1;
+}
+
+/* Marks a term that lost a reference, to be examined by rdf_gc(). */
+static int add_candidate(db_t db, nid_t id)
+{
+    return exec_gc(db, GC_ADD_CANDIDATE, id);
+}
+
+/* Returns 1 if a term occurs in any triple, 0 if not, or -1 on error. */
+static int term_used(db_t db, nid_t id)
+{
+    sqlite3_stmt *stmt;
+    int used = -1;
+
+    if((stmt = gc_stmt(db, GC_TERM_USED)) == NULL)
+        return -1;
+    sqlite3_bind_int64(stmt, 1, id);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+        used = sqlite3_column_int(stmt, 0) != 0;
+    sqlite3_reset(stmt);
+
+    return used;
+}
+
+/* Deletes an unused node or literal, removing it from the term cache
+   first. Returns 0 if deleted (or not found), or -1 on error. */
+static int delete_term(db_t db, nid_t id)
+{
+    sqlite3_stmt *stmt;
+    const char *data, *type, *lang;
+    char key[TERM_KEY_MAX];
+    size_t key_len = 0;
+    int result;
+
+    stmt = db->stmts[SQL_FIND_NODE_BY_ID];
+    sqlite3_bind_int64(stmt, 1, id);
+    if((result = step(db, SQL_FIND_NODE_BY_ID)) == SQLITE_ROW)
+    {
+        if((data = (const char*)sqlite3_column_text(stmt, 0)) != NULL)
+            key_len = uri_key(key, data);
+        sqlite3_reset(stmt);
+        if(key_len > 0)
+            tc_remove(db->cache, key, key_len);
+        return exec_gc(db, GC_DELETE_NODE, id);
+    }
+    sqlite3_reset(stmt);
+    if(result != SQLITE_DONE)
+        return -1;
+
+    stmt = db->stmts[SQL_FIND_LITERAL_BY_ID];
+    sqlite3_bind_int64(stmt, 1, id);
+    if((result = step(db, SQL_FIND_LITERAL_BY_ID)) == SQLITE_ROW)
+    {
+        data = (const char*)sqlite3_column_text(stmt, 0);
+        type = (const char*)sqlite3_column_text(stmt, 1);
+        lang = (const char*)sqlite3_column_text(stmt, 2);
+        if(data != NULL && type != NULL && lang != NULL)
+            key_len = lit_key(key, data, type, lang);
+        sqlite3_reset(stmt);
+        if(key_len > 0)
+            tc_remove(db->cache, key, key_len);
+        return exec_gc(db, GC_DELETE_LITERAL, id);
+    }
+    sqlite3_reset(stmt);
+
+    return (result == SQLITE_DONE) ? 0 : -1;
+}
+
+/* Examines up to GC_BATCH candidates in one transaction, deleting the
+   terms that are no longer used. Returns the number of candidates
+   examined, or -1 on error. */
+static int collect_batch(db_t db)
+{
+    sqlite3_stmt *stmt;
+    nid_t ids[GC_BATCH];
+    int n, count = 0, deleted = 0, used, result = 0;
+
+    if((stmt = gc_stmt(db, GC_NEXT_CANDIDATES)) == NULL)
+        return -1;
+    if(!db->batch && begin(db) != 0)
+        return -1;
+
+    sqlite3_bind_int(stmt, 1, GC_BATCH);
+    while(count < GC_BATCH && sqlite3_step(stmt) == SQLITE_ROW)
+        ids[count++] = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+
+    /* The generation is bumped before the first term is deleted. */
+    for(n = 0; n < count && result == 0; ++n)
+    {
+        if( (used = term_used(db, ids[n])) < 0 ||
+            (!used && deleted++ == 0 && bump_generation(db) != 0) ||
+            (!used && delete_term(db, ids[n]) != 0) ||
+            exec_gc(db, GC_DELETE_CANDIDATE, ids[n]) != 0 )
+            result = -1;
+    }
+
+    if(!db->batch)
+    {
+        if(result == 0)
+            result = commit(db);
+        if(result != 0)
+            rollback(db);
+    }
+
+    return (result == 0) ? count : -1;
+}
+
+/* Returns the number of free pages that rdf_gc() can release (none
+   unless the database uses incremental vacuum), or -1 on error. */
+static long long free_pages(db_t db)
+{
+    sqlite3_stmt *stmt;
+    long long pages = -1;
+    int result;
+
+    if((stmt = gc_stmt(db, GC_FREE_PAGES)) == NULL)
+        return -1;
+    if((result = sqlite3_step(stmt)) == SQLITE_ROW)
+        pages = sqlite3_column_int64(stmt, 0);
+    else
+    if(result == SQLITE_DONE)
+        pages = 0;
+    sqlite3_reset(stmt);
+
+    return pages;
+}
+
+
+/* Makes room for the term offsets of `count' identifiers, for
+   rdf_decode_ids(). Terms are stored by offset until all are decoded,
+   since the buffer may move while growing; (size_t)-1 stands for NULL. */
+static size_t *reserve_offsets(db_t db, int count)
+{
+    size_t *offsets;
+    int i;
+
+    if((size_t)count*3 > db->offsets_size)
+    {
+        offsets = (size_t*)realloc(db->offsets, 3*count*sizeof(size_t));
+        if(offsets == NULL)
+            return NULL;
+        db->offsets      = offsets;
+        db->offsets_size = 3*count;
+    }
+    for(i = 0; i < 3*count; ++i)
+        db->offsets[i] = (size_t)-1;
+
+    return db->offsets;
+}
+
+/* Points the output arrays of rdf_decode_ids() at the decoded terms. */
+static void point_terms( db_t db, int count, const char **lexical,
+                         const char **type, const char **lang )
+{
+    const char **out[3];
+    int i, k;
+
+    out[0] = lexical;
+    out[1] = type;
+    out[2] = lang;
+    for(k = 0; k < 3; ++k)
+    {
+        if(out[k] == NULL)
+            continue;
+        for(i = 0; i < count; ++i)
+            out[k][i] = (db->offsets[3*i + k] == (size_t)-1) ? NULL
+                      : db->term + db->offsets[3*i + k];
+    }
+}
+
+/* rdf_decode_ids() for mapped stores */
+static int decode_mapped( db_t db, const nid_t *ids, int count,
+                          const char **lexical, const char **type,
+                          const char **lang )
+{
+    const char *col[3];
+    size_t used = 0, len, *offsets;
+    int i, k, found;
+
+    if((offsets = reserve_offsets(db, count)) == NULL)
+        return -1;
+
+    for(i = 0; i < count; ++i)
+    {
+        if((found = mm_decode(db->mm, ids[i], &db->mm_term)) < 0)
+            return -1;
+        if(found == 0)
+            continue;
+
+        col[0] = db->mm_term.lexical;
+        col[1] = db->mm_term.type;
+        col[2] = db->mm_term.lang;
+        for(k = 0; k < 3; ++k)
+        {
+            if(col[k] == NULL)
+                continue;
+            len = strlen(col[k]) + 1;
+            if(reserve_term(db, used + len) != 0)
+                return -1;
+            memcpy(db->term + used, col[k], len);
+            offsets[3*i + k] = used;
+            used += len;
+        }
+    }
+    point_terms(db, count, lexical, type, lang);
+
+    return 0;
+}
+
+/* Returns a private iterator over the triples of a mapped store that
+   match a pattern, for find statement `find' (which determines whether
+   terms or identifiers are returned). */
+static rdf_it_t open_mapped(db_t db, int find, nid_t subj, nid_t pred, nid_t obj)
+{
+    rdf_it_t it;
+
+    if((it = (rdf_it_t)malloc(sizeof(struct rdf_it))) == NULL)
+        return NULL;
+    memset(it, 0, sizeof(struct rdf_it));
+    it->db   = db;
+    it->find = find;
+    if((it->cursor = mm_find(db->mm, subj, pred, obj)) == NULL)
+    {
+        free(it);
+        return NULL;
+    }
+
+    return it;
+}
+
+/* Reads the next triple from a mapped store. Unless `terms' is NULL, its
+   terms are decoded into the five columns returned by rdf_next(). Returns
+   1, 0 at the end, or -1 on error. */
+static int read_mapped(rdf_it_t it, const char **terms)
+{
+    mmstore_t mm = it->db->mm;
+    nid_t ids[3];
+    int n;
+
+    if(!mm_next(it->cursor, &ids[0], &ids[1], &ids[2]))
+        return 0;
+    if(terms == NULL)
+        return 1;
+
+    for(n = 0; n < 3; ++n)
+        if(mm_decode(mm, ids[n], &it->terms[n]) <= 0)
+            return -1;
+    terms[0] = it->terms[0].lexical;
+    terms[1] = it->terms[1].lexical;
+    terms[2] = it->terms[2].lexical;
+    terms[3] = it->terms[2].type;
+    terms[4] = it->terms[2].lang;
+
+    return 1;
+}
+
+/* rdf_next_batch() for mapped stores */
+static int next_batch_mapped(rdf_it_t it, struct rdf_batch *batch, int count)
+{
+    const char *terms[5];
+    nid_t ids[3];
+    char *term;
+    size_t len;
+    int rows, n, result = 1;
+
+    for(rows = 0; rows < count; ++rows)
+    {
+        if(it->find >= FIND_IDS)
+        {
+            if((result = mm_next(it->cursor, &ids[0], &ids[1], &ids[2])) == 0)
+                break;
+            for(n = 0; n < 3; ++n)
+                if(batch->ids[n])
+                    batch->ids[n][rows] = ids[n];
+            continue;
+        }
+
+        if((result = read_mapped(it, terms)) <= 0)
+            break;
+        for(n = 0; n < 5; ++n)
+        {
+            if(!batch->terms[n] && !batch->lengths[n])
+                continue;
+            term = NULL;
+            len  = 0;
+            if(terms[n] != NULL)
+            {
+                len = strlen(terms[n]);
+                if((term = (char*)palloc(&it->pool, len + 1)) == NULL)
+                {
+                    result = -1;
+                    break;
+                }
+                memcpy(term, terms[n], len + 1);
+            }
+            if(batch->terms[n])
+                batch->terms[n][rows] = term;
+            if(batch->lengths[n])
+                batch->lengths[n][rows] = len;
+        }
+        if(result < 0)
+            break;
+    }
+
+    if(result < 0 || rows == 0)
+    {
+        release_it(it);
+        return result;
+    }
+
+    /* As for statements, release the iterator on the next call. */
+    it->done = (result == 0);
+    return rows;
+}
+
+
+/* Buffered snapshot data, being written or read */
+struct dump_stream
+{
+    FILE            *fp;
+    unsigned char   *buf;       /* DUMP_BLOCK bytes */
+    size_t          size;       /* bytes in buf */
+    size_t          pos;        /* bytes of buf read */
+    char            *text;      /* strings read by get_strings() */
+    size_t          text_size;
+};
+
+static unsigned long adler32(const unsigned char *data, size_t size)
+{
+    unsigned long a = 1, b = 0;
+    size_t n;
+
+    while(size > 0)
+    {
+        /* Largest run for which b cannot overflow 32 bits */
+        n = (size < 5552) ? size : 5552;
+        size -= n;
+        while(n-- > 0)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+static void put_u32(unsigned char *p, unsigned long value)
+{
+    p[0] = (unsigned char)(value);
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return (unsigned long)p[0]       | (unsigned long)p[1] << 8 |
+           (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+/* Writes the buffered data as a block. Returns 0, or -1 on error. */
+static int flush_block(struct dump_stream *ds)
+{
+    unsigned char header[8];
+
+    if(ds->size == 0)
+        return 0;
+
+    put_u32(header, ds->size);
+    put_u32(header + 4, adler32(ds->buf, ds->size));
+    if( fwrite(header, 1, 8, ds->fp) != 8 ||
+        fwrite(ds->buf, 1, ds->size, ds->fp) != ds->size )
+        return -1;
+    ds->size = 0;
+
+    return 0;
+}
+
+static int put_bytes(struct dump_stream *ds, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    size_t n;
+
+    while(size > 0)
+    {
+        if(ds->size == DUMP_BLOCK && flush_block(ds) != 0)
+            return -1;
+        n = DUMP_BLOCK - ds->size;
+        if(n > size)
+            n = size;
+        memcpy(ds->buf + ds->size, p, n);
+        ds->size += n;
+        p        += n;
+        size     -= n;
+    }
+
+    return 0;
+}
+
+static int put_varint(struct dump_stream *ds, nid_t value)
+{
+    unsigned long long v = (unsigned long long)value;
+    unsigned char bytes[10];
+    size_t n = 0;
+
+    do {
+        bytes[n] = (unsigned char)(v & 127);
+        if((v >>= 7) != 0)
+            bytes[n] |= 128;
+        ++n;
+    } while(v != 0);
+
+    return put_bytes(ds, bytes, n);
+}
+
+static int put_string(struct dump_stream *ds, const char *text, size_t size)
+{
+    if(text == NULL)
+        return put_varint(ds, 0);
+
+    if(put_varint(ds, (nid_t)size + 1) != 0)
+        return -1;
+    return put_bytes(ds, text, size);
+}
+
+/* Writes a triple, relative to the previous one, which is updated. */
+static int put_triple(struct dump_stream *ds, nid_t *prev, const nid_t *triple)
+{
+    nid_t values[3];
+    int n;
+
+    values[0] = triple[0] - prev[0] + 1;
+    values[1] = triple[1] - ((triple[0] == prev[0]) ? prev[1] : 0);
+    values[2] = triple[2] - ((triple[0] == prev[0] && triple[1] == prev[1])
+                             ? prev[2] : 0);
+    for(n = 0; n < 3; ++n)
+    {
+        prev[n] = triple[n];
+        if(put_varint(ds, values[n]) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Reads and verifies the next block. Returns 0, or -1 on error. */
+static int read_block(struct dump_stream *ds)
+{
+    unsigned char header[8];
+
+    if(fread(header, 1, 8, ds->fp) != 8)
+        return -1;
+
+    ds->pos  = 0;
+    ds->size = get_u32(header);
+    if( ds->size == 0 || ds->size > DUMP_BLOCK ||
+        fread(ds->buf, 1, ds->size, ds->fp) != ds->size ||
+        adler32(ds->buf, ds->size) != get_u32(header + 4) )
+    {
+        fprintf(stderr, "rdfdb: snapshot is truncated or corrupt\n");
+        ds->size = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int get_bytes(struct dump_stream *ds, void *data, size_t size)
+{
+    unsigned char *p = (unsigned char*)data;
+    size_t n;
+
+    while(size > 0)
+    {
+        if(ds->pos == ds->size && read_block(ds) != 0)
+            return -1;
+        n = ds->size - ds->pos;
+        if(n > size)
+            n = size;
+        memcpy(p, ds->buf + ds->pos, n);
+        ds->pos += n;
+        p       += n;
+        size    -= n;
+    }
+
+    return 0;
+}
+
+static int get_varint(struct dump_stream *ds, nid_t *value)
+{
+    unsigned long long v = 0;
+    unsigned char byte;
+    int shift;
+
+    for(shift = 0; shift < 64; shift += 7)
+    {
+        if(ds->pos == ds->size && read_block(ds) != 0)
+            return -1;
+        byte = ds->buf[ds->pos++];
+        v |= (unsigned long long)(byte & 127) << shift;
+        if(!(byte & 128))
+        {
+            *value = (nid_t)v;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Reads `count' strings, which remain valid until the next call. */
+static int get_strings( struct dump_stream *ds, int count,
+                        const char **text, size_t *sizes )
+{
+    size_t offsets[3], used = 0, size;
+    char *buf;
+    nid_t len;
+    int n;
+
+    for(n = 0; n < count; ++n)
+    {
+        if(get_varint(ds, &len) != 0 || len < 0)
+            return -1;
+        if(len == 0)
+        {
+            offsets[n] = (size_t)-1;
+            continue;
+        }
+
+        /* Stored with a terminating zero instead of the extra byte */
+        if(used + (size_t)len > ds->text_size)
+        {
+            size = 2*ds->text_size;
+            if(size < used + (size_t)len)
+                size = used + (size_t)len;
+            if((buf = (char*)realloc(ds->text, size)) == NULL)
+                return -1;
+            ds->text      = buf;
+            ds->text_size = size;
+        }
+        if(get_bytes(ds, ds->text + used, (size_t)len - 1) != 0)
+            return -1;
+        ds->text[used + len - 1] = '\0';
+        offsets[n] = used;
+        sizes[n]   = (size_t)len - 1;
+        used      += (size_t)len;
+    }
+
+    for(n = 0; n < count; ++n)
+        text[n] = (offsets[n] == (size_t)-1) ? NULL : ds->text + offsets[n];
+
+    return 0;
+}
+
+/* Reads a triple, relative to the previous one, which it replaces.
+   Returns 1, 0 at the end of the triples, or -1 on error. */
+static int get_triple(struct dump_stream *ds, nid_t *triple)
+{
+    nid_t values[3];
+    int n;
+
+    if(get_varint(ds, &values[0]) != 0)
+        return -1;
+    if(values[0] == 0)
+        return 0;
+    for(n = 1; n < 3; ++n)
+        if(get_varint(ds, &values[n]) != 0)
+            return -1;
+
+    values[1] += (values[0] == 1) ? triple[1] : 0;
+    values[2] += (values[0] == 1 && values[1] == triple[1]) ? triple[2] : 0;
+    triple[0] += values[0] - 1;
+    triple[1]  = values[1];
+    triple[2]  = values[2];
+
+    return 1;
+}
+
+/* Inserts a node (kind 0) or a literal (kind 1) while bulk loading; the
+   strings are the URI, or the data, type and language. */
+static int bulk_term(db_t db, int kind, nid_t id, const char **text)
+{
+    int n = (kind == 0) ? SQL_INSERT_NODE : SQL_INSERT_LITERAL;
+    int columns = (kind == 0) ? 1 : 3, i;
+    sqlite3_stmt *stmt = db->stmts[n];
+
+    if(!db->bulk || db->bulk_triples > 0 || id <= 0)
+        return -1;
+
+    sqlite3_bind_int64(stmt, 1, id);
+    for(i = 0; i < columns; ++i)
+    {
+        if(text[i] == NULL)
+            sqlite3_bind_null(stmt, i + 2);
+        else
+            sqlite3_bind_text(stmt, i + 2, text[i], -1, SQLITE_STATIC);
+    }
+    if(exec_stmt(db, n) != 0)
+        return -1;
+
+    if(id > db->bulk_max_id)
+        db->bulk_max_id = id;
+    return 0;
+}
+
+/* Adds the nodes (kind 0) or literals (kind 1) of a snapshot. Returns
+   the number of terms, or -1 on error. */
+static nid_t restore_terms(db_t db, struct dump_stream *ds, int kind)
+{
+    const char *text[3];
+    size_t sizes[3];
+    nid_t delta, id = 0, count = 0;
+
+    while(get_varint(ds, &delta) == 0)
+    {
+        if(delta == 0)
+            return count;
+        id += delta;
+
+        if( get_strings(ds, (kind == 0) ? 1 : 3, text, sizes) != 0 ||
+            bulk_term(db, kind, id, text) != 0 )
+            break;
+        ++count;
     }
 
     return -1;
 }
 
-int rdf_drop( db_t db,
-                 const char *subj_uri,
-                 const char *pred_uri,
-                 const char *obj_lexical,
-                 const char *obj_type,
-                 const char *obj_lang )
+/* Adds the triples of a snapshot. Returns the number of triples, or -1
+   on error. */
+static nid_t restore_triples(db_t db, struct dump_stream *ds)
+{
+    nid_t triple[3] = { 0, 0, 0 }, count = 0;
+    int result;
+
+    while((result = get_triple(ds, triple)) > 0)
+    {
+        if(rdf_bulk_triple(db, triple[0], triple[1], triple[2]) != 0)
+            return -1;
+        ++count;
+    }
+
+    return (result == 0) ? count : -1;
+}
+
+/*
+ * API implementation
+ */
+
+db_t rdf_db_open(const char *filepath)
+{
+    return rdf_db_open_flags(filepath, 0);
+}
+
+db_t rdf_db_open_flags(const char *filepath, int flags)
+{
+    struct rdf_options options;
+
+    rdf_db_options(&options, RDF_PROFILE_DEFAULT);
+    options.flags = flags;
+
+    return rdf_db_open_ex(filepath, &options);
+}
+
+int rdf_db_options(struct rdf_options *options, int profile)
+{
+    memset(options, 0, sizeof(struct rdf_options));
+
+    switch(profile)
+    {
+    case RDF_PROFILE_DEFAULT:
+        break;
+
+    case RDF_PROFILE_BULK_LOAD:
+        options->cache_size  = (long long)1 << 30;
+        options->journal     = RDF_JOURNAL_MEMORY;
+        options->synchronous = RDF_SYNC_OFF;
+        options->term_cache  = (size_t)64 << 20;
+        options->autocommit  = 100000;
+        break;
+
+    case RDF_PROFILE_OLTP:
+        options->cache_size  = (long long)64 << 20;
+        options->mmap_size   = (long long)256 << 20;
+        options->journal     = RDF_JOURNAL_WAL;
+        options->synchronous = RDF_SYNC_NORMAL;
+        break;
+
+    case RDF_PROFILE_READ_REPLICA:
+        options->flags       = RDF_OPEN_READONLY | RDF_OPEN_WAL;
+        options->cache_size  = (long long)1 << 30;
+        options->mmap_size   = (long long)64 << 30;
+        options->term_cache  = (size_t)64 << 20;
+        break;
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Returns the auto_vacuum mode of the database, or -1 on error. */
+static int auto_vacuum(db_t db)
+{
+    sqlite3_stmt *stmt;
+    int mode = -1;
+
+    if(sqlite3_prepare_v2(db->db, "PRAGMA auto_vacuum", -1, &stmt, NULL) == SQLITE_OK)
+    {
+        if(sqlite3_step(stmt) == SQLITE_ROW)
+            mode = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return mode;
+}
+
+/* Runs a PRAGMA statement with an argument; returns 0 or -1. */
+static int set_pragma(db_t db, const char *name, const char *value)
+{
+    char sql[64];
+
+    sprintf(sql, "PRAGMA %s=%s", name, value);
+    if(sqlite3_exec(db->db, sql, NULL, NULL, NULL) != SQLITE_OK)
+    {
+        fprintf( stderr, "rdfdb: unable to set %s to %s: %s\n",
+                         name, value, sqlite3_errmsg(db->db) );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Applies the cache, memory-mapping and durability options to a newly
+   opened connection. Returns 0, or -1 on error. */
+static int apply_options(db_t db, const struct rdf_options *options)
+{
+    static const char * const journal_modes[] = {
+        NULL, "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL" };
+    static const char * const sync_levels[] = {
+        NULL, "OFF", "NORMAL", "FULL" };
+    char value[32];
+
+    if(options->cache_size > 0)
+    {
+        /* Negative sizes are in KiB rather than pages. */
+        sprintf(value, "%lld", -(options->cache_size >> 10));
+        if(set_pragma(db, "cache_size", value) != 0)
+            return -1;
+    }
+    if(options->mmap_size > 0)
+    {
+        sprintf(value, "%lld", options->mmap_size);
+        if(set_pragma(db, "mmap_size", value) != 0)
+            return -1;
+    }
+    if( options->journal != RDF_JOURNAL_DEFAULT &&
+        !(options->flags & RDF_OPEN_READONLY) &&
+        set_pragma(db, "journal_mode", journal_modes[options->journal]) != 0 )
+        return -1;
+    if( options->synchronous != RDF_SYNC_DEFAULT &&
+        set_pragma(db, "synchronous", sync_levels[options->synchronous]) != 0 )
+        return -1;
+
+    return 0;
+}
+
+db_t rdf_db_open_ex(const char *filepath, const struct rdf_options *options)
+{
+    struct rdf_options defaults;
+    db_t db;
+    int n, mode, flags;
+
+    if(options == NULL)
+    {
+        rdf_db_options(&defaults, RDF_PROFILE_DEFAULT);
+        options = &defaults;
+    }
+    if( options->journal < RDF_JOURNAL_DEFAULT ||
+        options->journal > RDF_JOURNAL_WAL ||
+        options->synchronous < RDF_SYNC_DEFAULT ||
+        options->synchronous > RDF_SYNC_FULL ||
+        options->cache_size < 0 || options->mmap_size < 0 ||
+        options->autocommit < 0 )
+    {
+        fprintf(stderr, "rdfdb: invalid options for %s\n", filepath);
+        return NULL;
+    }
+    flags = options->flags;
+    if(options->journal == RDF_JOURNAL_WAL)
+        flags |= RDF_OPEN_WAL;
+    if(flags & RDF_OPEN_MMAP)
+        flags = RDF_OPEN_MMAP;
+
+    /* Allocate handle */
+    if((db = (db_t)malloc(sizeof(struct db))) == NULL)
+        return NULL;
+    memset(db, 0, sizeof(struct db));
+
+    /* Create term cache */
+    if((db->cache = tc_create( options->term_cache > 0
+                               ? options->term_cache : TERM_CACHE_SIZE )) == NULL)
+    {
+        free(db);
+        return NULL;
+    }
+
+    /* Reads from a mapped store bypass SQLite. Its connection is to an
+       empty database in memory, made query-only below, so that writes
+       and SQL queries fail or find nothing. */
+    if(flags & RDF_OPEN_MMAP)
+    {
+        if((db->mm = mm_open(filepath)) == NULL)
+        {
+            rdf_db_close(db);
+            return NULL;
+        }
+        filepath = ":memory:";
+    }
+
+    /* Open database. A handle is used by one thread at a time, so the
+       connection needs no locking of its own. */
+    mode = SQLITE_OPEN_NOMUTEX | ((flags & RDF_OPEN_READONLY)
+         ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE));
+    if(sqlite3_open_v2(filepath, &db->db, mode, NULL) != SQLITE_OK)
+    {
+        rdf_db_close(db);
+        return NULL;
+    }
+
+    /* Free pages are reclaimed by rdf_gc(). This takes effect when the
+       database is created, or else at its next VACUUM (see rdf_purge()),
+       and must precede the switch to WAL mode, which writes the header.
+       Setting it commits a change even if it is set already, which would
+       make other handles drop their Bloom filters (see filter_has()). */
+    if(!(flags & RDF_OPEN_READONLY) && auto_vacuum(db) != 2)
+        sqlite3_exec(db->db, "PRAGMA auto_vacuum=INCREMENTAL", NULL, NULL, NULL);
+
+    if(flags & RDF_OPEN_WAL)
+    {
+        /* The journal mode is stored in the database, so read-only
+           handles find it set already. */
+        if(!(flags & RDF_OPEN_READONLY))
+            sqlite3_exec(db->db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+        sqlite3_busy_timeout(db->db, BUSY_TIMEOUT);
+    }
+    if(apply_options(db, options) != 0)
+    {
+        rdf_db_close(db);
+        return NULL;
+    }
+
+    /* Create database structure */
+    if(!(flags & RDF_OPEN_READONLY))
+        sqlite3_exec(db->db, creation_script, NULL, NULL, NULL);
+    if(detect_indexes(db) != 0)
+    {
+        rdf_db_close(db);
+        return NULL;
+    }
+    if( !(flags & RDF_OPEN_READONLY) &&
+        db->indexes == RDF_INDEX_SPO && count_triples(db) == 0 )
+    {
+        /* New database; create default indices right away. */
+        build_indexes(db, RDF_INDEX_DEFAULT);
+    }
+
+    /* Prepare statements */
+    for(n = 0; n < STATEMENTS; ++n)
+    {
+        if(sqlite3_prepare_v2(db->db, statements[n], -1, &db->stmts[n], NULL) != SQLITE_OK)
+        {
+            fprintf( stderr, "rdfdb: INTERNAL ERROR -- "
+                             "unable to prepare statement \"%s\"\n", statements[n] );
+            rdf_db_close(db);
+            return NULL;
+        }
+    }
+
+    db->empty.db     = db;
+    db->empty.shared = 1;
+    db->empty.find   = -1;
+    for(n = 0; n < FIND_STATEMENTS; ++n)
+    {
+        db->finds[n].db     = db;
+        db->finds[n].shared = 1;
+        db->finds[n].find   = n;
+    }
+    if(prepare_finds(db) != 0)
+    {
+        rdf_db_close(db);
+        return NULL;
+    }
+    check_stats(db);
+
+    /* Load or build the Bloom filter */
+    if(flags & (RDF_OPEN_BLOOM | RDF_OPEN_BLOOM_SAVE))
+    {
+        db->filter_flags = flags & (RDF_OPEN_BLOOM | RDF_OPEN_BLOOM_SAVE);
+        db->filter_save  = (flags & RDF_OPEN_BLOOM_SAVE) &&
+                           !(flags & RDF_OPEN_READONLY);
+        if(open_filter(db) != 0)
+        {
+            rdf_db_close(db);
+            return NULL;
+        }
+    }
+
+    /* Seed identifier allocator */
+    if(seed_ids(db) != 0)
+    {
+        rdf_db_close(db);
+        return NULL;
+    }
+    db->batch_size = options->autocommit;
+
+    if(db->mm != NULL)
+    {
+        db->stats = 0;
+        sqlite3_exec(db->db, "PRAGMA query_only=1", NULL, NULL, NULL);
+    }
+
+    return db;
+}
+
+int rdf_mmap_build(db_t db, const char *path)
+{
+    static const char * const queries[3] = {
+        "SELECT id, uri, NULL, NULL FROM Node",
+        "SELECT id, data, type, language FROM Literal",
+        "SELECT subject, predicate, object FROM Triple" };
+    sqlite3_stmt *stmt;
+    mm_builder_t b;
+    const char *text;
+    int n, result = 0;
+
+    if(db->mm != NULL || (b = mm_builder_create()) == NULL)
+        return -1;
+
+    /* Read everything in one transaction, for a consistent snapshot. */
+    if(!db->batch && begin(db) != 0)
+    {
+        mm_builder_destroy(b);
+        return -1;
+    }
+    for(n = 0; n < 3 && result == 0; ++n)
+    {
+        if(sqlite3_prepare_v2(db->db, queries[n], -1, &stmt, NULL) != SQLITE_OK)
+        {
+            result = -1;
+            break;
+        }
+        while(result == 0 && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            if(n == 2)
+                result = mm_builder_triple( b, sqlite3_column_int64(stmt, 0),
+                                               sqlite3_column_int64(stmt, 1),
+                                               sqlite3_column_int64(stmt, 2) );
+            else
+            if((text = (const char*)sqlite3_column_text(stmt, 1)) != NULL)
+                result = mm_builder_term( b, sqlite3_column_int64(stmt, 0), text,
+                             (const char*)sqlite3_column_text(stmt, 2),
+                             (const char*)sqlite3_column_text(stmt, 3) );
+        }
+        if(sqlite3_finalize(stmt) != SQLITE_OK)
+            result = -1;
+    }
+    if(!db->batch)
+        exec_stmt(db, SQL_COMMIT);
+
+    if(result == 0)
+        result = mm_builder_write(b, path);
+    mm_builder_destroy(b);
+
+    return result;
+}
+
+int rdf_dump(db_t db, FILE *fp)
+{
+    static const char * const queries[3] = {
+        "SELECT id, uri FROM Node ORDER BY id",
+        "SELECT id, data, type, language FROM Literal ORDER BY id",
+        "SELECT subject, predicate, object FROM Triple"
+        " ORDER BY subject, predicate, object" };
+    struct dump_stream ds;
+    sqlite3_stmt *stmt;
+    nid_t counts[3] = { 0, 0, 0 }, prev[3], triple[3];
+    int n, i, result = 0;
+
+    if(db->mm != NULL)
+        return -1;
+
+    memset(&ds, 0, sizeof(ds));
+    ds.fp = fp;
+    if((ds.buf = (unsigned char*)malloc(DUMP_BLOCK)) == NULL)
+        return -1;
+
+    /* Read everything in one transaction, for a consistent snapshot. */
+    if( !db->batch &&
+        sqlite3_exec(db->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK )
+    {
+        free(ds.buf);
+        return -1;
+    }
+
+    if(fwrite(DUMP_MAGIC, 1, 8, fp) != 8)
+        result = -1;
+    for(n = 0; n < 3 && result == 0; ++n)
+    {
+        if(sqlite3_prepare_v2(db->db, queries[n], -1, &stmt, NULL) != SQLITE_OK)
+        {
+            result = -1;
+            break;
+        }
+        prev[0] = prev[1] = prev[2] = 0;
+        while(result == 0 && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            ++counts[n];
+            if(n == 2)
+            {
+                for(i = 0; i < 3; ++i)
+                    triple[i] = sqlite3_column_int64(stmt, i);
+                result = put_triple(&ds, prev, triple);
+                continue;
+            }
+
+            triple[0] = sqlite3_column_int64(stmt, 0);
+            result    = put_varint(&ds, triple[0] - prev[0]);
+            prev[0]   = triple[0];
+            for(i = 1; i < sqlite3_column_count(stmt) && result == 0; ++i)
+                result = put_string( &ds,
+                             (const char*)sqlite3_column_text(stmt, i),
+                             sqlite3_column_bytes(stmt, i) );
+        }
+        if(sqlite3_finalize(stmt) != SQLITE_OK)
+            result = -1;
+        if(result == 0)
+            result = put_varint(&ds, 0);
+    }
+    for(n = 0; n < 3 && result == 0; ++n)
+        result = put_varint(&ds, counts[n]);
+    if(result == 0)
+        result = flush_block(&ds);
+
+    if(!db->batch)
+        sqlite3_exec(db->db, "COMMIT", NULL, NULL, NULL);
+    free(ds.buf);
+
+    return result;
+}
+
+int rdf_restore(db_t db, FILE *fp)
+{
+    struct dump_stream ds;
+    nid_t counts[3], count;
+    char magic[8];
+    int n, result = 0;
+
+    memset(&ds, 0, sizeof(ds));
+    ds.fp = fp;
+    if((ds.buf = (unsigned char*)malloc(DUMP_BLOCK)) == NULL)
+        return -1;
+    if(fread(magic, 1, 8, fp) != 8 || memcmp(magic, DUMP_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "rdfdb: not a snapshot\n");
+        free(ds.buf);
+        return -1;
+    }
+    if(rdf_bulk_begin(db) != 0)
+    {
+        free(ds.buf);
+        return -1;
+    }
+
+    for(n = 0; n < 2 && result == 0; ++n)
+        if((counts[n] = restore_terms(db, &ds, n)) < 0)
+            result = -1;
+    if(result == 0 && (counts[2] = restore_triples(db, &ds)) < 0)
+        result = -1;
+    for(n = 0; n < 3 && result == 0; ++n)
+        if(get_varint(&ds, &count) != 0 || count != counts[n])
+            result = -1;
+    if(result == 0 && ds.pos != ds.size)
+        result = -1;
+
+    if(rdf_bulk_end(db, result == 0) != 0)
+        result = -1;
+
+    free(ds.buf);
+    free(ds.text);
+
+    return result;
+}
+
+int rdf_bulk_begin(db_t db)
+{
+    static const char * const empty_query =
+        "SELECT EXISTS (SELECT 1 FROM Node) OR EXISTS (SELECT 1 FROM Literal)"
+        "    OR EXISTS (SELECT 1 FROM Triple)";
+    sqlite3_stmt *stmt;
+    int result = -1;
+
+    if(db->mm != NULL || db->batch || db->bulk || finds_busy(db))
+        return -1;
+
+    if(begin(db) != 0)
+        return -1;
+    if( clear_saved_filter(db) == 0 &&
+        sqlite3_prepare_v2(db->db, empty_query, -1, &stmt, NULL) == SQLITE_OK )
+    {
+        if(sqlite3_step(stmt) == SQLITE_ROW && !sqlite3_column_int(stmt, 0))
+            result = 0;
+        sqlite3_finalize(stmt);
+    }
+
+    /* Building the indices afterwards, by sorting, is faster than
+       updating them row by row, even if the rows come in order. */
+    db->bulk_indexes = db->indexes;
+    if( result == 0 &&
+        ( sqlite3_exec(db->db, bulk_script, NULL, NULL, NULL) != SQLITE_OK ||
+          drop_indexes(db, db->indexes) != 0 ) )
+        result = -1;
+
+    if(result != 0)
+    {
+        db->indexes = db->bulk_indexes;
+        rollback(db);
+        return -1;
+    }
+
+    /* Added terms and triples are not in the filter until the end. */
+    drop_filter(db);
+
+    db->bulk         = 1;
+    db->bulk_max_id  = 0;
+    db->bulk_triples = 0;
+    return 0;
+}
+
+int rdf_bulk_term( db_t db, nid_t id, const char *lexical,
+                   const char *type, const char *lang )
+{
+    const char *text[3];
+
+    text[0] = lexical;
+    text[1] = type;
+    text[2] = lang;
+
+    return bulk_term(db, (type == NULL) ? 0 : 1, id, text);
+}
+
+int rdf_bulk_triple(db_t db, nid_t subj, nid_t pred, nid_t obj)
+{
+    sqlite3_stmt *stmt = db->stmts[SQL_INSERT_TRIPLE];
+
+    if(!db->bulk)
+        return -1;
+
+    /* Triples are numbered after the terms. */
+    sqlite3_bind_int64(stmt, 1, db->bulk_max_id + db->bulk_triples + 1);
+    sqlite3_bind_int64(stmt, 2, subj);
+    sqlite3_bind_int64(stmt, 3, pred);
+    sqlite3_bind_int64(stmt, 4, obj);
+    if(exec_stmt(db, SQL_INSERT_TRIPLE) != 0)
+        return -1;
+
+    ++db->bulk_triples;
+    return 0;
+}
+
+int rdf_bulk_end(db_t db, int success)
+{
+    int result = success ? 0 : -1;
+
+    if(!db->bulk)
+        return -1;
+    db->bulk = 0;
+
+    if( result == 0 &&
+        ( sqlite3_exec(db->db, creation_script, NULL, NULL, NULL) != SQLITE_OK ||
+          build_indexes(db, db->bulk_indexes) != 0 ||
+          (db->stats && build_stats(db, HISTOGRAM_SIZE) != 0) ) )
+        result = -1;
+
+    if(result == 0)
+        result = commit(db);
+    if(result == 0)
+        db->histogram = db->stats;
+    else
+    {
+        db->indexes = db->bulk_indexes;
+        rollback(db);
+    }
+
+    /* Identifiers are allocated after the new ones, and the find
+       statements may refer to indices that were dropped. */
+    db->id_next = 0;
+    tc_clear(db->cache);
+    if(prepare_finds(db) != 0)
+        result = -1;
+    if(db->filter_flags)
+        build_filter(db);
+
+    return result;
+}
+
+int rdf_db_initialize(db_t db)
+{
+    if(rdf_db_set_indexes(db, db->indexes | RDF_INDEX_DEFAULT) != 0)
+        return -1;
+
+    return db->stats ? 0 : rdf_rebuild_stats(db, HISTOGRAM_SIZE);
+}
+
+int rdf_db_indexes(db_t db)
+{
+    return db->indexes & ~INDEX_PO;
+}
+
+int rdf_db_set_indexes(db_t db, int flags)
+{
+    int result;
+
+    /* The find statements cannot be prepared again while an iterator
+       uses one; check that before changing any index. */
+    if(finds_busy(db))
+        return -1;
+
+    /* The index on (predicate, object) is superseded by Triple_pos. */
+    flags |= RDF_INDEX_SPO;
+    if(flags & RDF_INDEX_POS)
+        flags &= ~INDEX_PO;
+    else
+        flags |= db->indexes & INDEX_PO;
+
+    result = build_indexes(db, flags);
+    if(result == 0)
+        result = drop_indexes(db, ~flags);
+    if(prepare_finds(db) != 0)
+        result = -1;
+
+    if(db->stats && !STATS_INDEXES(db->indexes))
+    {
+        /* Statistics can no longer be maintained; discard them. */
+        sqlite3_exec( db->db, "DELETE FROM Statistics; DELETE FROM Histogram;",
+                      NULL, NULL, NULL );
+        discard_stats(db);
+        db->stats = 0;
+    }
+
+    return result;
+}
+
+void rdf_db_close(db_t db)
+{
+    int n;
+
+    save_filter(db);
+
+    /* Clean up prepared statements */
+    for(n = 0; n < STATEMENTS; ++n)
+        if(db->stmts[n] != NULL)
+            sqlite3_finalize(db->stmts[n]);
+    for(n = 0; n < FIND_STATEMENTS; ++n)
+    {
+        if(db->finds[n].stmt != NULL)
+            sqlite3_finalize(db->finds[n].stmt);
+        pclear(&db->finds[n].pool);
+    }
+    free_spares(db);
+    for(n = 0; n < FIND_SHAPES; ++n)
+        if(db->counts[n] != NULL)
+            sqlite3_finalize(db->counts[n]);
+    if(db->decode != NULL)
+        sqlite3_finalize(db->decode);
+    for(n = 0; n < GC_STATEMENTS; ++n)
+        if(db->gc[n] != NULL)
+            sqlite3_finalize(db->gc[n]);
+    if(db->data_version != NULL)
+        sqlite3_finalize(db->data_version);
+    if(db->clear_filter != NULL)
+        sqlite3_finalize(db->clear_filter);
+
+    /* Close database */
+    sqlite3_close(db->db);
+    if(db->mm != NULL)
+        mm_close(db->mm);
+    free(db->mm_term.data);
+
+    /* Destroy term cache and filter */
+    tc_destroy(db->cache);
+    drop_filter(db);
+    free(db->term);
+    free(db->offsets);
+
+    /* Deallocate handle */
+    free(db);
+}
+
+char *rdf_anon_uri(db_t db)
+{
+    nid_t id;
+    sqlite3_stmt *stmt;
+    char uri[32];
+    char key[TERM_KEY_MAX];
+    size_t key_len;
+    char *result = NULL;
+
+    /* Clearing the saved Bloom filter must be part of the same transaction
+       as the insert, as in rdf_insert(). */
+    if(!db->batch && begin(db) != 0)
+        return NULL;
+
+    /* Allocate node identifier for anonymous resource */
+    if(clear_saved_filter(db) == 0 && (id = next_id(db)))
+    {
+        /* Create URI */
+        sprintf(uri, "_:%lld", id);
+
+        /* Insert new anonymous node */
+        stmt = db->stmts[SQL_INSERT_NODE];
+        sqlite3_bind_int64(stmt, 1, id);
+        sqlite3_bind_text(stmt, 2, uri, -1, SQLITE_STATIC);
+        if(step(db, SQL_INSERT_NODE) == SQLITE_DONE)
+            result = strdup(uri);
+        sqlite3_reset(stmt);
+
+        if(result && (key_len = uri_key(key, uri)))
+            tc_insert(db->cache, key, key_len, id);
+        if(result && db->filter != NULL)
+            filter_add(db, uri_hash(uri));
+    }
+
+    if(!db->batch)
+    {
+        if(result == NULL || commit(db) != 0)
+        {
+            rollback(db);
+            free(result);
+            result = NULL;
+        }
+    }
+
+    return result;
+}
+
+int rdf_insert( db_t db,
+                const char *subj_uri,
+                const char *pred_uri,
+                const char *obj_lexical,
+                const char *obj_type,
+                const char *obj_lang )
+{
+    nid_t subj_id, pred_id, obj_id;
+    int result = -1;
+
+    /* Run all lookups and inserts for this triple in a single transaction,
+       unless the caller already opened one with rdf_begin(). */
+    if(!db->batch && begin(db) != 0)
+        return -1;
+
+    subj_id = uri_to_id(db, subj_uri);
+    pred_id = uri_to_id(db, pred_uri);
+    if(obj_type == NULL)
+    {
+        /* Object is a resource */
+        obj_id = uri_to_id(db, obj_lexical);
+    }
+    else
+    {
+        /* Object is a literal */
+        obj_id = lit_to_id(db, obj_lexical, obj_type, obj_lang);
+    }
+
+    if( subj_id && pred_id && obj_id &&
+        tri_to_id(db, subj_id, pred_id, obj_id) )
+    {
+        result = 0;
+    }
+
+    if(!db->batch)
+    {
+        /* Implicit transaction; commit or roll back immediately. */
+        if(result == 0)
+            result = commit(db);
+        if(result != 0)
+            rollback(db);
+    }
+    else
+    if(result == 0 && db->batch_size > 0 && ++db->batch_count >= db->batch_size)
+    {
+        /* Batch is full; commit it and continue in a new transaction. */
+        db->batch_count = 0;
+        if(commit(db) != 0)
+        {
+            rollback(db);
+            db->batch = 0;
+            result = -1;
+        }
+        else
+        if(begin(db) != 0)
+        {
+            db->batch = 0;
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+int rdf_begin(db_t db)
+{
+    if(db->batch || begin(db) != 0)
+        return -1;
+
+    db->batch       = 1;
+    db->batch_count = 0;
+    return 0;
+}
+
+int rdf_commit(db_t db)
+{
+    if(!db->batch)
+        return -1;
+
+    db->batch = 0;
+    if(commit(db) != 0)
+    {
+        rollback(db);
+        return -1;
+    }
+    return 0;
+}
+
+int rdf_rollback(db_t db)
+{
+    if(!db->batch)
+        return -1;
+
+    db->batch = 0;
+    return rollback(db);
+}
+
+int rdf_in_batch(db_t db)
+{
+    return db->batch;
+}
+
+void rdf_autocommit(db_t db, long long count)
+{
+    db->batch_size = (count > 0) ? count : 0;
+}
+
+void rdf_cache_size(db_t db, size_t bytes)
+{
+    tc_resize(db->cache, bytes);
+}
+
+void rdf_cache_stats(db_t db, long long *hits, long long *misses)
+{
+    tc_stats(db->cache, hits, misses, NULL, NULL);
+}
+
+void rdf_cache_clear(db_t db)
+{
+    tc_clear(db->cache);
+}
+
+int rdf_reserve_ids(db_t db, long long count)
+{
+    db->id_reserve = (count > 0) ? count : 0;
+    return seed_ids(db);
+}
+
+int rdf_filter_rebuild(db_t db)
+{
+    if(!db->filter_flags || db->bulk)
+        return -1;
+
+    return build_filter(db);
+}
+
+int rdf_drop( db_t db,
+                 const char *subj_uri,
+                 const char *pred_uri,
+                 const char *obj_lexical,
+                 const char *obj_type,
+                 const char *obj_lang )
+{
+    int result = 0;
+    nid_t subj_id, pred_id, obj_id;
+
+    if(!subj_uri || !pred_uri || !obj_lexical)
+        return -1;
+
+    /* Terms are looked up in the transaction, which checks that cached
+       identifiers are still valid; statistics are updated in it too. */
+    if(!db->batch && begin(db) != 0)
+        return -1;
+
+    /* If any of the terms does not exist, neither does the triple. */
+    if( (subj_id = find_uri_id(db, subj_uri)) &&
+        (pred_id = find_uri_id(db, pred_uri)) &&
+        (obj_id  = find_obj_id(db, obj_lexical, obj_type, obj_lang)) &&
+        (db->filter == NULL || filter_has(db, tri_hash(subj_id, pred_id, obj_id))) )
+    {
+        sqlite3_stmt *stmt = db->stmts[SQL_DROP_TRIPLE];
+
+        sqlite3_bind_int64(stmt, 1, subj_id);
+        sqlite3_bind_int64(stmt, 2, pred_id);
+        sqlite3_bind_int64(stmt, 3, obj_id);
+        if(step(db, SQL_DROP_TRIPLE) != SQLITE_DONE)
+            result = -1;
+        sqlite3_reset(stmt);
+
+        if( result == 0 && sqlite3_changes(db->db) > 0 &&
+            ( count_triple(db, subj_id, pred_id, obj_id, -1) != 0 ||
+              add_candidate(db, subj_id) != 0 ||
+              add_candidate(db, pred_id) != 0 ||
+              add_candidate(db, obj_id) != 0 ) )
+            result = -1;
+    }
+
+    if(!db->batch)
+    {
+        if(result == 0)
+            result = commit(db);
+        if(result != 0)
+            rollback(db);
+    }
+
+    return result;
+}
+
+int rdf_exists( db_t db,
+                const char *subj_uri,
+                const char *pred_uri,
+                const char *obj_lexical,
+                const char *obj_type,
+                const char *obj_lang )
+{
+    rdf_it_t it;
+    int result = -1, own;
+
+    /* Look up the terms and the triple in a single read transaction,
+       rather than each in a transaction of its own. This also makes it
+       cheap to check that the filter is up to date (see filter_has()). */
+    own = db->mm == NULL && sqlite3_get_autocommit(db->db);
+    if(own && exec_stmt(db, SQL_BEGIN_READ) != 0)
+        return -1;
+    if(own)
+        check_cache(db);
+
+    it = rdf_find(db, subj_uri, pred_uri, obj_lexical, obj_type, obj_lang);
+    if(it != NULL)
+    {
+        result = rdf_next(it, NULL, NULL, NULL, NULL, NULL);
+        if(result > 0)
+            rdf_cancel(it);
+    }
+
+    if(own)
+        exec_stmt(db, SQL_COMMIT);
+    return result;
+}
+
+rdf_it_t rdf_find( db_t db,
+                   const char *subj_uri,
+                   const char *pred_uri,
+                   const char *obj_lexical,
+                   const char *obj_type,
+                   const char *obj_lang )
+{
+    rdf_it_t it;
+    nid_t subj_id = 0, pred_id = 0, obj_id = 0;
+    int shape;
+
+    /* Transactions check the cache when they start (see begin()). */
+    if(sqlite3_get_autocommit(db->db))
+        check_cache(db);
+
+    if( (subj_uri && (subj_id = find_uri_id(db, subj_uri)) == 0) ||
+        (pred_uri && (pred_id = find_uri_id(db, pred_uri)) == 0) ||
+        (obj_lexical && (obj_id = find_obj_id(
+            db, obj_lexical, obj_type, obj_lang)) == 0) )
+    {
+        /* A term does not exist, so no triples match. */
+        return &db->empty;
+    }
+
+    shape = (subj_id ? 1 : 0) | (pred_id ? 2 : 0) | (obj_id ? 4 : 0);
+    if( shape == 7 && db->filter != NULL &&
+        !filter_has(db, tri_hash(subj_id, pred_id, obj_id)) )
+        return &db->empty;
+    if(db->mm != NULL)
+        return open_mapped(db, shape, subj_id, pred_id, obj_id);
+    if((it = open_find(db, shape)) == NULL)
+        return NULL;
+
+    if(subj_id)
+        sqlite3_bind_int64(it->stmt, 1, subj_id);
+    if(pred_id)
+        sqlite3_bind_int64(it->stmt, 2, pred_id);
+    if(obj_id)
+        sqlite3_bind_int64(it->stmt, 3, obj_id);
+
+    return it;
+}
+
+int rdf_next( rdf_it_t it,
+              const char **subj_uri,
+              const char **pred_uri,
+              const char **obj_lexical,
+              const char **obj_type,
+              const char **obj_lang )
+{
+    sqlite3_stmt *stmt = it->stmt;
+    const char *terms[5];
+    int result;
+
+    if(it->cursor != NULL)
+    {
+        result = read_mapped( it, (subj_uri || pred_uri || obj_lexical ||
+                                   obj_type || obj_lang) ? terms : NULL );
+        if(result <= 0)
+        {
+            release_it(it);
+            return result;
+        }
+        if(subj_uri)
+            *subj_uri    = terms[0];
+        if(pred_uri)
+            *pred_uri    = terms[1];
+        if(obj_lexical)
+            *obj_lexical = terms[2];
+        if(obj_type)
+            *obj_type    = terms[3];
+        if(obj_lang)
+            *obj_lang    = terms[4];
+        return 1;
+    }
+    if(stmt == NULL)
+        return 0;
+
+    /* Attempt to get next row from statement. */
+    result = sqlite3_step(stmt);
+    if(result == SQLITE_ROW)
+    {
+        /* New row available; extract data */
+        if(subj_uri)
+            *subj_uri    = (const char*)sqlite3_column_text(stmt, 0);
+        if(pred_uri)
+            *pred_uri    = (const char*)sqlite3_column_text(stmt, 1);
+        if(obj_lexical)
+            *obj_lexical = (const char*)sqlite3_column_text(stmt, 2);
+        if(obj_type)
+            *obj_type    = (const char*)sqlite3_column_text(stmt, 3);
+        if(obj_lang)
+            *obj_lang    = (const char*)sqlite3_column_text(stmt, 4);
+
+        return 1;
+    }
+    else
+    {
+        /* End of result set, or error occured. */
+        release_it(it);
+
+        return (result == SQLITE_DONE) ? 0 : -1;
+    }
+}
+
+int rdf_next_batch(rdf_it_t it, struct rdf_batch *batch, int count)
 {
-    int result = -1;
-    nid_t subj_id, pred_id, obj_id;
+    sqlite3_stmt *stmt = it->stmt;
+    const char *text;
+    char *term;
+    size_t len;
+    int columns, rows, n, result = SQLITE_ROW;
+
+    if(stmt == NULL && it->cursor == NULL)
+        return 0;
+    if(count <= 0)
+        return -1;
 
-    if( (subj_id = uri_to_id(db, subj_uri)) &&
-        (pred_id = uri_to_id(db, pred_uri)) &&
-        (obj_id  = lit_to_id(db, obj_lexical, obj_type, obj_lang)) )
+    /* The previous call reached the end of the results. */
+    if(it->done)
+    {
+        release_it(it);
+        return 0;
+    }
+
+    /* Strings from the previous call are no longer needed. */
+    preset(&it->pool);
+
+    if(it->cursor != NULL)
+        return next_batch_mapped(it, batch, count);
+
+    columns = sqlite3_column_count(stmt);
+    for(rows = 0; rows < count; ++rows)
+    {
+        if((result = sqlite3_step(stmt)) != SQLITE_ROW)
+            break;
+
+        for(n = 0; n < columns && n < 5; ++n)
+        {
+            if(n < 3 && batch->ids[n])
+                batch->ids[n][rows] = sqlite3_column_int64(stmt, n);
+
+            if(batch->terms[n] || batch->lengths[n])
+            {
+                term = NULL;
+                len  = 0;
+                if((text = (const char*)sqlite3_column_text(stmt, n)) != NULL)
+                {
+                    len = sqlite3_column_bytes(stmt, n);
+                    if((term = (char*)palloc(&it->pool, len + 1)) == NULL)
+                    {
+                        release_it(it);
+                        return -1;
+                    }
+                    memcpy(term, text, len + 1);
+                }
+                if(batch->terms[n])
+                    batch->terms[n][rows] = term;
+                if(batch->lengths[n])
+                    batch->lengths[n][rows] = len;
+            }
+        }
+    }
+
+    if(result == SQLITE_ROW || (result == SQLITE_DONE && rows > 0))
+    {
+        /* Release the iterator on the next call, so that the strings
+           returned now remain valid until then. */
+        it->done = (result == SQLITE_DONE);
+        return rows;
+    }
+
+    release_it(it);
+    return (result == SQLITE_DONE) ? 0 : -1;
+}
+
+void rdf_cancel(rdf_it_t it)
+{
+    release_it(it);
+}
+
+nid_t rdf_term_id( db_t db,
+                   const char *lexical,
+                   const char *type,
+                   const char *lang )
+{
+    if(lexical == NULL)
+        return 0;
+    if(sqlite3_get_autocommit(db->db))
+        check_cache(db);
+
+    return find_obj_id(db, lexical, type, lang);
+}
+
+int rdf_decode_id( db_t db,
+                   nid_t id,
+                   const char **lexical,
+                   const char **type,
+                   const char **lang )
+{
+    sqlite3_stmt *stmt;
+    const char *col[3] = { NULL, NULL, NULL };
+    size_t len[3] = { 0, 0, 0 }, size;
+    int n, columns = 0, result;
+
+    if(db->mm != NULL)
+    {
+        if((result = mm_decode(db->mm, id, &db->mm_term)) <= 0)
+            return result;
+        if(lexical)
+            *lexical = db->mm_term.lexical;
+        if(type)
+            *type    = db->mm_term.type;
+        if(lang)
+            *lang    = db->mm_term.lang;
+        return 1;
+    }
+
+    /* Try nodes first, then literals */
+    stmt = db->stmts[SQL_FIND_NODE_BY_ID];
+    sqlite3_bind_int64(stmt, 1, id);
+    if((result = step(db, SQL_FIND_NODE_BY_ID)) == SQLITE_ROW)
+        columns = 1;
+    else
     {
-        sqlite3_stmt *stmt = db->stmts[SQL_DROP_TRIPLE];
-        sqlite3_bind_int64(stmt, 1, subj_id);
-        sqlite3_bind_int64(stmt, 2, pred_id);
-        sqlite3_bind_int64(stmt, 3, obj_id);
-        if(sqlite3_step(stmt) == SQLITE_DONE)
-            result = 0;
         sqlite3_reset(stmt);
+        stmt = db->stmts[SQL_FIND_LITERAL_BY_ID];
+        sqlite3_bind_int64(stmt, 1, id);
+        if((result = step(db, SQL_FIND_LITERAL_BY_ID)) == SQLITE_ROW)
+            columns = 3;
     }
 
-    return result;
+    if(columns == 0)
+    {
+        sqlite3_reset(stmt);
+        return (result == SQLITE_DONE) ? 0 : -1;
+    }
+
+    /* Copy the term into the handle's buffer, since the column values do
+       not survive resetting the statement. */
+    for(n = 0, size = 0; n < columns; ++n)
+    {
+        col[n] = (const char*)sqlite3_column_text(stmt, n);
+        len[n] = col[n] ? strlen(col[n]) + 1 : 0;
+        size  += len[n];
+    }
+    if(reserve_term(db, size) != 0)
+    {
+        sqlite3_reset(stmt);
+        return -1;
+    }
+    for(n = 0, size = 0; n < columns; ++n)
+    {
+        if(col[n] != NULL)
+            memcpy(db->term + size, col[n], len[n]);
+        col[n] = col[n] ? db->term + size : NULL;
+        size  += len[n];
+    }
+    sqlite3_reset(stmt);
+
+    if(lexical)
+        *lexical = col[0];
+    if(type)
+        *type    = col[1];
+    if(lang)
+        *lang    = col[2];
+
+    return 1;
 }
 
-int rdf_exists( db_t db,
-                const char *subj_uri,
-                const char *pred_uri,
-                const char *obj_lexical,
-                const char *obj_type,
-                const char *obj_lang )
+int rdf_decode_ids( db_t db,
+                    const nid_t *ids,
+                    int count,
+                    const char **lexical,
+                    const char **type,
+                    const char **lang )
+{
+    const char *col;
+    sqlite3_stmt *stmt;
+    size_t used = 0, len, *offsets;
+    nid_t id;
+    int i, j, n, k, result;
+
+    if(count <= 0)
+        return 0;
+    if(db->mm != NULL)
+        return decode_mapped(db, ids, count, lexical, type, lang);
+    if( (stmt = prepare_decode(db)) == NULL ||
+        (offsets = reserve_offsets(db, count)) == NULL )
+        return -1;
+
+    for(i = 0; i < count; i += DECODE_BATCH)
+    {
+        n = (count - i < DECODE_BATCH) ? count - i : DECODE_BATCH;
+        for(j = 0; j < DECODE_BATCH; ++j)
+        {
+            if(j < n)
+                sqlite3_bind_int64(stmt, j + 1, ids[i + j]);
+            else
+                sqlite3_bind_null(stmt, j + 1);
+        }
+
+        while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            id = sqlite3_column_int64(stmt, 0);
+            for(k = 0; k < 3; ++k)
+            {
+                if((col = (const char*)sqlite3_column_text(stmt, k + 1)) == NULL)
+                    continue;
+                len = strlen(col) + 1;
+                if(reserve_term(db, used + len) != 0)
+                {
+                    sqlite3_reset(stmt);
+                    return -1;
+                }
+                memcpy(db->term + used, col, len);
+
+                /* The same identifier may occur more than once. */
+                for(j = 0; j < n; ++j)
+                    if(ids[i + j] == id)
+                        offsets[3*(i + j) + k] = used;
+                used += len;
+            }
+        }
+        sqlite3_reset(stmt);
+        if(result != SQLITE_DONE)
+            return -1;
+    }
+
+    point_terms(db, count, lexical, type, lang);
+
+    return 0;
+}
+
+rdf_it_t rdf_find_ids(db_t db, nid_t subj, nid_t pred, nid_t obj)
 {
     rdf_it_t it;
+    int shape;
+
+    shape = (subj ? 1 : 0) | (pred ? 2 : 0) | (obj ? 4 : 0);
+    if(db->mm != NULL)
+        return open_mapped(db, FIND_IDS + shape, subj, pred, obj);
+    if((it = open_find(db, FIND_IDS + shape)) == NULL)
+        return NULL;
+
+    if(subj)
+        sqlite3_bind_int64(it->stmt, 1, subj);
+    if(pred)
+        sqlite3_bind_int64(it->stmt, 2, pred);
+    if(obj)
+        sqlite3_bind_int64(it->stmt, 3, obj);
+
+    return it;
+}
+
+int rdf_next_ids(rdf_it_t it, nid_t *subj, nid_t *pred, nid_t *obj)
+{
+    sqlite3_stmt *stmt = it->stmt;
     int result;
 
-    it = rdf_find(db, subj_uri, pred_uri, obj_lexical, obj_type, obj_lang);
-    if(!it)
+    if(it->cursor != NULL)
+    {
+        if(mm_next(it->cursor, subj, pred, obj))
+            return 1;
+        release_it(it);
+        return 0;
+    }
+    if(stmt == NULL)
+        return 0;
+
+    result = sqlite3_step(stmt);
+    if(result == SQLITE_ROW)
+    {
+        if(subj)
+            *subj = sqlite3_column_int64(stmt, 0);
+        if(pred)
+            *pred = sqlite3_column_int64(stmt, 1);
+        if(obj)
+            *obj  = sqlite3_column_int64(stmt, 2);
+
+        return 1;
+    }
+    else
+    {
+        release_it(it);
+
+        return (result == SQLITE_DONE) ? 0 : -1;
+    }
+}
+
+int rdf_pred_stats(db_t db, nid_t pred, struct rdf_pred_stats *stats)
+{
+    if(!db->stats || flush_stats(db) != 0)
+        return -1;
+
+    return get_stats(db, pred, stats);
+}
+
+long long rdf_object_count(db_t db, nid_t pred, nid_t obj)
+{
+    sqlite3_stmt *stmt = db->stmts[SQL_GET_HISTOGRAM];
+    long long count = -1;
+
+    if(!db->stats)
+        return -1;
+
+    sqlite3_bind_int64(stmt, 1, pred);
+    sqlite3_bind_int64(stmt, 2, obj);
+    if(step(db, SQL_GET_HISTOGRAM) == SQLITE_ROW)
+        count = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+
+    return count;
+}
+
+int rdf_rebuild_stats(db_t db, int top_k)
+{
+    int result;
+
+    if(!STATS_INDEXES(db->indexes))
+        return -1;
+
+    if(!db->batch && begin(db) != 0)
         return -1;
 
-    result = rdf_next(it, NULL, NULL, NULL, NULL, NULL);
-    if(result > 0)
-        rdf_cancel(it);
+    result = build_stats(db, top_k);
+
+    if(!db->batch)
+    {
+        if(result == 0)
+            result = commit(db);
+        if(result != 0)
+            rollback(db);
+    }
+    db->stats     = (result == 0);
+    db->histogram = (result == 0 && top_k > 0);
+
     return result;
 }
 
-rdf_it_t rdf_find( db_t db,
-                   const char *subj_uri,
-                   const char *pred_uri,
-                   const char *obj_lexical,
-                   const char *obj_type,
-                   const char *obj_lang )
+/* Estimates the size of a pattern from the statistics, assuming values
+   are distributed uniformly except for objects in the histogram. */
+static double estimate_stats(db_t db, nid_t subj, nid_t pred, nid_t obj)
+{
+    struct rdf_pred_stats stats;
+    double count;
+    long long n;
+    int found;
+
+    if((found = get_stats(db, (pred > 0) ? pred : 0, &stats)) <= 0)
+        return found;   /* predicate is not used, or error */
+
+    count = (double)stats.triples;
+    if(pred == RDF_ID_BOUND)
+    {
+        sqlite3_stmt *stmt = db->stmts[SQL_COUNT_PREDICATES];
+        if(step(db, SQL_COUNT_PREDICATES) == SQLITE_ROW &&
+           (n = sqlite3_column_int64(stmt, 0)) > 1)
+            count /= (double)n;
+        sqlite3_reset(stmt);
+    }
+    if(subj != 0 && stats.subjects > 1)
+        count /= (double)stats.subjects;
+    if( obj > 0 && pred > 0 && stats.triples > 0 &&
+        (n = rdf_object_count(db, pred, obj)) >= 0 )
+        count *= (double)n/stats.triples;
+    else
+    if(obj != 0 && stats.objects > 1)
+        count /= (double)stats.objects;
+
+    return count;
+}
+
+/* Without statistics, counts the matching triples, and the distinct values
+   in each column, over a limited sample. */
+static double estimate_sample( db_t db, nid_t subj, nid_t pred, nid_t obj,
+                               double *distinct )
 {
     sqlite3_stmt *stmt;
-    nid_t subj_id = 0, pred_id = 0, obj_id = 0;
+    char sql[512];
+    double count = -1;
+    int shape, n;
 
-    if( (subj_uri && (subj_id = uri_to_id(db, subj_uri)) == 0) ||
-        (pred_uri && (pred_id = uri_to_id(db, pred_uri)) == 0) ||
-        (obj_lexical && (obj_id = lit_to_id(
-            db, obj_lexical, obj_type, obj_lang)) == 0) )
+    shape = (subj > 0 ? 1 : 0) | (pred > 0 ? 2 : 0) | (obj > 0 ? 4 : 0);
+    if((stmt = db->counts[shape]) == NULL)
     {
-        /* Failed to allocate ids */
-        return NULL;
+        sprintf( sql, "SELECT COUNT(*), COUNT(DISTINCT subject),"
+                      " COUNT(DISTINCT predicate), COUNT(DISTINCT object)"
+                      " FROM (SELECT subject, predicate, object FROM Triple %s"
+                      " LIMIT %d)", find_conditions[shape], ESTIMATE_LIMIT );
+        if(sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+            return -1;
+        db->counts[shape] = stmt;
+    }
+
+    if(subj > 0)
+        sqlite3_bind_int64(stmt, 1, subj);
+    if(pred > 0)
+        sqlite3_bind_int64(stmt, 2, pred);
+    if(obj > 0)
+        sqlite3_bind_int64(stmt, 3, obj);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        count = (double)sqlite3_column_int64(stmt, 0);
+        for(n = 0; n < 3; ++n)
+            distinct[n] = (double)sqlite3_column_int64(stmt, n + 1);
     }
+    sqlite3_reset(stmt);
 
-    char buffer[1024] =
-        "SELECT SubjectNode.uri   AS subject_uri,"
-        "       PredicateNode.uri AS predicate_uri,"
-        "       COALESCE(ObjectNode.uri, Literal.data) AS object_lexical,"
-        "       Literal.type      AS object_type,"
-        "       Literal.language  AS object_language "
-        "FROM Triple "
-        "LEFT JOIN Node AS SubjectNode   ON SubjectNode.id   = subject "
-        "LEFT JOIN Node AS PredicateNode ON PredicateNode.id = predicate "
-        "LEFT JOIN Node AS ObjectNode    ON ObjectNode.id    = object "
-        "LEFT JOIN Literal               ON Literal.id       = object ";
+    return count;
+}
+
+double rdf_estimate(db_t db, nid_t subj, nid_t pred, nid_t obj)
+{
+    double count, distinct[3];
+    nid_t id[3];
+    int n;
 
-    if(subj_id || pred_id || obj_id)
+    if(db->mm != NULL)
     {
-        strcat(buffer, "WHERE 1 ");
-        if(subj_id)
-            sprintf(buffer + strlen(buffer), "AND subject=%lld ", subj_id);
-        if(pred_id)
-            sprintf(buffer + strlen(buffer), "AND predicate=%lld ", pred_id);
-        if(obj_id)
-            sprintf(buffer + strlen(buffer), "AND subject=%lld ", obj_id);
+        /* Mapped stores count matches exactly. */
+        count = (double)mm_count( db->mm, (subj > 0) ? subj : 0,
+                                  (pred > 0) ? pred : 0, (obj > 0) ? obj : 0 );
+        for(n = 0; n < 3; ++n)
+            distinct[n] = (double)mm_distinct(db->mm, n);
     }
+    else
+    if(db->stats && flush_stats(db) == 0)
+        return estimate_stats(db, subj, pred, obj);
+    else
+        count = estimate_sample(db, subj, pred, obj, distinct);
+
+    /* A position bound to a single value selects one of its distinct
+       values; assume these are equally frequent. */
+    id[0] = subj;
+    id[1] = pred;
+    id[2] = obj;
+    for(n = 0; n < 3 && count > 0; ++n)
+        if(id[n] == RDF_ID_BOUND && distinct[n] > 1)
+            count /= distinct[n];
+
+    return count;
+}
+
+rdf_it_t rdf_query(db_t db, const char *sql)
+{
+    rdf_it_t it;
 
-    if(sqlite3_prepare(db->db, buffer, -1, &stmt, NULL) != SQLITE_OK)
+    if((it = (rdf_it_t)malloc(sizeof(struct rdf_it))) == NULL)
+        return NULL;
+    memset(it, 0, sizeof(struct rdf_it));
+    it->db     = db;
+    it->shared = 0;
+    it->busy   = 1;
+    it->find   = -1;
+    if(sqlite3_prepare_v2(db->db, sql, -1, &it->stmt, NULL) != SQLITE_OK)
     {
-        fprintf( stderr, "rdfdb: INTERNAL ERROR -- "
-                         "unable to prepare statement \"%s\"\n", buffer );
+        fprintf( stderr, "rdfdb: unable to prepare query \"%s\": %s\n",
+                         sql, sqlite3_errmsg(db->db) );
+        sqlite3_finalize(it->stmt);
+        free(it);
         return NULL;
     }
 
-    return stmt;
+    return it;
 }
 
-int rdf_next( rdf_it_t it,
-              const char **subj_uri,
-              const char **pred_uri,
-              const char **obj_lexical,
-              const char **obj_type,
-              const char **obj_lang )
+int rdf_columns(rdf_it_t it)
 {
-    /* Attempt to get next row from statement. */
-    int result = sqlite3_step(it);
+    return it->stmt ? sqlite3_column_count(it->stmt) : 0;
+}
+
+int rdf_next_row(rdf_it_t it, const char **values, int count)
+{
+    sqlite3_stmt *stmt = it->stmt;
+    int result, n;
+
+    if(stmt == NULL)
+        return 0;
+
+    result = sqlite3_step(stmt);
     if(result == SQLITE_ROW)
     {
-        /* New row available; extract data */
-        if(subj_uri)
-            *subj_uri    = sqlite3_column_text(it, 0);
-        if(pred_uri)
-            *pred_uri    = sqlite3_column_text(it, 1);
-        if(obj_lexical)
-            *obj_lexical = sqlite3_column_text(it, 2);
-        if(obj_type)
-            *obj_type    = sqlite3_column_text(it, 3);
-        if(obj_lang)
-            *obj_lang    = sqlite3_column_text(it, 4);
+        for(n = 0; n < count; ++n)
+            values[n] = (const char*)sqlite3_column_text(stmt, n);
 
         return 1;
     }
     else
     {
-        /* End of result set, or error occured. */
-        sqlite3_finalize(it);
+        release_it(it);
 
         return (result == SQLITE_DONE) ? 0 : -1;
     }
 }
 
-void rdf_cancel(rdf_it_t it)
-{
-    sqlite3_finalize(it);
-}
-
 void rdf_purge(db_t db)
 {
+    /* Cached terms may refer to nodes that are about to be deleted;
+       other handles clear theirs when they see the new generation. */
+    tc_clear(db->cache);
+    if(!db->batch && begin(db) != 0)
+        return;
+    bump_generation(db);
+
+    /* All candidates for rdf_gc() are examined below. */
+    sqlite3_exec(db->db, "DELETE FROM Garbage;", NULL, NULL, NULL);
+
     /* Delete unused nodes */
     sqlite3_exec(db->db,
         "DELETE FROM Node WHERE id NOT IN"
@@ -461,6 +3963,106 @@ void rdf_purge(db_t db)
         "DELETE FROM Literal WHERE id NOT IN ( SELECT object FROM triple );",
         NULL, NULL, NULL );
 
-    /* Vacuum database to reclaim freed up space. */
+    if(!db->batch && commit(db) != 0)
+        rollback(db);
+
+    /* Vacuum database to reclaim freed up space. This also switches
+       databases created before rdf_gc() existed to incremental vacuum. */
     sqlite3_exec(db->db, "VACUUM;", NULL, NULL, NULL);
+
+    /* The filter still holds the deleted terms and triples. */
+    if(db->filter_flags)
+        build_filter(db);
+}
+
+int rdf_db_stats(db_t db, struct rdf_op_stats *stats, int count)
+{
+    int n;
+
+    for(n = 0; n < count && n < OPERATIONS; ++n)
+    {
+        stats[n].name    = op_names[n];
+        stats[n].count   = db->ops[n].count;
+        stats[n].seconds = 1e-9*db->ops[n].nanoseconds;
+        memcpy( stats[n].latency, db->ops[n].latency,
+                sizeof(stats[n].latency) );
+    }
+
+    return OPERATIONS;
+}
+
+void rdf_db_stats_reset(db_t db)
+{
+    memset(db->ops, 0, sizeof(db->ops));
+}
+
+/* Returns the upper bound (in microseconds) of the histogram bucket that
+   holds the given fraction of timed operations, or -1 if none were timed. */
+static double percentile(const struct op_stats *ops, double fraction)
+{
+    long long total = 0, seen = 0;
+    int b;
+
+    for(b = 0; b < RDF_LATENCY_BUCKETS; ++b)
+        total += ops->latency[b];
+    if(total == 0)
+        return -1;
+
+    for(b = 0; b < RDF_LATENCY_BUCKETS - 1; ++b)
+        if((seen += ops->latency[b]) >= fraction*total)
+            break;
+
+    return 1e-3*((long long)1 << b);
+}
+
+void rdf_db_stats_dump(db_t db, FILE *fp)
+{
+    int n;
+
+    fprintf(fp, "operation\tcount\tseconds\tp50_us\tp99_us\n");
+    for(n = 0; n < OPERATIONS; ++n)
+    {
+        const struct op_stats *ops = &db->ops[n];
+
+        if(ops->count == 0)
+            continue;
+        fprintf( fp, "%s\t%lld\t%.6f", op_names[n], ops->count,
+                 1e-9*ops->nanoseconds );
+        if(percentile(ops, 0.50) < 0)
+            fprintf(fp, "\t-\t-\n");     /* counted, but not timed */
+        else
+            fprintf( fp, "\t%.3f\t%.3f\n", percentile(ops, 0.50),
+                     percentile(ops, 0.99) );
+    }
+    fflush(fp);
+}
+
+void rdf_db_stats_interval(db_t db, FILE *fp, double seconds)
+{
+    db->dump_fp       = fp;
+    db->dump_interval = (long long)(1e9*seconds);
+    db->dump_next     = clock_ns() + db->dump_interval;
+}
+
+int rdf_gc(db_t db, double seconds)
+{
+    long long deadline = clock_ns() + (long long)(1e9*seconds);
+    long long pages;
+    char sql[64];
+    int count;
+
+    /* Delete unused terms first, since that frees pages. */
+    do {
+        if((count = collect_batch(db)) < 0)
+            return -1;
+    } while(count == GC_BATCH && clock_ns() < deadline);
+    if(count == GC_BATCH)
+        return 1;
+
+    sprintf(sql, "PRAGMA incremental_vacuum(%d)", GC_VACUUM_PAGES);
+    while((pages = free_pages(db)) > 0 && clock_ns() < deadline)
+        if(sqlite3_exec(db->db, sql, NULL, NULL, NULL) != SQLITE_OK)
+            return -1;
+
+    return (pages > 0) ? 1 : (int)pages;
 }
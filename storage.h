@@ -1,6 +1,9 @@
 #ifndef STORAGE_H_INCLUDED
 #define STORAGE_H_INCLUDED
 
+#include <stddef.h>
+#include <stdio.h>
+
 /*
     DATA TYPES
 */
@@ -8,8 +11,57 @@
 struct db;
 typedef struct db *db_t;
 
-struct sqlite3_stmt;
-typedef struct sqlite3_stmt *rdf_it_t;
+struct rdf_it;
+typedef struct rdf_it *rdf_it_t;
+
+/* Identifier of a node (resource or literal) in the database */
+typedef long long int nid_t;
+
+/* Statistics on the triples with a given predicate */
+struct rdf_pred_stats
+{
+    long long triples;          /* number of triples */
+    long long subjects;         /* number of distinct subjects */
+    long long objects;          /* number of distinct objects */
+};
+
+/* Column arrays filled by rdf_next_batch(), indexed by result column:
+   for rdf_find(), subject, predicate, object, object type and language
+   terms; for rdf_find_ids(), subject, predicate and object identifiers.
+   Arrays left NULL are not filled. */
+struct rdf_batch
+{
+    nid_t       *ids[3];
+    const char  **terms[5];
+    size_t      *lengths[5];    /* string lengths; 0 for NULL terms */
+};
+
+/* Options for rdf_db_open_ex(). Zero fields keep SQLite's (or rdfdb's)
+   defaults; rdf_db_options() fills in one of the RDF_PROFILE_* sets. */
+struct rdf_options
+{
+    int         flags;          /* RDF_OPEN_* flags */
+    long long   cache_size;     /* bytes of SQLite page cache */
+    long long   mmap_size;      /* bytes of the file to read through mmap() */
+    int         journal;        /* RDF_JOURNAL_* mode */
+    int         synchronous;    /* RDF_SYNC_* level */
+    size_t      term_cache;     /* bytes of term cache (see rdf_cache_size) */
+    long long   autocommit;     /* batch size (see rdf_autocommit) */
+};
+
+/* Latency histograms have a bucket per power of two nanoseconds: bucket n
+   counts operations that took less than 2^n ns (and at least half that);
+   the last bucket also counts all slower ones. */
+#define RDF_LATENCY_BUCKETS (32)
+
+/* Counters of an instrumented operation */
+struct rdf_op_stats
+{
+    const char  *name;
+    long long   count;
+    double      seconds;                        /* total time taken */
+    long long   latency[RDF_LATENCY_BUCKETS];
+};
 
 /*
     CONSTANTS
@@ -17,16 +69,141 @@ typedef struct sqlite3_stmt *rdf_it_t;
 
 extern const char * const uri_type;
 
+/* Indices on triples, named after their column order */
+#define RDF_INDEX_SPO       (1)
+#define RDF_INDEX_POS       (2)
+#define RDF_INDEX_OSP       (4)
+#define RDF_INDEX_DEFAULT   (RDF_INDEX_SPO | RDF_INDEX_POS | RDF_INDEX_OSP)
+
+/* Flags for rdf_db_open_flags() */
+#define RDF_OPEN_READONLY   (1)     /* never write to the database */
+#define RDF_OPEN_WAL        (2)     /* use a write-ahead log */
+#define RDF_OPEN_MMAP       (4)     /* open a store built by rdf_mmap_build() */
+#define RDF_OPEN_BLOOM      (8)     /* filter lookups of absent terms and
+                                       triples; see rdf_filter_rebuild() */
+#define RDF_OPEN_BLOOM_SAVE (16)    /* RDF_OPEN_BLOOM, keeping the filter in
+                                       the database between sessions */
+
+/* Journal modes for struct rdf_options. RDF_JOURNAL_WAL is the same as the
+   RDF_OPEN_WAL flag. Read-only handles cannot change the journal mode. */
+#define RDF_JOURNAL_DEFAULT     (0) /* keep the database's journal mode */
+#define RDF_JOURNAL_DELETE      (1)
+#define RDF_JOURNAL_TRUNCATE    (2)
+#define RDF_JOURNAL_PERSIST     (3)
+#define RDF_JOURNAL_MEMORY      (4) /* a crash may corrupt the database */
+#define RDF_JOURNAL_WAL         (5)
+
+/* Synchronous levels for struct rdf_options */
+#define RDF_SYNC_DEFAULT        (0) /* FULL, unless changed at compile time */
+#define RDF_SYNC_OFF            (1) /* a crash may corrupt the database */
+#define RDF_SYNC_NORMAL         (2) /* with WAL, commits may be lost on a
+                                       power failure, but not corrupted */
+#define RDF_SYNC_FULL           (3)
+
+/* Option profiles for rdf_db_options() */
+#define RDF_PROFILE_DEFAULT     (0) /* same as rdf_db_open() */
+#define RDF_PROFILE_BULK_LOAD   (1) /* fast loading; a crash loses it all */
+#define RDF_PROFILE_OLTP        (2) /* many small durable transactions */
+#define RDF_PROFILE_READ_REPLICA (3) /* read-only, large caches */
+
+/* Stands for a position bound to a value not known in advance */
+#define RDF_ID_BOUND        ((nid_t)-1)
+
 /*
     FUNCTION DECLARATIONS
 */
 
 db_t rdf_db_open(const char *filepath);
 
+/* Opens a database with the given RDF_OPEN_* flags. A handle may only be
+   used by one thread at a time, but different threads can use handles on
+   the same database. With RDF_OPEN_WAL, readers do not block the writer
+   or each other, and see the database as of the start of each statement;
+   handles wait for locks held by others rather than failing right away.
+   A read-only handle cannot create the database or its indices. See
+   dbpool.h for sharing handles among threads. */
+db_t rdf_db_open_flags(const char *filepath, int flags);
+
+/* Opens a database with the given options (or the defaults, if NULL).
+   Returns NULL if the database cannot be opened or an option is invalid.
+   The mmap size is capped by SQLite's compile-time maximum. */
+db_t rdf_db_open_ex(const char *filepath, const struct rdf_options *options);
+
+/* Fills in the options of one of the RDF_PROFILE_* profiles, which can be
+   adjusted before calling rdf_db_open_ex(). Returns 0, or -1 if there is
+   no such profile.
+
+   RDF_PROFILE_BULK_LOAD keeps the journal in memory, never syncs, commits
+   every 100,000 triples and uses large caches. RDF_PROFILE_OLTP uses WAL
+   with NORMAL syncing, a moderate page cache and memory-mapped reads.
+   RDF_PROFILE_READ_REPLICA opens the database read-only in WAL mode, with
+   a large page cache and as much of the file memory-mapped as SQLite
+   allows. */
+int rdf_db_options(struct rdf_options *options, int profile);
+
 void rdf_db_close(db_t db);
 
+/* Writes the contents of the database to `path' as an immutable store
+   for read-only replicas, which is opened with the RDF_OPEN_MMAP flag
+   (all other flags and options are then ignored). Such a handle answers
+   rdf_find(), rdf_find_ids(), rdf_exists(), rdf_estimate() and the
+   functions on term identifiers straight from the memory-mapped file,
+   using binary search on sorted, compressed SPO, POS and OSP arrays and a
+   front-coded term dictionary. Its identifiers differ from those of the
+   source database. Writes fail, queries with rdf_query() find nothing,
+   and there are no predicate statistics. The whole database is read into
+   memory while building. Returns 0, or -1 on error. */
+int rdf_mmap_build(db_t db, const char *path);
+
+/* Writes a snapshot of the database to `fp': its nodes and literals with
+   their identifiers, followed by its triples as identifiers, in compact,
+   checksummed blocks that are written (and read back) sequentially, so
+   snapshots can be sent through pipes. Statistics are not included, since
+   rdf_restore() recomputes them, and neither are the terms that rdf_gc()
+   has yet to examine. Returns 0, or -1 on error. */
+int rdf_dump(db_t db, FILE *fp);
+
+/* Loads a snapshot written by rdf_dump() into an empty database, in a
+   single transaction. Terms keep their identifiers. Rows are added in
+   order of identifier with all indices dropped, and the indices are then
+   built by sorting; this is much faster than rdf_insert(). Reads up to
+   the end of the snapshot and no further. Returns 0, or -1 if the
+   snapshot is invalid, the database is not empty, or a transaction or
+   iterator is open. */
+int rdf_restore(db_t db, FILE *fp);
+
+/* Bulk loading into an empty database, as done by rdf_restore().
+   rdf_bulk_begin() opens a transaction and drops all indices. Terms are
+   then added with their identifiers, which must be positive and distinct,
+   followed by distinct triples of these identifiers; adding terms in
+   order of identifier and triples in SPO order is fastest. rdf_bulk_end()
+   builds the indices and statistics and commits if `success' is non-zero,
+   or rolls everything back. Nothing else may be done with the handle in
+   between. All return 0, or -1 on error; once rdf_bulk_begin() has
+   succeeded, rdf_bulk_end() must be called in any case. rdf_bulk_begin()
+   fails if the database is not empty, or if a transaction or iterator is
+   open. */
+int rdf_bulk_begin(db_t db);
+
+int rdf_bulk_term( db_t db, nid_t id, const char *lexical,
+                   const char *type, const char *lang );
+
+int rdf_bulk_triple(db_t db, nid_t subj, nid_t pred, nid_t obj);
+
+int rdf_bulk_end(db_t db, int success);
+
+/* Brings an existing database up to date by building any missing default
+   indices and statistics. This may take a while on large databases. */
 int rdf_db_initialize(db_t db);
 
+/* Returns the set of indices present on the database. */
+int rdf_db_indexes(db_t db);
+
+/* Builds or drops indices so that exactly the given set is present. The SPO
+   index is always kept. rdf_find() chooses among the available indices the
+   best one for each pattern. Fails if an iterator is in use. */
+int rdf_db_set_indexes(db_t db, int flags);
+
 char *rdf_anon_uri( db_t db );
 
 int rdf_insert( db_t db,
@@ -36,6 +213,64 @@ int rdf_insert( db_t db,
                 const char *obj_type,
                 const char *obj_lang );
 
+/* Batch transactions: all inserts between rdf_begin() and rdf_commit() are
+   written in a single transaction. If rdf_autocommit() is set to a positive
+   count, the batch is committed (and a new one started) after every `count'
+   inserted triples. Outside a batch, each rdf_insert() commits by itself.
+   A batch still open when the database is closed is rolled back. */
+int rdf_begin(db_t db);
+
+int rdf_commit(db_t db);
+
+int rdf_rollback(db_t db);
+
+/* Returns non-zero if a batch opened with rdf_begin() is in progress. */
+int rdf_in_batch(db_t db);
+
+void rdf_autocommit(db_t db, long long count);
+
+/* By default a handle allocates node identifiers from an in-memory
+   counter, which it seeds again from the database whenever another
+   connection has committed in the meantime. When several handles write to
+   the same database, rdf_reserve_ids() avoids that by claiming identifiers
+   from the database in ranges of `count'. Identifiers of terms deleted by
+   rdf_purge() or rdf_gc() are never handed out again. */
+int rdf_reserve_ids(db_t db, long long count);
+
+/* Terms are cached in memory to avoid database lookups. The cache uses at
+   most `bytes' bytes (4 MB by default; 0 disables caching). Deleting terms
+   with rdf_purge() or rdf_gc() bumps a generation number in the database; other
+   handles forget their cached terms when they next see it changed, at the
+   start of a transaction or of a lookup outside one. */
+void rdf_cache_size(db_t db, size_t bytes);
+
+void rdf_cache_stats(db_t db, long long *hits, long long *misses);
+
+/* Forgets all cached terms. */
+void rdf_cache_clear(db_t db);
+
+/* With RDF_OPEN_BLOOM, a handle keeps a Bloom filter of the terms and
+   triples in the database, built when it is opened, so that looking up
+   ones that do not exist (in rdf_insert(), rdf_drop(), rdf_exists(),
+   rdf_find() and rdf_term_id()) mostly needs no index lookup. It takes
+   2.5 to 5 bytes per term and triple, and grows by rebuilding it from
+   the database once it holds twice as many elements as it was built for.
+   rdf_purge() rebuilds it as well, to forget deleted elements.
+
+   The filter misses terms and triples added through other connections,
+   so it is dropped as soon as another connection commits a change (which
+   SQLite's data_version shows); this function builds it again. Handles
+   opened with RDF_OPEN_BLOOM_SAVE store the filter in the database when
+   they are closed, and load it instead of building it when opened, as
+   long as no terms or triples were added since; every handle that adds
+   any deletes the saved filter (but other programs writing the database
+   do not). Returns 0, or -1 if the handle has no filter or it cannot be
+   built. */
+int rdf_filter_rebuild(db_t db);
+
+/* rdf_drop(), rdf_exists() and rdf_find() only look up terms; they never
+   write to the database. A term that does not exist yields an empty
+   result. */
 int rdf_drop( db_t db,
                  const char *subj_uri,
                  const char *pred_uri,
@@ -64,6 +299,115 @@ int rdf_next( rdf_it_t it,
               const char **obj_type,
               const char **obj_lang );
 
+/* Reads up to `count' rows at once into the column arrays of `batch',
+   which must have room for that many. Returns the number of rows read,
+   0 at the end of the results (releasing the iterator, like rdf_next()),
+   or -1 on error. Strings remain valid until the next call. */
+int rdf_next_batch(rdf_it_t it, struct rdf_batch *batch, int count);
+
 void rdf_cancel(rdf_it_t it);
 
+/* Access by node identifier. rdf_term_id() returns the identifier of an
+   existing term (a resource if `type' is NULL), or 0 if there is none.
+   rdf_decode_id() does the reverse; the strings remain valid until the
+   next call, and `type' and `lang' are set to NULL for resources.
+   rdf_decode_ids() decodes `count' identifiers at once into the given
+   arrays (any of which may be NULL), with far fewer lookups; unknown
+   identifiers yield NULL. rdf_find_ids() matches triples by identifiers,
+   with 0 matching anything; its results are read with rdf_next_ids(),
+   without looking up any terms. */
+nid_t rdf_term_id( db_t db,
+                   const char *lexical,
+                   const char *type,
+                   const char *lang );
+
+int rdf_decode_id( db_t db,
+                   nid_t id,
+                   const char **lexical,
+                   const char **type,
+                   const char **lang );
+
+int rdf_decode_ids( db_t db,
+                    const nid_t *ids,
+                    int count,
+                    const char **lexical,
+                    const char **type,
+                    const char **lang );
+
+rdf_it_t rdf_find_ids(db_t db, nid_t subj, nid_t pred, nid_t obj);
+
+int rdf_next_ids(rdf_it_t it, nid_t *subj, nid_t *pred, nid_t *obj);
+
+/* Estimates the number of triples matching a pattern of identifiers, where
+   0 matches anything and RDF_ID_BOUND stands for a single, unknown value.
+   Meant for query planning: uses the statistics if available, or samples
+   the matching triples otherwise. Returns -1 on error. */
+double rdf_estimate(db_t db, nid_t subj, nid_t pred, nid_t obj);
+
+/* Statistics are kept per predicate, and updated by rdf_insert() and
+   rdf_drop(). They require the POS and OSP indices; databases created by
+   older versions get them from rdf_db_initialize() or rdf_rebuild_stats().
+   rdf_pred_stats() returns the statistics of a predicate (or the totals
+   over all triples, if `pred' is 0): 1 if found, 0 if the predicate is not
+   used, or -1 if no statistics are available. */
+int rdf_pred_stats(db_t db, nid_t pred, struct rdf_pred_stats *stats);
+
+/* Returns the number of triples with the given predicate and object, if
+   the object is among the most frequent ones kept for that predicate, or
+   -1 otherwise. */
+long long rdf_object_count(db_t db, nid_t pred, nid_t obj);
+
+/* Recomputes the statistics, keeping the `top_k' most frequent objects of
+   each predicate. Fails if the required indices are missing. Other open
+   handles only maintain the new statistics once reopened. */
+int rdf_rebuild_stats(db_t db, int top_k);
+
+/* Runs an SQL query over the database tables (such as one produced by
+   serql_to_sql()). Rows are read with rdf_next_row(), which stores up to
+   `count' column values in `values'; values are NULL for unbound columns,
+   and remain valid until the next call. */
+rdf_it_t rdf_query(db_t db, const char *sql);
+
+int rdf_columns(rdf_it_t it);
+
+int rdf_next_row(rdf_it_t it, const char **values, int count);
+
+/* Deletes all nodes and literals that are not used by any triple, and
+   rewrites the whole database file to reclaim the space. This locks the
+   database for as long as it takes; see rdf_gc() for an alternative. */
+void rdf_purge(db_t db);
+
+/* Reclaims nodes and literals left unused by rdf_drop() incrementally,
+   in transactions that each examine a small number of terms, followed by
+   returning free pages to the file system (for databases that use
+   incremental vacuum, which rdfdb sets up when it creates a database or
+   purges an existing one). Stops after about `seconds' seconds, though
+   always does some work. Returns 1 if there is work left, 0 if not, or -1
+   on error. Terms that were never used by a triple, or that were unused
+   before this function existed, are only deleted by rdf_purge().
+   Examining a term takes a lookup on the subject, predicate and object of
+   the Triple table, which is fast with the default indices. */
+int rdf_gc(db_t db, double seconds);
+
+/* Instrumentation. Every handle counts and times each of its prepared
+   statements, term lookups (hits in the term cache, which are only
+   counted, and dictionary lookups that find the term or not), the
+   insertion of new nodes and literals, and the preparation of find
+   statements. The cost is a few clock readings per database access.
+
+   rdf_db_stats() copies the counters of up to `count' operations into
+   `stats', and returns the number of operations there are.
+   rdf_db_stats_dump() writes the operations used so far as tab-separated
+   rows with counts, total time and the 50th and 99th percentile latencies
+   (as upper bounds of their histogram buckets, or "-" if not timed). With
+   rdf_db_stats_interval(), they are also written to `fp' whenever at
+   least `seconds' have passed since the last time; NULL turns this off. */
+int rdf_db_stats(db_t db, struct rdf_op_stats *stats, int count);
+
+void rdf_db_stats_reset(db_t db);
+
+void rdf_db_stats_dump(db_t db, FILE *fp);
+
+void rdf_db_stats_interval(db_t db, FILE *fp, double seconds);
+
 #endif /* ndef STORAGE_H_INCLUDED */
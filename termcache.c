@@ -0,0 +1,239 @@
+#include "termcache.h"
+#include <string.h>
+
+#define INITIAL_BUCKETS 256
+
+struct tc_entry
+{
+    struct tc_entry *chain;             /* next entry in hash bucket */
+    struct tc_entry *prev, *next;       /* LRU list; most recent first */
+    unsigned        hash;
+    long long       id;
+    size_t          len;
+    char            key[1];
+};
+
+struct termcache
+{
+    struct tc_entry **buckets;
+    size_t          nbuckets;
+    struct tc_entry *head, *tail;
+
+    size_t          entries, bytes, budget;
+    long long       hits, misses;
+};
+
+
+/* FNV-1a hash */
+static unsigned hash_key(const char *key, size_t len)
+{
+    unsigned h = 2166136261u;
+    while(len-- > 0)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    return h;
+}
+
+static size_t entry_size(size_t len)
+{
+    return sizeof(struct tc_entry) + len + sizeof(struct tc_entry*);
+}
+
+static void unlink_lru(termcache_t tc, struct tc_entry *e)
+{
+    if(e->prev)
+        e->prev->next = e->next;
+    else
+        tc->head = e->next;
+
+    if(e->next)
+        e->next->prev = e->prev;
+    else
+        tc->tail = e->prev;
+}
+
+static void push_lru(termcache_t tc, struct tc_entry *e)
+{
+    e->prev = NULL;
+    e->next = tc->head;
+    if(tc->head)
+        tc->head->prev = e;
+    else
+        tc->tail = e;
+    tc->head = e;
+}
+
+static void remove_entry(termcache_t tc, struct tc_entry *e)
+{
+    struct tc_entry **p = &tc->buckets[e->hash % tc->nbuckets];
+
+    while(*p != e)
+        p = &(*p)->chain;
+    *p = e->chain;
+
+    unlink_lru(tc, e);
+    tc->entries -= 1;
+    tc->bytes   -= entry_size(e->len);
+    free(e);
+}
+
+static void evict(termcache_t tc)
+{
+    while(tc->tail && tc->bytes > tc->budget)
+        remove_entry(tc, tc->tail);
+}
+
+static void grow(termcache_t tc)
+{
+    struct tc_entry **buckets, *e;
+    size_t n, nbuckets = 2*tc->nbuckets;
+
+    buckets = (struct tc_entry**)calloc(nbuckets, sizeof(struct tc_entry*));
+    if(buckets == NULL)
+        return;
+
+    for(e = tc->head; e; e = e->next)
+    {
+        n = e->hash % nbuckets;
+        e->chain   = buckets[n];
+        buckets[n] = e;
+    }
+
+    free(tc->buckets);
+    tc->buckets  = buckets;
+    tc->nbuckets = nbuckets;
+}
+
+termcache_t tc_create(size_t budget)
+{
+    termcache_t tc = (termcache_t)malloc(sizeof(struct termcache));
+    if(tc == NULL)
+        return NULL;
+    memset(tc, 0, sizeof(struct termcache));
+
+    tc->nbuckets = INITIAL_BUCKETS;
+    tc->buckets  = (struct tc_entry**)calloc(tc->nbuckets, sizeof(struct tc_entry*));
+    if(tc->buckets == NULL)
+    {
+        free(tc);
+        return NULL;
+    }
+    tc->budget = budget;
+
+    return tc;
+}
+
+void tc_destroy(termcache_t tc)
+{
+    tc_clear(tc);
+    free(tc->buckets);
+    free(tc);
+}
+
+long long tc_lookup(termcache_t tc, const char *key, size_t len)
+{
+    unsigned hash = hash_key(key, len);
+    struct tc_entry *e;
+
+    for(e = tc->buckets[hash % tc->nbuckets]; e; e = e->chain)
+    {
+        if(e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0)
+        {
+            /* Move to front of LRU list */
+            if(e != tc->head)
+            {
+                unlink_lru(tc, e);
+                push_lru(tc, e);
+            }
+            tc->hits += 1;
+            return e->id;
+        }
+    }
+
+    tc->misses += 1;
+    return 0;
+}
+
+void tc_insert(termcache_t tc, const char *key, size_t len, long long id)
+{
+    unsigned hash = hash_key(key, len);
+    struct tc_entry *e, **bucket;
+
+    if(entry_size(len) > tc->budget)
+        return;
+
+    bucket = &tc->buckets[hash % tc->nbuckets];
+    for(e = *bucket; e; e = e->chain)
+    {
+        if(e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0)
+        {
+            e->id = id;
+            return;
+        }
+    }
+
+    if((e = (struct tc_entry*)malloc(sizeof(struct tc_entry) + len)) == NULL)
+        return;
+    e->hash  = hash;
+    e->id    = id;
+    e->len   = len;
+    memcpy(e->key, key, len);
+
+    e->chain = *bucket;
+    *bucket  = e;
+    push_lru(tc, e);
+    tc->entries += 1;
+    tc->bytes   += entry_size(len);
+
+    evict(tc);
+    if(tc->entries > tc->nbuckets)
+        grow(tc);
+}
+
+void tc_remove(termcache_t tc, const char *key, size_t len)
+{
+    unsigned hash = hash_key(key, len);
+    struct tc_entry *e;
+
+    for(e = tc->buckets[hash % tc->nbuckets]; e; e = e->chain)
+    {
+        if(e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0)
+        {
+            remove_entry(tc, e);
+            return;
+        }
+    }
+}
+
+void tc_clear(termcache_t tc)
+{
+    struct tc_entry *e, *next;
+
+    for(e = tc->head; e; e = next)
+    {
+        next = e->next;
+        free(e);
+    }
+    memset(tc->buckets, 0, tc->nbuckets*sizeof(struct tc_entry*));
+    tc->head    = tc->tail = NULL;
+    tc->entries = 0;
+    tc->bytes   = 0;
+}
+
+void tc_resize(termcache_t tc, size_t budget)
+{
+    tc->budget = budget;
+    evict(tc);
+}
+
+void tc_stats( termcache_t tc, long long *hits, long long *misses,
+               size_t *entries, size_t *bytes )
+{
+    if(hits)
+        *hits = tc->hits;
+    if(misses)
+        *misses = tc->misses;
+    if(entries)
+        *entries = tc->entries;
+    if(bytes)
+        *bytes = tc->bytes;
+}
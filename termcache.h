@@ -0,0 +1,36 @@
+#ifndef TERMCACHE_H_INCLUDED
+#define TERMCACHE_H_INCLUDED
+
+#include <stdlib.h>
+
+/* A bounded cache mapping byte-string keys to non-zero identifiers.
+   When the memory used by the cache exceeds its budget, the least
+   recently used entries are evicted. */
+typedef struct termcache *termcache_t;
+
+/* Creates a cache that uses at most `budget' bytes. */
+termcache_t tc_create(size_t budget);
+
+/* Destroys the cache and frees all memory associated with it. */
+void tc_destroy(termcache_t tc);
+
+/* Returns the identifier associated with `key', or 0 if it is not cached. */
+long long tc_lookup(termcache_t tc, const char *key, size_t len);
+
+/* Associates `key' with `id', evicting old entries to stay within budget. */
+void tc_insert(termcache_t tc, const char *key, size_t len, long long id);
+
+/* Removes the entry for `key', if there is one. */
+void tc_remove(termcache_t tc, const char *key, size_t len);
+
+/* Removes all entries from the cache (but keeps the hit/miss counters). */
+void tc_clear(termcache_t tc);
+
+/* Changes the memory budget; entries are evicted if necessary. */
+void tc_resize(termcache_t tc, size_t budget);
+
+/* Retrieves usage statistics; any of the pointers may be NULL. */
+void tc_stats( termcache_t tc, long long *hits, long long *misses,
+               size_t *entries, size_t *bytes );
+
+#endif /* ndef TERMCACHE_H_INCLUDED */
@@ -1,54 +1,53 @@
 #include "storage.h"
+#include "ntriples.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int export_to_ntriples(FILE *fp, rdf_it_t it)
+/* Returns 1 if `copy' holds the same triples as `db', finding each of them
+   with rdf_exists(), or 0 if not. */
+static int same_triples(db_t db, db_t copy)
 {
-    int result;
-    const char *subj_uri, *pred_uri, *obj_lexical, *obj_type, *obj_lang;
+    const char *subj, *pred, *obj, *type, *lang;
+    rdf_it_t it;
+    long long count = 0, found = 0, copied = 0;
 
-    while((result = rdf_next(it, &subj_uri, &pred_uri,
-                                 &obj_lexical, &obj_type, &obj_lang)) > 0)
+    it = rdf_find(db, NULL, NULL, NULL, NULL, NULL);
+    while(rdf_next(it, &subj, &pred, &obj, &type, &lang) > 0)
     {
-        fprintf(fp, "<%s> <%s> ", subj_uri, pred_uri);
-        if(obj_type == NULL)
-            fprintf(fp, "<%s>", obj_lexical);
-        else
-        {
-            const char *p;
-
-            fputc('"', fp);
-            for(p = obj_lexical; *p; ++p)
-            {
-                if(*p == '\\')
-                    fputs("\\\\", fp);
-                else
-                if(*p == '"')
-                    fputs("\\\"", fp);
-                else
-                if(*p == 0x0A)
-                    fputs("\\n", fp);
-                else
-                if(*p == 0x0D)
-                    fputs("\\r", fp);
-                else
-                if(*p == 0x09)
-                    fputs("\\t", fp);
-                else
-                    fputc(*p, fp);
-            }
-            fputc('"', fp);
-        }
-        fprintf(fp, "\n");
+        ++count;
+        if(rdf_exists(copy, subj, pred, obj, type, lang) == 1)
+            ++found;
     }
 
-    return result;
+    it = rdf_find(copy, NULL, NULL, NULL, NULL, NULL);
+    while(rdf_next(it, &subj, &pred, &obj, &type, &lang) > 0)
+        ++copied;
+
+    return count > 0 && found == count && copied == count;
+}
+
+/* Returns how often the database handle did an instrumented operation. */
+static long long op_count(db_t db, const char *name)
+{
+    struct rdf_op_stats stats[64];
+    int n, count = rdf_db_stats(db, stats, 64);
+
+    for(n = 0; n < count && n < 64; ++n)
+        if(strcmp(stats[n].name, name) == 0)
+            return stats[n].count;
+
+    return 0;
 }
 
 int main()
 {
+    static const char *gone[2]  = { "old", "older" };
+    static const char *added[2] = { "new", "newer" };
+    FILE *fp;
+    db_t copy;
+    int n;
     db_t db = rdf_db_open("test.dat");
     if(db)
     {
@@ -57,7 +56,98 @@ int main()
         printf("%d\n", rdf_insert(db, "foo", "bar", "hallo", "", "nl"));
         printf("%d\n", rdf_insert(db, "foo", "bar", "w\raa\nbar", "", "nl"));
 
-        export_to_ntriples(stdout, rdf_find(db, NULL, NULL, NULL, NULL, NULL));
+        rdf_write_ntriples(stdout, rdf_find(db, NULL, NULL, NULL, NULL, NULL));
+
+        /* Round trip through the N-Triples loader */
+        if((fp = tmpfile()))
+        {
+            rdf_write_ntriples(fp, rdf_find(db, NULL, NULL, NULL, NULL, NULL));
+            fputs("<foo> <bar> \"caf\\u00E9\"@fr .\n", fp);
+            fputs("<foo> <bar> _:b1 .\n", fp);
+            fputs("not a triple\n", fp);
+            rewind(fp);
+            printf("%lld\n", rdf_load_ntriples(db, fp, NULL));
+            fclose(fp);
+        }
+
+        rdf_write_ntriples(stdout, rdf_find(db, NULL, NULL, NULL, NULL, NULL));
+
+        /* Same triples in an immutable memory-mapped store */
+        remove("test.mm");
+        copy = NULL;
+        if(rdf_mmap_build(db, "test.mm") == 0)
+            copy = rdf_db_open_flags("test.mm", RDF_OPEN_MMAP);
+        printf("mmstore %d\n", copy != NULL && same_triples(db, copy));
+        if(copy)
+        {
+            rdf_write_ntriples(stdout, rdf_find(copy, NULL, "bar", "hallo", "", "nl"));
+            rdf_db_close(copy);
+        }
+        remove("test.mm");
+
+        /* Same triples after a snapshot is restored into a new database */
+        remove("test_restore.dat");
+        copy = NULL;
+        if((fp = tmpfile()))
+        {
+            if(rdf_dump(db, fp) == 0)
+            {
+                rewind(fp);
+                if((copy = rdf_db_open("test_restore.dat")) && rdf_restore(copy, fp) != 0)
+                {
+                    rdf_db_close(copy);
+                    copy = NULL;
+                }
+            }
+            fclose(fp);
+        }
+        printf("restore %d\n", copy != NULL && same_triples(db, copy));
+        if(copy)
+            rdf_db_close(copy);
+        remove("test_restore.dat");
+
+        /* Same answers through a Bloom filter, including for a triple of
+           existing terms and a term that do not exist, which the filter
+           should rule out */
+        if((copy = rdf_db_open_flags("test.dat", RDF_OPEN_BLOOM)))
+        {
+            printf("bloom %d\n", same_triples(db, copy));
+            printf("%d %d\n", rdf_exists(copy, "foo", "bar", "foo", NULL, NULL),
+                              rdf_exists(db, "foo", "bar", "foo", NULL, NULL));
+            printf("%d %d\n", rdf_exists(copy, "foo", "missing", "baz", "", ""),
+                              rdf_exists(db, "foo", "missing", "baz", "", ""));
+            printf("%d\n", op_count(copy, "filter_negative") > 0);
+            rdf_db_close(copy);
+        }
+
+        /* A term cached by one handle is deleted through another, with
+           rdf_purge() and then rdf_gc(), and a third handle adds a term;
+           the first handle must not insert triples with the stale
+           identifier, and the new term must not get it either */
+        for(n = 0; n < 2; ++n)
+        {
+            db_t other;
+
+            if((copy = rdf_db_open("test.dat")) == NULL)
+                break;
+            rdf_insert(db, gone[n], "bar", "baz", "", "");
+            rdf_exists(copy, gone[n], "bar", "baz", "", "");
+            rdf_drop(db, gone[n], "bar", "baz", "", "");
+            if(n == 0)
+                rdf_purge(db);
+            else
+                while(rdf_gc(db, 1.0) > 0)
+                    ;
+            if((other = rdf_db_open("test.dat")))
+            {
+                rdf_insert(other, added[n], "bar", "baz", "", "");
+                rdf_db_close(other);
+            }
+            rdf_insert(copy, gone[n], "bar", "keep", "", "");
+            printf("cache %d", rdf_exists(db, gone[n], "bar", "keep", "", ""));
+            printf(" %d\n", rdf_exists(db, added[n], "bar", "keep", "", ""));
+            rdf_db_close(copy);
+        }
 
         rdf_db_close(db);
     }